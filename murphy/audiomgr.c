@@ -75,16 +75,32 @@ typedef struct {
     uint16_t    state;
 } domain_t;
 
+typedef struct {
+    int                  nreg;
+    int                  nunreg;
+    int                  size;
+    am_method           *regm;
+    am_nodereg_data    **regd;
+    am_method           *unregm;
+    am_nodeunreg_data  **unregd;
+} batch_t;
+
 
 struct pa_audiomgr {
     domain_t      domain;
     pa_hashmap   *nodes;        /**< nodes ie. sinks and sources */
     pa_hashmap   *conns;        /**< connections */
+    int           batching;     /**< begin_batch() nesting level */
+    batch_t       batch;        /**< (un)registrations while batching */
 };
 
 
 static void *node_hash(mir_direction, uint16_t);
 static void *conn_hash(uint16_t);
+static void batch_grow(batch_t *);
+static void batch_flush(struct userdata *, pa_audiomgr *);
+static void nodereg_data_free(am_nodereg_data *);
+static void nodeunreg_data_free(am_nodeunreg_data *);
 
 
 struct pa_audiomgr *pa_audiomgr_init(struct userdata *u)
@@ -113,6 +129,14 @@ void pa_audiomgr_done(struct userdata *u)
         if (u->routerif && am->domain.id != AM_ID_INVALID)
             pa_routerif_unregister_domain(u, am->domain.id);
 
+        am->batching = 0;
+        batch_flush(u, am);
+
+        pa_xfree(am->batch.regm);
+        pa_xfree(am->batch.regd);
+        pa_xfree(am->batch.unregm);
+        pa_xfree(am->batch.unregd);
+
         pa_hashmap_free(am->nodes, NULL,NULL);
         pa_hashmap_free(am->conns, NULL,NULL);
         pa_xfree((void *)am->domain.name);
@@ -155,13 +179,17 @@ void pa_audiomgr_domain_registered(struct userdata   *u,
     pa_assert_se((am = u->audiomgr));
 
 
+    pa_xfree((void *)am->domain.name);
+
     am->domain.name  = pa_xstrdup(dr->name);
     am->domain.id    = id;
     am->domain.state = state;
 
     pa_log_debug("start domain registration for '%s' domain", dr->name);
     
+    pa_audiomgr_begin_batch(u);
     pa_discover_domain_up(u);
+    pa_audiomgr_end_batch(u);
     
     pa_log_debug("domain registration for '%s' domain is complete", dr->name);
 
@@ -227,6 +255,14 @@ void pa_audiomgr_register_node(struct userdata *u, mir_node *node)
                 rd->mute = MS_UNMUTED;
                 method = audiomgr_register_sink;
             }
+
+            if (am->batching) {
+                batch_grow(&am->batch);
+                am->batch.regm[am->batch.nreg] = method;
+                am->batch.regd[am->batch.nreg] = rd;
+                am->batch.nreg++;
+                return;
+            }
             
             success = pa_routerif_register_node(u, method, rd);
             
@@ -237,6 +273,7 @@ void pa_audiomgr_register_node(struct userdata *u, mir_node *node)
             else {
                 pa_log("%s: failed to register node '%s' (%p)"
                        "to audio manager", __FILE__, rd->name, node);
+                nodereg_data_free(rd);
             }
         }
     }
@@ -269,9 +306,7 @@ void pa_audiomgr_node_registered(struct userdata *u,
         pa_hashmap_put(am->nodes, key, node);
     }
 
-    pa_xfree((void *)rd->key);
-    pa_xfree((void *)rd->name);
-    pa_xfree((void *)rd);
+    nodereg_data_free(rd);
 }
 
 void pa_audiomgr_unregister_node(struct userdata *u, mir_node *node)
@@ -316,6 +351,13 @@ void pa_audiomgr_unregister_node(struct userdata *u, mir_node *node)
         else
             method = audiomgr_deregister_sink;
         
+        if (am->batching) {
+            batch_grow(&am->batch);
+            am->batch.unregm[am->batch.nunreg] = method;
+            am->batch.unregd[am->batch.nunreg] = ud;
+            am->batch.nunreg++;
+            return;
+        }
         
         success = pa_routerif_unregister_node(u, method, ud);
         
@@ -326,6 +368,7 @@ void pa_audiomgr_unregister_node(struct userdata *u, mir_node *node)
         else {
             pa_log("%s: failed to unregister node '%s' (%p)"
                    "from audio manager", __FILE__, node->amname, node);
+            nodeunreg_data_free(ud);
         }
     }
 }
@@ -338,8 +381,29 @@ void pa_audiomgr_node_unregistered(struct userdata   *u,
     /* can't do too much here anyways,
        since the node is gone already */
 
-    pa_xfree((void *)ud->name);
-    pa_xfree((void *)ud);
+    nodeunreg_data_free(ud);
+}
+
+void pa_audiomgr_begin_batch(struct userdata *u)
+{
+    pa_audiomgr *am;
+
+    pa_assert(u);
+    pa_assert_se((am = u->audiomgr));
+
+    am->batching++;
+}
+
+void pa_audiomgr_end_batch(struct userdata *u)
+{
+    pa_audiomgr *am;
+
+    pa_assert(u);
+    pa_assert_se((am = u->audiomgr));
+    pa_assert(am->batching > 0);
+
+    if (--am->batching == 0)
+        batch_flush(u, am);
 }
 
 
@@ -415,6 +479,100 @@ void pa_audiomgr_disconnect(struct userdata *u, am_connect_data *cd)
     pa_routerif_acknowledge(u, audiomgr_disconnect, &ad);
 }
 
+static void batch_grow(batch_t *b)
+{
+    size_t size;
+
+    pa_assert(b);
+
+    if (b->nreg < b->size && b->nunreg < b->size)
+        return;
+
+    b->size = b->size ? b->size * 2 : 16;
+
+    size = sizeof(am_method) * b->size;
+    b->regm   = pa_xrealloc(b->regm,   size);
+    b->unregm = pa_xrealloc(b->unregm, size);
+
+    b->regd   = pa_xrealloc(b->regd,   sizeof(am_nodereg_data *)   * b->size);
+    b->unregd = pa_xrealloc(b->unregd, sizeof(am_nodeunreg_data *) * b->size);
+}
+
+static void batch_flush(struct userdata *u, pa_audiomgr *am)
+{
+    batch_t *b;
+    int nsent;
+    int i;
+
+    pa_assert(u);
+    pa_assert(am);
+
+    b = &am->batch;
+
+    /*
+     * the routing interface hands over the successfully sent entries and
+     * NULLs them out in the array; whatever remains has failed
+     */
+    if (b->nunreg > 0) {
+        if (!u->routerif)
+            nsent = 0;
+        else {
+            nsent = pa_routerif_unregister_nodes(u, b->nunreg,
+                                                 b->unregm, b->unregd);
+        }
+
+        pa_log_debug("unregistered %d/%d nodes from audio manager",
+                     nsent, b->nunreg);
+
+        for (i = 0;  i < b->nunreg;  i++) {
+            if (b->unregd[i]) {
+                pa_log("%s: failed to unregister node '%s' from audio "
+                       "manager", __FILE__, b->unregd[i]->name);
+                nodeunreg_data_free(b->unregd[i]);
+            }
+        }
+
+        b->nunreg = 0;
+    }
+
+    if (b->nreg > 0) {
+        if (!u->routerif)
+            nsent = 0;
+        else
+            nsent = pa_routerif_register_nodes(u, b->nreg, b->regm, b->regd);
+
+        pa_log_debug("initiated registration of %d/%d nodes to audio manager",
+                     nsent, b->nreg);
+
+        for (i = 0;  i < b->nreg;  i++) {
+            if (b->regd[i]) {
+                pa_log("%s: failed to register node '%s' to audio manager",
+                       __FILE__, b->regd[i]->name);
+                nodereg_data_free(b->regd[i]);
+            }
+        }
+
+        b->nreg = 0;
+    }
+}
+
+static void nodereg_data_free(am_nodereg_data *rd)
+{
+    if (rd) {
+        pa_xfree((void *)rd->key);
+        pa_xfree((void *)rd->name);
+        pa_xfree((void *)rd);
+    }
+}
+
+static void nodeunreg_data_free(am_nodeunreg_data *ud)
+{
+    if (ud) {
+        pa_xfree((void *)ud->name);
+        pa_xfree((void *)ud);
+    }
+}
+
 static void *node_hash(mir_direction direction, uint16_t amid)
 {
     return NULL + ((uint32_t)direction << 16 | (uint32_t)amid);
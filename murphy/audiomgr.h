@@ -122,6 +122,9 @@ void pa_audiomgr_node_registered(struct userdata *, uint16_t, uint16_t,
 void pa_audiomgr_unregister_node(struct userdata *, mir_node *);
 void pa_audiomgr_node_unregistered(struct userdata *, am_nodeunreg_data *);
 
+void pa_audiomgr_begin_batch(struct userdata *);
+void pa_audiomgr_end_batch(struct userdata *);
+
 void pa_audiomgr_connect(struct userdata *, am_connect_data *);
 void pa_audiomgr_disconnect(struct userdata *, am_connect_data *);
 
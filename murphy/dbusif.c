@@ -22,8 +22,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <pulse/mainloop.h>
+
 #include <pulsecore/pulsecore-config.h>
 #include <pulsecore/dbus-shared.h>
+#include <pulsecore/dbus-util.h>
+#include <pulsecore/shared.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/asyncq.h>
 
 #include "userdata.h"
 #include "dbusif.h"
@@ -54,6 +62,9 @@
 #define POLICY_ACTIONS              "audio_actions"
 #define POLICY_STATUS               "status"
 
+#define WORKER_QUEUE_SIZE           256
+#define WORKER_BATCH_MAX            32
+
 #define PROP_ROUTE_SINK_TARGET      "policy.sink_route.target"
 #define PROP_ROUTE_SINK_MODE        "policy.sink_route.mode"
 #define PROP_ROUTE_SINK_HWID        "policy.sink_route.hwid"
@@ -66,7 +77,17 @@
 
 typedef void (*pending_cb_t)(struct userdata *, const char *,
                              DBusMessage *, void *);
-typedef pa_bool_t (*method_t)(struct userdata *, DBusMessage *);
+typedef pa_bool_t (*method_t)(DBusMessage *, struct am_connect_data *);
+
+typedef enum {
+    CMD_SEND = 1,               /* main -> worker: send a message */
+    CMD_SEND_WITH_REPLY,        /* main -> worker: send and await reply */
+    CMD_QUIT,                   /* main -> worker: stop the worker */
+    CMD_REPLY,                  /* worker -> main: reply to a pending call */
+    CMD_NAME_CHANGE,            /* worker -> main: NameOwnerChanged */
+    CMD_CONNECT,                /* worker -> main: AudioManager connect */
+    CMD_DISCONNECT,             /* worker -> main: AudioManager disconnect */
+} cmd_type;
 
 
 struct pending {
@@ -94,6 +115,48 @@ struct pa_routerif {
     int                 mregist;  /* are we registered to murphy */
     int                 amisup;   /* is the audio manager up */
     PA_LLIST_HEAD(struct pending, pendlist);
+    DBusConnection     *dbusconn; /* conn, or the private one of the worker */
+    struct worker      *worker;   /* D-Bus worker thread, if any */
+    pa_hashmap         *nodemsg;  /* marshalled node registrations by name */
+    DBusMessage        *ackmsg[audiomgr_method_dim]; /* ack templates */
+};
+
+/*
+ * When running threaded, the D-Bus connection is driven by a mainloop
+ * of its own in a worker thread. The worker replies to the incoming
+ * method calls and decodes them into commands; the main thread picks
+ * up the commands in bounded batches from a deferred event. Outgoing
+ * messages are marshalled in the main thread and handed to the worker
+ * for sending. Both directions use lock-free single-producer queues.
+ */
+struct worker {
+    pa_mainloop_api         *mainapi;  /* PulseAudio main loop */
+    pa_mainloop             *mainloop; /* mainloop of the worker thread */
+    pa_dbus_wrap_connection *conn;     /* private connection of the worker */
+    pa_thread               *thread;
+    pa_asyncq               *inq;      /* main thread -> worker */
+    pa_asyncq               *outq;     /* worker -> main thread */
+    pa_io_event             *inev;     /* worker: inq got readable */
+    pa_io_event             *outwev;   /* worker: outq got writable */
+    pa_io_event             *outev;    /* main: outq got readable */
+    pa_defer_event          *batch;    /* main: process a batch of outq */
+};
+
+struct command {
+    cmd_type                 type;
+    DBusMessage             *msg;      /* message to send, or reply */
+    struct pending          *pdata;    /* pending call of a reply */
+    char                    *name;     /* NameOwnerChanged arguments */
+    char                    *before;
+    char                    *after;
+    struct am_connect_data   ac;       /* AudioManager (dis)connect */
+};
+
+struct nodemsg {                /* cached node registration message */
+    char               *name;
+    am_method           method;
+    am_nodereg_data     data;     /* values the message was built of */
+    DBusMessage        *msg;
 };
 
 
@@ -142,11 +205,41 @@ static void free_routerif(pa_routerif *,struct userdata *);
 static pa_bool_t send_message_with_reply(struct userdata *, 
                                          DBusConnection *, DBusMessage *,
                                          pending_cb_t, void *);
+static pa_bool_t send_message(pa_routerif *, DBusConnection *,
+                              DBusMessage *);
+static void flush_messages(pa_routerif *, DBusConnection *);
+static void complete_pending(struct userdata *, struct pending *,
+                             DBusMessage *);
+
+static pa_bool_t dbus_in_use(pa_core *);
+static struct worker *worker_new(pa_mainloop_api *, DBusBusType,
+                                 DBusError *);
+static pa_bool_t worker_start(struct userdata *, struct worker *);
+static void worker_stop(struct worker *);
+static void worker_free(struct worker *);
+static void worker_thread(void *);
+static void worker_post(pa_asyncq *, struct command *);
+static void worker_send(struct worker *, struct command *);
+static void worker_inq_cb(pa_mainloop_api *, pa_io_event *, int,
+                          pa_io_event_flags_t, void *);
+static void worker_write_cb(pa_mainloop_api *, pa_io_event *, int,
+                            pa_io_event_flags_t, void *);
+static void worker_execute(struct worker *, struct command *);
+static void worker_pending_cb(DBusPendingCall *, void *);
+static void main_outq_cb(pa_mainloop_api *, pa_io_event *, int,
+                         pa_io_event_flags_t, void *);
+static void main_batch_cb(pa_mainloop_api *, pa_defer_event *, void *);
+static void main_execute(struct userdata *, struct command *);
+static void free_command(void *);
 
 
 static DBusHandlerResult filter(DBusConnection *, DBusMessage *, void *);
 
 static void handle_admin_message(struct userdata *, DBusMessage *);
+static pa_bool_t decode_name_change(DBusMessage *, const char **,
+                                    const char **, const char **);
+static void handle_name_change(struct userdata *, const char *,
+                               const char *, const char *);
 #if 0
 static void handle_info_message(struct userdata *, DBusMessage *);
 static void handle_action_message(struct userdata *, DBusMessage *);
@@ -174,8 +267,15 @@ static pa_bool_t build_sound_properties(DBusMessageIter *,
                                         struct am_nodereg_data *);
 static pa_bool_t build_connection_formats(DBusMessageIter *,
                                           struct am_nodereg_data *);
-static pa_bool_t routerif_connect(struct userdata *, DBusMessage *);
-static pa_bool_t routerif_disconnect(struct userdata *, DBusMessage *);
+static pa_bool_t routerif_connect(DBusMessage *, struct am_connect_data *);
+static pa_bool_t routerif_disconnect(DBusMessage *,struct am_connect_data *);
+
+static DBusMessage *cached_node_message(pa_routerif *, am_method,
+                                        am_nodereg_data *);
+static void cache_node_message(pa_routerif *, am_method, am_nodereg_data *,
+                               DBusMessage *);
+static void uncache_node_message(pa_routerif *, const char *);
+static void free_nodemsg(void *, void *);
 
 static const char *method_str(am_method);
 
@@ -186,7 +286,8 @@ pa_routerif *pa_routerif_init(struct userdata *u,
                               const char      *mrppath,
                               const char      *mrpnam,
                               const char      *ampath,
-                              const char      *amnam)
+                              const char      *amnam,
+                              pa_bool_t        threaded)
 {
     static const DBusObjectPathVTable  vtable = {
         .message_function = audiomgr_method_handler,
@@ -221,19 +322,54 @@ pa_routerif *pa_routerif_init(struct userdata *u,
         return NULL;
     }
     
+    /*
+     * libdbus can be made thread safe only before it creates any object.
+     * A bus connection shared by other modules means it is too late for
+     * that, so in that case D-Bus stays in the main thread.
+     */
+    if (threaded) {
+        if (dbus_in_use(m->core)) {
+            pa_log_info("%s: D-Bus is already in use in this process; not "
+                        "moving it to a separate thread", __FILE__);
+            threaded = FALSE;
+        }
+        else if (!dbus_threads_init_default()) {
+            pa_log("%s: failed to initialize D-Bus threading", __FILE__);
+            return NULL;
+        }
+    }
+
     routerif = pa_xnew0(pa_routerif, 1);
     PA_LLIST_HEAD_INIT(struct pending, routerif->pendlist);
+    routerif->nodemsg = pa_hashmap_new(pa_idxset_string_hash_func,
+                                       pa_idxset_string_compare_func);
 
     dbus_error_init(&error);
-    routerif->conn = pa_dbus_bus_get(m->core, type, &error);
 
-    if (routerif->conn == NULL || dbus_error_is_set(&error)) {
-        pa_log("%s: failed to get %s Bus: %s: %s",
-               __FILE__, dbustype, error.name, error.message);
-        goto fail;
+    if (!threaded) {
+        routerif->conn = pa_dbus_bus_get(m->core, type, &error);
+
+        if (routerif->conn == NULL || dbus_error_is_set(&error)) {
+            pa_log("%s: failed to get %s Bus: %s: %s",
+                   __FILE__, dbustype, error.name, error.message);
+            goto fail;
+        }
+
+        dbusconn = pa_dbus_connection_get(routerif->conn);
+    }
+    else {
+        routerif->worker = worker_new(m->core->mainloop, type, &error);
+
+        if (routerif->worker == NULL || dbus_error_is_set(&error)) {
+            pa_log("%s: failed to get private %s Bus: %s: %s",
+                   __FILE__, dbustype, error.name, error.message);
+            goto fail;
+        }
+
+        dbusconn = pa_dbus_wrap_connection_get(routerif->worker->conn);
     }
 
-    dbusconn = pa_dbus_connection_get(routerif->conn);
+    routerif->dbusconn = dbusconn;
 
     flags  = DBUS_NAME_FLAG_REPLACE_EXISTING | DBUS_NAME_FLAG_DO_NOT_QUEUE;
     result = dbus_bus_request_name(dbusconn, PULSE_DBUS_NAME, flags,&error);
@@ -344,6 +480,16 @@ pa_routerif *pa_routerif_init(struct userdata *u,
 
     u->routerif = routerif; /* Argh.. */
 
+    if (routerif->worker) {
+        if (!worker_start(u, routerif->worker)) {
+            pa_log("%s: failed to start D-Bus worker thread", __FILE__);
+            u->routerif = NULL;
+            goto fail;
+        }
+
+        pa_log_info("%s: D-Bus is handled in a worker thread", __FILE__);
+    }
+
     register_to_murphy(u);
     register_to_audiomgr(u);
 
@@ -359,16 +505,21 @@ static void free_routerif(pa_routerif *routerif, struct userdata *u)
 {
     DBusConnection  *dbusconn;
     struct pending  *p, *n;
+    int              i;
 
     if (routerif) {
 
-        if (routerif->conn) {
-            dbusconn = pa_dbus_connection_get(routerif->conn);
+        /* after this nothing runs on the worker's connection any more */
+        if (routerif->worker)
+            worker_stop(routerif->worker);
 
+        if ((dbusconn = routerif->dbusconn)) {
             PA_LLIST_FOREACH_SAFE(p,n, routerif->pendlist) {
                 PA_LLIST_REMOVE(struct pending, routerif->pendlist, p);
-                dbus_pending_call_set_notify(p->call, NULL,NULL, NULL);
-                dbus_pending_call_unref(p->call);
+                if (p->call) {
+                    dbus_pending_call_set_notify(p->call, NULL,NULL, NULL);
+                    dbus_pending_call_unref(p->call);
+                }
             }
 
             if (u) {
@@ -379,9 +530,12 @@ static void free_routerif(pa_routerif *routerif, struct userdata *u)
             dbus_bus_remove_match(dbusconn, routerif->admarule, NULL);
             dbus_bus_remove_match(dbusconn, routerif->actrule, NULL);
             dbus_bus_remove_match(dbusconn, routerif->strrule, NULL);
+        }
 
+        if (routerif->worker)
+            worker_free(routerif->worker);
+        else if (routerif->conn)
             pa_dbus_connection_unref(routerif->conn);
-        }
 
         pa_xfree(routerif->ifnam);
         pa_xfree(routerif->mrppath);
@@ -395,6 +549,14 @@ static void free_routerif(pa_routerif *routerif, struct userdata *u)
         pa_xfree(routerif->actrule);
         pa_xfree(routerif->strrule);
 
+        if (routerif->nodemsg)
+            pa_hashmap_free(routerif->nodemsg, free_nodemsg, NULL);
+
+        for (i = 0;  i < audiomgr_method_dim;  i++) {
+            if (routerif->ackmsg[i])
+                dbus_message_unref(routerif->ackmsg[i]);
+        }
+
         pa_xfree(routerif);
     }
 }
@@ -412,11 +574,23 @@ static DBusHandlerResult filter(DBusConnection *conn, DBusMessage *msg,
                                 void *arg)
 {
     struct userdata  *u = arg;
+    struct worker    *w = u->routerif ? u->routerif->worker : NULL;
+    struct command   *cmd;
+    const char       *name, *before, *after;
 
     if (dbus_message_is_signal(msg, ADMIN_DBUS_INTERFACE,
                                ADMIN_NAME_OWNER_CHANGED))
     {
-        handle_admin_message(u, msg);
+        if (!w)
+            handle_admin_message(u, msg);
+        else if (decode_name_change(msg, &name, &before, &after)) {
+            cmd = pa_xnew0(struct command, 1);
+            cmd->type   = CMD_NAME_CHANGE;
+            cmd->name   = pa_xstrdup(name);
+            cmd->before = pa_xstrdup(before);
+            cmd->after  = pa_xstrdup(after);
+            worker_post(w->outq, cmd);
+        }
         return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
 
@@ -439,26 +613,44 @@ static DBusHandlerResult filter(DBusConnection *conn, DBusMessage *msg,
 
 static void handle_admin_message(struct userdata *u, DBusMessage *msg)
 {
-    pa_routerif *routerif;
-    char        *name;
-    char        *before;
-    char        *after;
-    int          success;
+    const char *name;
+    const char *before;
+    const char *after;
 
-    pa_assert(u);
-    pa_assert_se((routerif = u->routerif));
+    if (decode_name_change(msg, &name, &before, &after))
+        handle_name_change(u, name, before, after);
+}
+
+static pa_bool_t decode_name_change(DBusMessage *msg, const char **name,
+                                    const char **before, const char **after)
+{
+    int success;
+
+    pa_assert(msg);
 
     success = dbus_message_get_args(msg, NULL,
-                                    DBUS_TYPE_STRING, &name,
-                                    DBUS_TYPE_STRING, &before,
-                                    DBUS_TYPE_STRING, &after,
+                                    DBUS_TYPE_STRING, name,
+                                    DBUS_TYPE_STRING, before,
+                                    DBUS_TYPE_STRING, after,
                                     DBUS_TYPE_INVALID);
 
-    if (!success || !name) {
+    if (!success || !*name) {
         pa_log("Received malformed '%s' message", ADMIN_NAME_OWNER_CHANGED);
-        return;
+        return FALSE;
     }
 
+    return TRUE;
+}
+
+static void handle_name_change(struct userdata *u, const char *name,
+                               const char *before, const char *after)
+{
+    pa_routerif *routerif;
+
+    pa_assert(u);
+    pa_assert(name);
+    pa_assert_se((routerif = u->routerif));
+
     if (!strcmp(name, routerif->mrpnam)) {
         if (after && strcmp(after, "")) {
             pa_log_debug("murphy is up");
@@ -499,24 +691,37 @@ static void reply_cb(DBusPendingCall *pend, void *data)
 {
     struct pending  *pdata = (struct pending *)data;
     struct userdata *u;
-    pa_routerif     *routerif;
     DBusMessage     *reply;
 
     pa_assert(pdata);
     pa_assert(pdata->call == pend);
     pa_assert_se((u = pdata->u));
+
+    reply = dbus_pending_call_steal_reply(pend);
+
+    complete_pending(u, pdata, reply);
+
+    if (reply)
+        dbus_message_unref(reply);
+}
+
+static void complete_pending(struct userdata *u, struct pending *pdata,
+                             DBusMessage *reply)
+{
+    pa_routerif *routerif;
+
+    pa_assert(u);
+    pa_assert(pdata);
     pa_assert_se((routerif = u->routerif));
 
     PA_LLIST_REMOVE(struct pending, routerif->pendlist, pdata);
 
-    if ((reply = dbus_pending_call_steal_reply(pend)) == NULL) {
+    if (reply == NULL) {
         pa_log("%s: Murphy pending call '%s' failed: invalid argument",
                __FILE__, pdata->method);
     }
-    else {
+    else
         pdata->cb(u, pdata->method, reply, pdata->data);
-        dbus_message_unref(reply);
-    }
 
     pa_xfree((void *)pdata->method);
     pa_xfree((void *)pdata);
@@ -530,6 +735,7 @@ static pa_bool_t send_message_with_reply(struct userdata *u,
 {
     pa_routerif     *routerif;
     struct pending  *pdata = NULL;
+    struct command  *cmd;
     const char      *method;
     DBusPendingCall *pend;
 
@@ -550,6 +756,15 @@ static pa_bool_t send_message_with_reply(struct userdata *u,
 
     PA_LLIST_PREPEND(struct pending, routerif->pendlist, pdata);
 
+    if (routerif->worker) {
+        cmd = pa_xnew0(struct command, 1);
+        cmd->type  = CMD_SEND_WITH_REPLY;
+        cmd->msg   = dbus_message_ref(msg);
+        cmd->pdata = pdata;
+        worker_send(routerif->worker, cmd);
+        return TRUE;
+    }
+
     if (!dbus_connection_send_with_reply(conn, msg, &pend, -1)) {
         pa_log("%s: Failed to %s", __FILE__, method);
         goto failed;
@@ -574,6 +789,453 @@ static pa_bool_t send_message_with_reply(struct userdata *u,
     return FALSE;
 }
 
+static pa_bool_t send_message(pa_routerif    *routerif,
+                              DBusConnection *conn,
+                              DBusMessage    *msg)
+{
+    struct command *cmd;
+
+    pa_assert(routerif);
+    pa_assert(conn);
+    pa_assert(msg);
+
+    if (!routerif->worker)
+        return dbus_connection_send(conn, msg, NULL);
+
+    cmd = pa_xnew0(struct command, 1);
+    cmd->type = CMD_SEND;
+    cmd->msg  = dbus_message_ref(msg);
+    worker_send(routerif->worker, cmd);
+
+    return TRUE;
+}
+
+static void flush_messages(pa_routerif *routerif, DBusConnection *conn)
+{
+    pa_assert(routerif);
+    pa_assert(conn);
+
+    /* the worker pushes out whatever it gets without us blocking on it */
+    if (!routerif->worker)
+        dbus_connection_flush(conn);
+}
+
+
+/**************************************************************************
+ *
+ * D-Bus worker thread
+ *
+ */
+static pa_bool_t dbus_in_use(pa_core *core)
+{
+    /* the names pa_dbus_bus_get() shares its connections with */
+    static const char *shared[] = {
+        "dbus-connection-session",
+        "dbus-connection-system",
+        "dbus-connection-starter"
+    };
+
+    size_t i;
+
+    pa_assert(core);
+
+    for (i = 0;  i < PA_ELEMENTSOF(shared);  i++) {
+        if (pa_shared_get(core, shared[i]))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static struct worker *worker_new(pa_mainloop_api *mainapi, DBusBusType type,
+                                 DBusError *error)
+{
+    struct worker *w;
+
+    pa_assert(mainapi);
+
+    w = pa_xnew0(struct worker, 1);
+    w->mainapi  = mainapi;
+    w->mainloop = pa_mainloop_new();
+
+    if (!(w->conn = pa_dbus_wrap_connection_new(pa_mainloop_get_api(
+                                                    w->mainloop),
+                                                TRUE, type, error)))
+    {
+        pa_mainloop_free(w->mainloop);
+        pa_xfree(w);
+        return NULL;
+    }
+
+    dbus_connection_set_exit_on_disconnect(
+                       pa_dbus_wrap_connection_get(w->conn), FALSE);
+
+    return w;
+}
+
+static pa_bool_t worker_start(struct userdata *u, struct worker *w)
+{
+    pa_mainloop_api *api;
+
+    pa_assert(u);
+    pa_assert(w);
+    pa_assert_se((api = pa_mainloop_get_api(w->mainloop)));
+
+    w->inq  = pa_asyncq_new(WORKER_QUEUE_SIZE);
+    w->outq = pa_asyncq_new(WORKER_QUEUE_SIZE);
+
+    if (!w->inq || !w->outq)
+        return FALSE;
+
+    w->inev   = api->io_new(api, pa_asyncq_read_fd(w->inq), PA_IO_EVENT_INPUT,
+                            worker_inq_cb, w);
+    w->outwev = api->io_new(api, pa_asyncq_write_fd(w->outq),
+                            PA_IO_EVENT_INPUT, worker_write_cb, w->outq);
+
+    w->outev  = w->mainapi->io_new(w->mainapi, pa_asyncq_read_fd(w->outq),
+                                   PA_IO_EVENT_INPUT, main_outq_cb, u);
+    w->batch  = w->mainapi->defer_new(w->mainapi, main_batch_cb, u);
+
+    w->mainapi->defer_enable(w->batch, FALSE);
+
+    /* both queues are empty, so the readers can start waiting */
+    pa_asyncq_read_before_poll(w->inq);
+    pa_asyncq_read_before_poll(w->outq);
+
+    if (!(w->thread = pa_thread_new("murphy-dbus", worker_thread, w)))
+        return FALSE;
+
+    return TRUE;
+}
+
+static void worker_stop(struct worker *w)
+{
+    struct command *cmd;
+
+    pa_assert(w);
+
+    if (w->thread) {
+        /* queued behind everything we sent before, eg. the unregistration */
+        cmd = pa_xnew0(struct command, 1);
+        cmd->type = CMD_QUIT;
+        worker_send(w, cmd);
+
+        pa_thread_free(w->thread);
+        w->thread = NULL;
+    }
+
+    /* whatever the worker left behind will never be processed */
+    if (w->outq) {
+        while ((cmd = pa_asyncq_pop(w->outq, FALSE)))
+            free_command(cmd);
+    }
+
+    if (w->outev) {
+        w->mainapi->io_free(w->outev);
+        w->outev = NULL;
+    }
+
+    if (w->batch) {
+        w->mainapi->defer_free(w->batch);
+        w->batch = NULL;
+    }
+}
+
+static void worker_free(struct worker *w)
+{
+    pa_mainloop_api *api;
+
+    pa_assert(w);
+    pa_assert(!w->thread);
+    pa_assert_se((api = pa_mainloop_get_api(w->mainloop)));
+
+    if (w->conn)
+        pa_dbus_wrap_connection_free(w->conn);
+
+    if (w->inev)
+        api->io_free(w->inev);
+    if (w->outwev)
+        api->io_free(w->outwev);
+
+    if (w->inq)
+        pa_asyncq_free(w->inq, free_command);
+    if (w->outq)
+        pa_asyncq_free(w->outq, free_command);
+
+    pa_mainloop_free(w->mainloop);
+
+    pa_xfree(w);
+}
+
+static void worker_thread(void *data)
+{
+    struct worker *w = (struct worker *)data;
+    int            retval;
+
+    pa_assert(w);
+
+    pa_log_debug("%s: D-Bus worker thread started", __FILE__);
+
+    if (pa_mainloop_run(w->mainloop, &retval) < 0)
+        pa_log("%s: D-Bus worker mainloop failed", __FILE__);
+
+    pa_log_debug("%s: D-Bus worker thread exiting", __FILE__);
+}
+
+static void worker_post(pa_asyncq *q, struct command *cmd)
+{
+    pa_assert(q);
+    pa_assert(cmd);
+
+    /*
+     * a full queue makes pa_asyncq_post() keep the command locally;
+     * (re)arm the write side so that it gets pushed out as soon as
+     * the reader makes room for it
+     */
+    pa_asyncq_post(q, cmd);
+    pa_asyncq_write_after_poll(q);
+    pa_asyncq_write_before_poll(q);
+}
+
+static void worker_send(struct worker *w, struct command *cmd)
+{
+    pa_assert(w);
+    pa_assert(cmd);
+
+    /*
+     * the main thread never leaves anything in the local queue of inq:
+     * a command stuck there would never reach the worker once we are
+     * blocked joining it. The worker doesn't block on anything but D-Bus
+     * I/O, so waiting for room here is short.
+     */
+    pa_asyncq_push(w->inq, cmd, TRUE);
+}
+
+static void worker_write_cb(pa_mainloop_api     *api,
+                            pa_io_event         *e,
+                            int                  fd,
+                            pa_io_event_flags_t  events,
+                            void                *data)
+{
+    pa_asyncq *q = (pa_asyncq *)data;
+
+    (void)api;
+    (void)e;
+    (void)fd;
+    (void)events;
+
+    pa_assert(q);
+
+    pa_asyncq_write_after_poll(q);
+    pa_asyncq_write_before_poll(q);
+}
+
+static void worker_inq_cb(pa_mainloop_api     *api,
+                          pa_io_event         *e,
+                          int                  fd,
+                          pa_io_event_flags_t  events,
+                          void                *data)
+{
+    struct worker  *w = (struct worker *)data;
+    struct command *cmd;
+
+    (void)api;
+    (void)e;
+    (void)fd;
+    (void)events;
+
+    pa_assert(w);
+
+    pa_asyncq_read_after_poll(w->inq);
+
+    for (;;) {
+        while ((cmd = pa_asyncq_pop(w->inq, FALSE)))
+            worker_execute(w, cmd);
+
+        if (pa_asyncq_read_before_poll(w->inq) >= 0)
+            break;
+    }
+}
+
+static void worker_execute(struct worker *w, struct command *cmd)
+{
+    DBusConnection  *conn;
+    DBusPendingCall *pend;
+    struct pending  *pdata;
+    const char      *method;
+
+    pa_assert(w);
+    pa_assert(cmd);
+    pa_assert_se((conn = pa_dbus_wrap_connection_get(w->conn)));
+
+    switch (cmd->type) {
+
+    case CMD_SEND:
+        if (!dbus_connection_send(conn, cmd->msg, NULL)) {
+            pa_log("%s: Failed to send D-Bus message '%s'", __FILE__,
+                   dbus_message_get_member(cmd->msg));
+        }
+        break;
+
+    case CMD_SEND_WITH_REPLY:
+        pdata  = cmd->pdata;
+        method = pdata->method;
+
+        if (!dbus_connection_send_with_reply(conn, cmd->msg, &pend, -1) ||
+            !pend)
+        {
+            pa_log("%s: Failed to %s", __FILE__, method);
+            pend = NULL;
+        }
+        else if (!dbus_pending_call_set_notify(pend, worker_pending_cb,
+                                               pdata, NULL))
+        {
+            pa_log("%s: Can't set notification for %s", __FILE__, method);
+            dbus_pending_call_cancel(pend);
+            dbus_pending_call_unref(pend);
+            pend = NULL;
+        }
+
+        if ((pdata->call = pend) == NULL) {
+            /* let the main thread know that there will be no reply */
+            dbus_message_unref(cmd->msg);
+            cmd->msg  = NULL;
+            cmd->type = CMD_REPLY;
+            worker_post(w->outq, cmd);
+            return;
+        }
+        break;
+
+    case CMD_QUIT:
+        /* the last messages (eg. domain unregistration) must get out */
+        dbus_connection_flush(conn);
+        pa_mainloop_quit(w->mainloop, 0);
+        break;
+
+    default:
+        pa_log("%s: invalid command %d to D-Bus worker",__FILE__,cmd->type);
+        break;
+    }
+
+    free_command(cmd);
+}
+
+static void worker_pending_cb(DBusPendingCall *pend, void *data)
+{
+    struct pending  *pdata = (struct pending *)data;
+    struct worker   *w;
+    struct command  *cmd;
+
+    pa_assert(pdata);
+    pa_assert(pdata->call == pend);
+    pa_assert_se((w = pdata->u->routerif->worker));
+
+    cmd = pa_xnew0(struct command, 1);
+    cmd->type  = CMD_REPLY;
+    cmd->msg   = dbus_pending_call_steal_reply(pend);
+    cmd->pdata = pdata;
+
+    pdata->call = NULL;
+    dbus_pending_call_unref(pend);
+
+    worker_post(w->outq, cmd);
+}
+
+static void main_outq_cb(pa_mainloop_api     *api,
+                         pa_io_event         *e,
+                         int                  fd,
+                         pa_io_event_flags_t  events,
+                         void                *data)
+{
+    struct userdata *u = (struct userdata *)data;
+    struct worker   *w;
+
+    (void)e;
+    (void)fd;
+    (void)events;
+
+    pa_assert(u);
+    pa_assert_se((w = u->routerif->worker));
+
+    pa_asyncq_read_after_poll(w->outq);
+    api->defer_enable(w->batch, TRUE);
+}
+
+static void main_batch_cb(pa_mainloop_api *api, pa_defer_event *e, void *data)
+{
+    struct userdata *u = (struct userdata *)data;
+    struct worker   *w;
+    struct command  *cmd;
+    int              i;
+
+    pa_assert(u);
+    pa_assert_se((w = u->routerif->worker));
+
+    /*
+     * process at most a batch worth of commands per main loop iteration
+     * however much the worker has queued up, so a flood from the D-Bus
+     * peer can't starve the rest of the main loop
+     */
+    for (i = 0;  i < WORKER_BATCH_MAX;  i++) {
+        if (!(cmd = pa_asyncq_pop(w->outq, FALSE))) {
+            if (pa_asyncq_read_before_poll(w->outq) >= 0)
+                api->defer_enable(e, FALSE);
+            return;
+        }
+
+        main_execute(u, cmd);
+        free_command(cmd);
+
+        if (!u->routerif || u->routerif->worker != w)
+            return;
+    }
+}
+
+static void main_execute(struct userdata *u, struct command *cmd)
+{
+    pa_assert(u);
+    pa_assert(cmd);
+
+    switch (cmd->type) {
+
+    case CMD_REPLY:
+        complete_pending(u, cmd->pdata, cmd->msg);
+        break;
+
+    case CMD_NAME_CHANGE:
+        handle_name_change(u, cmd->name, cmd->before, cmd->after);
+        break;
+
+    case CMD_CONNECT:
+        pa_audiomgr_connect(u, &cmd->ac);
+        break;
+
+    case CMD_DISCONNECT:
+        pa_audiomgr_disconnect(u, &cmd->ac);
+        break;
+
+    default:
+        pa_log("%s: invalid command %d from D-Bus worker",
+               __FILE__, cmd->type);
+        break;
+    }
+}
+
+static void free_command(void *data)
+{
+    struct command *cmd = (struct command *)data;
+
+    if (cmd) {
+        if (cmd->msg)
+            dbus_message_unref(cmd->msg);
+
+        pa_xfree(cmd->name);
+        pa_xfree(cmd->before);
+        pa_xfree(cmd->after);
+        pa_xfree(cmd);
+    }
+}
+
 
 /**************************************************************************
  *
@@ -587,7 +1249,7 @@ void pa_routerif_send_device_state(struct userdata *u, char *state,
     static char     *path = (char *)"/org/tizen/policy/info";
 
     pa_routerif     *routerif = u->routerif;
-    DBusConnection  *conn = pa_dbus_connection_get(routerif->conn);
+    DBusConnection  *conn = routerif->dbusconn;
     DBusMessage     *msg;
     DBusMessageIter  mit;
     DBusMessageIter  dit;
@@ -621,7 +1283,7 @@ void pa_routerif_send_device_state(struct userdata *u, char *state,
 
     dbus_message_iter_close_container(&mit, &dit);
 
-    sts = dbus_connection_send(conn, msg, NULL);
+    sts = send_message(routerif, conn, msg);
 
     if (!sts) {
         pa_log("%s: Can't send info message: out of memory", __FILE__);
@@ -638,7 +1300,7 @@ void pa_routerif_send_media_status(struct userdata *u, const char *media,
     static const char  *type = "media";
 
     pa_routerif    *routerif = u->routerif;
-    DBusConnection *conn   = pa_dbus_connection_get(routerif->conn);
+    DBusConnection *conn   = routerif->dbusconn;
     DBusMessage    *msg;
     const char     *state;
     int             success;
@@ -660,7 +1322,7 @@ void pa_routerif_send_media_status(struct userdata *u, const char *media,
         if (!success)
             pa_log("%s: Can't build D-Bus info message", __FILE__);
         else {
-            if (!dbus_connection_send(conn, msg, NULL)) {
+            if (!send_message(routerif, conn, msg)) {
                 pa_log("%s: Can't send info message: out of memory", __FILE__);
             }
         }
@@ -871,7 +1533,7 @@ static pa_bool_t register_to_murphy(struct userdata *u)
     static const char *name = "pulseaudio";
 
     pa_routerif    *routerif = u->routerif;
-    DBusConnection *conn   = pa_dbus_connection_get(routerif->conn);
+    DBusConnection *conn   = routerif->dbusconn;
     DBusMessage    *msg;
     const char     *signals[4];
     const char    **v_ARRAY;
@@ -918,7 +1580,7 @@ static pa_bool_t register_to_murphy(struct userdata *u)
 static int signal_status(struct userdata *u, uint32_t txid, uint32_t status)
 {
     pa_routerif    *routerif = u->routerif;
-    DBusConnection *conn = pa_dbus_connection_get(routerif->conn);
+    DBusConnection *conn = routerif->dbusconn;
     DBusMessage    *msg;
     char            path[256];
     int             ret;
@@ -955,7 +1617,7 @@ static int signal_status(struct userdata *u, uint32_t txid, uint32_t status)
         goto fail;
     }
 
-    ret = dbus_connection_send(conn, msg, NULL);
+    ret = send_message(routerif, conn, msg);
 
     if (!ret) {
         pa_log("%s: Can't send status message: out of memory", __FILE__);
@@ -985,15 +1647,17 @@ static DBusHandlerResult audiomgr_method_handler(DBusConnection *conn,
     struct dispatch {
         const char *name;
         method_t    method;
+        cmd_type    cmd;
     };
 
     static struct dispatch dispatch_tbl[] = {
-        { AUDIOMGR_CONNECT   , routerif_connect    },
-        { AUDIOMGR_DISCONNECT, routerif_disconnect },
-        {        NULL,                 NULL        }
+        { AUDIOMGR_CONNECT   , routerif_connect   , CMD_CONNECT    },
+        { AUDIOMGR_DISCONNECT, routerif_disconnect, CMD_DISCONNECT },
+        {        NULL,                 NULL       ,       0        }
     };
 
     struct userdata         *u = (struct userdata *)arg;
+    struct worker           *w = u->routerif ? u->routerif->worker : NULL;
     struct dispatch         *d;
     const char              *name;
     method_t                 method;
@@ -1001,6 +1665,8 @@ static DBusHandlerResult audiomgr_method_handler(DBusConnection *conn,
     dbus_int16_t             errcod;
     DBusMessage             *reply;
     pa_bool_t                success;
+    struct command          *cmd;
+    struct am_connect_data   ac;
 
     pa_assert(conn);
     pa_assert(msg);
@@ -1036,10 +1702,22 @@ static DBusHandlerResult audiomgr_method_handler(DBusConnection *conn,
 
         dbus_message_unref(reply);
 
-        if (method)
-            d->method(u, msg);
-        else
+        if (!method)
             pa_log_info("%s: unsupported '%s' method ignored", __FILE__, name);
+        else if (d->method(msg, &ac)) {
+            if (!w) {
+                if (d->cmd == CMD_CONNECT)
+                    pa_audiomgr_connect(u, &ac);
+                else
+                    pa_audiomgr_disconnect(u, &ac);
+            }
+            else {
+                cmd = pa_xnew0(struct command, 1);
+                cmd->type = d->cmd;
+                cmd->ac   = ac;
+                worker_post(w->outq, cmd);
+            }
+        }
                 
         return DBUS_HANDLER_RESULT_HANDLED;
     }
@@ -1120,7 +1798,7 @@ pa_bool_t pa_routerif_register_domain(struct userdata   *u,
     pa_assert(u);
     pa_assert(dr);
     pa_assert_se((routerif = u->routerif));
-    pa_assert_se((conn = pa_dbus_connection_get(routerif->conn)));
+    pa_assert_se((conn = routerif->dbusconn));
 
     pa_log_info("%s: registering to AudioManager: name='%s' path='%s' if='%s'"
                 , __FILE__, routerif->amnam, routerif->amrpath, routerif->amrnam);
@@ -1179,7 +1857,7 @@ pa_bool_t pa_routerif_domain_complete(struct userdata *u, uint16_t domain)
 
     pa_assert(u);
     pa_assert_se((routerif = u->routerif));
-    pa_assert_se((conn = pa_dbus_connection_get(routerif->conn)));
+    pa_assert_se((conn = routerif->dbusconn));
     
 
     pa_log_debug("%s: domain %u AudioManager %s", __FUNCTION__,
@@ -1205,12 +1883,12 @@ pa_bool_t pa_routerif_domain_complete(struct userdata *u, uint16_t domain)
         goto getout;
     }
 
-    if (!dbus_connection_send(conn, msg, NULL)) {
+    if (!send_message(routerif, conn, msg)) {
         pa_log("%s: Failed to send '%s'", __FILE__, AUDIOMGR_DOMAIN_COMPLETE);
         goto getout;
     }
 
-    dbus_connection_flush(conn);
+    flush_messages(routerif, conn);
 
  getout:
     dbus_message_unref(msg);
@@ -1226,7 +1904,7 @@ pa_bool_t pa_routerif_unregister_domain(struct userdata *u, uint16_t domain)
 
     pa_assert(u);
     pa_assert_se((routerif = u->routerif));
-    pa_assert_se((conn = pa_dbus_connection_get(routerif->conn)));
+    pa_assert_se((conn = routerif->dbusconn));
 
     pa_log_info("%s: deregistreing domain %u from AudioManager",
                 __FILE__, domain);
@@ -1253,12 +1931,12 @@ pa_bool_t pa_routerif_unregister_domain(struct userdata *u, uint16_t domain)
         goto getout;
     }
 
-    if (!dbus_connection_send(conn, msg, NULL)) {
+    if (!send_message(routerif, conn, msg)) {
         pa_log("%s: Failed to send '%s'", __FILE__,AUDIOMGR_DEREGISTER_DOMAIN);
         goto getout;
     }
 
-    dbus_connection_flush(conn);
+    flush_messages(routerif, conn);
 
  getout:
     dbus_message_unref(msg);
@@ -1394,10 +2072,18 @@ pa_bool_t pa_routerif_register_node(struct userdata *u,
     pa_assert(u);
     pa_assert(rd);
     pa_assert_se((routerif = u->routerif));
-    pa_assert_se((conn = pa_dbus_connection_get(routerif->conn)));
+    pa_assert_se((conn = routerif->dbusconn));
 
     pa_log_debug("%s: %s '%s' to AudioManager", __FUNCTION__, method,rd->name);
 
+    /*
+     * nodes are re-registered with identical data on every audio manager
+     * restart and availability change; if we have sent this very same
+     * registration before, just copy the marshalled message
+     */
+    if ((msg = cached_node_message(routerif, m, rd)))
+        goto send;
+
     msg = dbus_message_new_method_call(routerif->amnam, routerif->amrpath,
                                        routerif->amrnam, method);
     
@@ -1457,7 +2143,9 @@ pa_bool_t pa_routerif_register_node(struct userdata *u,
 #undef CONT_OPEN
 #undef MSG_APPEND
 
+    cache_node_message(routerif, m, rd, msg);
 
+ send:
     success = send_message_with_reply(u, conn, msg,
                                       audiomgr_register_node_cb, rd);
     if (!success) {
@@ -1466,10 +2154,127 @@ pa_bool_t pa_routerif_register_node(struct userdata *u,
     }
     
  getout:
-    dbus_message_unref(msg);
+    if (msg)
+        dbus_message_unref(msg);
     return success;
 }
 
+static DBusMessage *cached_node_message(pa_routerif *routerif, am_method m,
+                                        am_nodereg_data *rd)
+{
+    struct nodemsg *nm;
+    am_nodereg_data *cd;
+
+    pa_assert(routerif);
+    pa_assert(rd);
+    pa_assert(rd->name);
+
+    if (!(nm = pa_hashmap_get(routerif->nodemsg, rd->name)))
+        return NULL;
+
+    cd = &nm->data;
+
+    if (nm->method       != m                ||
+        cd->id           != rd->id           ||
+        cd->domain       != rd->domain       ||
+        cd->class        != rd->class        ||
+        cd->state        != rd->state        ||
+        cd->volume       != rd->volume       ||
+        cd->visible      != rd->visible      ||
+        cd->avail.status != rd->avail.status ||
+        cd->avail.reason != rd->avail.reason ||
+        cd->mute         != rd->mute         ||
+        cd->mainvol      != rd->mainvol      ||
+        cd->interrupt    != rd->interrupt      )
+        return NULL;
+
+    /* the copy is unlocked and has no serial, so it can be sent again */
+    return dbus_message_copy(nm->msg);
+}
+
+static void cache_node_message(pa_routerif *routerif, am_method m,
+                               am_nodereg_data *rd, DBusMessage *msg)
+{
+    struct nodemsg *nm;
+
+    pa_assert(routerif);
+    pa_assert(rd);
+    pa_assert(rd->name);
+    pa_assert(msg);
+
+    if (!(nm = pa_hashmap_get(routerif->nodemsg, rd->name))) {
+        nm = pa_xnew0(struct nodemsg, 1);
+        nm->name = pa_xstrdup(rd->name);
+        pa_hashmap_put(routerif->nodemsg, nm->name, nm);
+    }
+    else if (nm->msg)
+        dbus_message_unref(nm->msg);
+
+    /*
+     * keep a copy of our own: the original is handed over for sending
+     * and may be locked and serialed by the worker thread meanwhile
+     */
+    nm->method = m;
+    nm->data = *rd;
+    nm->data.key = nm->data.name = NULL;
+    nm->msg = dbus_message_copy(msg);
+}
+
+static void uncache_node_message(pa_routerif *routerif, const char *name)
+{
+    struct nodemsg *nm;
+
+    pa_assert(routerif);
+
+    if (name && (nm = pa_hashmap_remove(routerif->nodemsg, name)))
+        free_nodemsg(nm, NULL);
+}
+
+static void free_nodemsg(void *data, void *userdata)
+{
+    struct nodemsg *nm = (struct nodemsg *)data;
+
+    (void)userdata;
+
+    if (nm) {
+        if (nm->msg)
+            dbus_message_unref(nm->msg);
+        pa_xfree(nm->name);
+        pa_xfree(nm);
+    }
+}
+
+int pa_routerif_register_nodes(struct userdata *u,
+                               int n,
+                               am_method *m,
+                               am_nodereg_data **rd)
+{
+    pa_routerif    *routerif;
+    int             i, nsent;
+
+    pa_assert(u);
+    pa_assert(n >= 0);
+    pa_assert(m);
+    pa_assert(rd);
+    pa_assert_se((routerif = u->routerif));
+    pa_assert(routerif->dbusconn);
+
+    /*
+     * AudioManager's routing interface has no bulk registration method.
+     * Queue all the calls without waiting for any of the replies; the
+     * main loop writes them out as soon as the socket is writable, and the
+     * replies are dispatched one by one to audiomgr_register_node_cb().
+     */
+    for (i = nsent = 0;  i < n;  i++) {
+        if (rd[i] && pa_routerif_register_node(u, m[i], rd[i])) {
+            rd[i] = NULL;
+            nsent++;
+        }
+    }
+
+    return nsent;
+}
+
 static void audiomgr_unregister_node_cb(struct userdata *u,
                                         const char      *method,
                                         DBusMessage     *reply,
@@ -1532,10 +2337,13 @@ pa_bool_t pa_routerif_unregister_node(struct userdata *u,
     pa_assert(u);
     pa_assert(ud);
     pa_assert_se((routerif = u->routerif));
-    pa_assert_se((conn = pa_dbus_connection_get(routerif->conn)));
+    pa_assert_se((conn = routerif->dbusconn));
 
     pa_log_debug("%s: %s '%s' to AudioManager", __FUNCTION__, method,ud->name);
 
+    /* the cached registration goes with the node */
+    uncache_node_message(routerif, ud->name);
+
     msg = dbus_message_new_method_call(routerif->amnam, routerif->amrpath,
                                        routerif->amrnam, method);
     
@@ -1556,26 +2364,52 @@ pa_bool_t pa_routerif_unregister_node(struct userdata *u,
     }
     
  getout:
-    dbus_message_unref(msg);
+    if (msg)
+        dbus_message_unref(msg);
     return success;
 }
 
-static pa_bool_t routerif_connect(struct userdata *u, DBusMessage *msg)
+int pa_routerif_unregister_nodes(struct userdata *u,
+                                 int n,
+                                 am_method *m,
+                                 am_nodeunreg_data **ud)
 {
-    struct am_connect_data ac;
-    int                    success;
+    pa_routerif    *routerif;
+    int             i, nsent;
 
     pa_assert(u);
+    pa_assert(n >= 0);
+    pa_assert(m);
+    pa_assert(ud);
+    pa_assert_se((routerif = u->routerif));
+    pa_assert(routerif->dbusconn);
+
+    for (i = nsent = 0;  i < n;  i++) {
+        if (ud[i] && pa_routerif_unregister_node(u, m[i], ud[i])) {
+            ud[i] = NULL;
+            nsent++;
+        }
+    }
+
+    return nsent;
+}
+
+static pa_bool_t routerif_connect(DBusMessage *msg,
+                                  struct am_connect_data *ac)
+{
+    int success;
+
     pa_assert(msg);
+    pa_assert(ac);
 
-    memset(&ac, 0, sizeof(ac));
+    memset(ac, 0, sizeof(*ac));
 
     success = dbus_message_get_args(msg, NULL,
-                                    DBUS_TYPE_UINT16, &ac.handle,
-                                    DBUS_TYPE_UINT16, &ac.connection,
-                                    DBUS_TYPE_UINT16, &ac.source,
-                                    DBUS_TYPE_UINT16, &ac.sink,
-                                    DBUS_TYPE_INT16 , &ac.format,
+                                    DBUS_TYPE_UINT16, &ac->handle,
+                                    DBUS_TYPE_UINT16, &ac->connection,
+                                    DBUS_TYPE_UINT16, &ac->source,
+                                    DBUS_TYPE_UINT16, &ac->sink,
+                                    DBUS_TYPE_INT16 , &ac->format,
                                     DBUS_TYPE_INVALID);
     if (!success) {
         pa_log("%s: got broken connect message from AudioManager. "
@@ -1584,26 +2418,24 @@ static pa_bool_t routerif_connect(struct userdata *u, DBusMessage *msg)
     }
 
     pa_log_debug("AudioManager connect(%u|%u|%u|%u|%d)",
-                 ac.handle, ac.connection, ac.source, ac.sink, ac.format);
-
-    pa_audiomgr_connect(u, &ac);
+                 ac->handle, ac->connection, ac->source, ac->sink,ac->format);
 
     return TRUE;
 }
 
-static pa_bool_t routerif_disconnect(struct userdata *u, DBusMessage *msg)
+static pa_bool_t routerif_disconnect(DBusMessage *msg,
+                                     struct am_connect_data *ac)
 {
-    struct am_connect_data ac;
-    int                    success;
+    int success;
 
-    pa_assert(u);
     pa_assert(msg);
+    pa_assert(ac);
 
-    memset(&ac, 0, sizeof(ac));
+    memset(ac, 0, sizeof(*ac));
 
     success = dbus_message_get_args(msg, NULL,
-                                    DBUS_TYPE_UINT16, &ac.handle,
-                                    DBUS_TYPE_UINT16, &ac.connection,
+                                    DBUS_TYPE_UINT16, &ac->handle,
+                                    DBUS_TYPE_UINT16, &ac->connection,
                                     DBUS_TYPE_INVALID);
     if (!success) {
         pa_log("%s: got broken disconnect message from AudioManager. "
@@ -1611,9 +2443,7 @@ static pa_bool_t routerif_disconnect(struct userdata *u, DBusMessage *msg)
         return FALSE;
     }
 
-    pa_log_debug("AudioManager disconnect(%u|%u)", ac.handle, ac.connection);
-
-    pa_audiomgr_disconnect(u, &ac);
+    pa_log_debug("AudioManager disconnect(%u|%u)",ac->handle,ac->connection);
 
     return TRUE;
 }
@@ -1630,14 +2460,22 @@ pa_bool_t pa_routerif_acknowledge(struct userdata *u, am_method m,
     pa_assert(u);
     pa_assert(method);
     pa_assert_se((routerif = u->routerif));
-    pa_assert_se((conn = pa_dbus_connection_get(routerif->conn)));
+    pa_assert_se((conn = routerif->dbusconn));
 
     pa_log_debug("%s: sending %s", __FILE__, method);
 
-    msg = dbus_message_new_method_call(routerif->amnam,
-                                       routerif->amrpath,
-                                       routerif->amrnam,
-                                       method);
+    /* the header of an ack is always the same; only the body varies */
+    pa_assert(m > audiomgr_unknown_method && m < audiomgr_method_dim);
+
+    if (!routerif->ackmsg[m]) {
+        routerif->ackmsg[m] = dbus_message_new_method_call(routerif->amnam,
+                                                           routerif->amrpath,
+                                                           routerif->amrnam,
+                                                           method);
+    }
+
+    msg = routerif->ackmsg[m] ? dbus_message_copy(routerif->ackmsg[m]) : NULL;
+
     if (msg == NULL) {
         pa_log("%s: Failed to create D-Bus message for '%s'",
                __FILE__, method);
@@ -1656,13 +2494,14 @@ pa_bool_t pa_routerif_acknowledge(struct userdata *u, am_method m,
         goto getout;
     }
 
-    if (!dbus_connection_send(conn, msg, NULL)) {
+    if (!send_message(routerif, conn, msg)) {
         pa_log("%s: Failed to send D-Bus message '%s'", __FILE__, method);
         goto getout;
     }
 
  getout:
-    dbus_message_unref(msg);
+    if (msg)
+        dbus_message_unref(msg);
     return success;
 }
 
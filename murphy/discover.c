@@ -22,6 +22,8 @@
 
 #include <pulsecore/pulsecore-config.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 #include <pulsecore/hashmap.h>
 #include <pulsecore/idxset.h>
 #include <pulsecore/client.h>
@@ -53,6 +55,17 @@
 
 #define ACTIVE_PORT       NULL
 
+#define PROFILE_SWITCH_COST    300  /* msec a switch is assumed to take */
+#define PROFILE_COST_FACTOR     10  /* min. dwell time in switch costs */
+#define PROFILE_MIN_DWELL        2  /* sec a profile is kept at least */
+#define PROFILE_MAX_DWELL       30  /* sec; limit of backing off flapping */
+#define PROFILE_MAX_FLAPS        4
+
+#define STREAM_RESUME_BUDGET     4  /* streams uncorked per tick by default */
+#define STREAM_RESUME_TICK   20000  /* usec between the uncorking ticks */
+#define STREAM_PARKED_TICK  1000000  /* usec between checks of parked ones */
+#define STREAM_RESUME_BUCKET     8
+
 /* Bluetooth service class */
 #define BIT(x)    (1U << (x))
 
@@ -80,8 +93,12 @@ typedef struct {
 
 typedef struct {
     struct userdata *u;
-    uint32_t index;
-} stream_uncork_t;
+    uint32_t         sink;      /**< index of the sink waited for */
+    uint32_t        *streams;   /**< sink-input indexes to uncork */
+    uint32_t         nstream;
+    uint32_t         maxstream;
+    pa_time_event   *timer;
+} stream_resume;
 
 static const char combine_pattern[]   = "Simultaneous output on ";
 static const char loopback_outpatrn[] = "Loopback from ";
@@ -122,12 +139,49 @@ static mir_node_type get_stream_routing_class(pa_proplist *);
 static void set_bluetooth_profile(struct userdata *, mir_node *);
 
 
+typedef struct {
+    char       *key;          /**< "<from profile>><to profile>" */
+    pa_usec_t   usec;         /**< average time a switch took */
+} profile_cost;
+
+typedef struct {
+    struct userdata *u;
+    uint32_t         card;    /**< card index */
+    char            *profile; /**< the profile we last saw active */
+    pa_usec_t        changed; /**< when the profile changed last time */
+    pa_usec_t        dwell;   /**< min. time the current profile is kept */
+    uint32_t         flaps;   /**< back and forth switches in a row */
+    pa_hashmap      *costs;   /**< transition -> profile_cost */
+    uint32_t         recheck; /**< node to reconsider when dwell is over */
+    pa_time_event   *timer;
+} profile_switch;
+
+static profile_switch *get_profile_switch(struct userdata *, pa_card *,
+                                          pa_bool_t);
+static pa_usec_t profile_switch_cost(profile_switch *, const char *,
+                                     const char *);
+static void update_profile_switch_cost(profile_switch *, const char *,
+                                       const char *, pa_usec_t);
+static void profile_switched(struct userdata *, pa_card *);
+static pa_usec_t profile_switch_deferral(struct userdata *, pa_card *,
+                                         const char *);
+static void schedule_profile_recheck(profile_switch *, pa_usec_t, uint32_t);
+static void profile_recheck_cb(pa_mainloop_api *, pa_time_event *,
+                               const struct timeval *, void *);
+static void free_profile_cost(void *, void *);
+static void free_profile_switch(void *, void *);
+
 static void schedule_deferred_routing(struct userdata *);
 static void schedule_card_check(struct userdata *, pa_card *);
 static void schedule_source_cleanup(struct userdata *, mir_node *);
-#if 0
-static void schedule_stream_uncorking(struct userdata *, pa_sink *);
-#endif
+static void schedule_stream_uncorking(struct userdata *,
+                                      pa_sink_input_new_data *, pa_sink *);
+static void stream_resume_put(struct userdata *, pa_sink_input *);
+static void schedule_resume_tick(stream_resume *, pa_usec_t);
+static int resume_priority(struct userdata *, pa_sink_input *);
+static void stream_resume_cb(pa_mainloop_api *, pa_time_event *,
+                             const struct timeval *, void *);
+static void free_stream_resume(void *, void *);
 
 static void pa_hashmap_node_free(void *node, void *u)
 {
@@ -135,7 +189,8 @@ static void pa_hashmap_node_free(void *node, void *u)
 }
 
 
-struct pa_discover *pa_discover_init(struct userdata *u)
+struct pa_discover *pa_discover_init(struct userdata *u,
+                                     const char *uncork_budget_str)
 {
     pa_discover *discover = pa_xnew0(pa_discover, 1);
 
@@ -147,6 +202,19 @@ struct pa_discover *pa_discover_init(struct userdata *u)
                                             pa_idxset_string_compare_func);
     discover->nodes.byptr  = pa_hashmap_new(pa_idxset_trivial_hash_func,
                                             pa_idxset_trivial_compare_func);
+    discover->profsw       = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                            pa_idxset_trivial_compare_func);
+    discover->resume       = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                            pa_idxset_trivial_compare_func);
+    discover->resume_pending = PA_IDXSET_INVALID;
+
+    if (!uncork_budget_str ||
+        pa_atou(uncork_budget_str, &discover->uncork_budget) < 0 ||
+        discover->uncork_budget < 1)
+    {
+        discover->uncork_budget = STREAM_RESUME_BUDGET;
+    }
+
     return discover;
 }
 
@@ -157,6 +225,8 @@ void pa_discover_done(struct userdata *u)
     if (u && (discover = u->discover)) {
         pa_hashmap_free(discover->nodes.byname, pa_hashmap_node_free,u);
         pa_hashmap_free(discover->nodes.byptr, NULL,NULL);
+        pa_hashmap_free(discover->profsw, free_profile_switch, u);
+        pa_hashmap_free(discover->resume, free_stream_resume, u);
         pa_xfree(discover);
         u->discover = NULL;
     }
@@ -199,7 +269,9 @@ void pa_discover_add_card(struct userdata *u, pa_card *card)
     }
 
     if (pa_streq(bus, "pci") || pa_streq(bus, "usb")) {
+        pa_audiomgr_begin_batch(u);
         handle_alsa_card(u, card);
+        pa_audiomgr_end_batch(u);
         return;
     }
     else if (pa_streq(bus, "bluetooth")) {
@@ -213,10 +285,11 @@ void pa_discover_add_card(struct userdata *u, pa_card *card)
 
 void pa_discover_remove_card(struct userdata *u, pa_card *card)
 {
-    const char  *bus;
-    pa_discover *discover;
-    mir_node    *node;
-    void        *state;
+    const char     *bus;
+    pa_discover    *discover;
+    mir_node       *node;
+    profile_switch *psw;
+    void           *state;
 
     pa_assert(u);
     pa_assert(card);
@@ -225,6 +298,9 @@ void pa_discover_remove_card(struct userdata *u, pa_card *card)
     if (!(bus = pa_utils_get_card_bus(card)))
         bus = "<unknown>";
 
+    psw = pa_hashmap_remove(discover->profsw, PA_UINT32_TO_PTR(card->index));
+    free_profile_switch(psw, u);
+
 
     PA_HASHMAP_FOREACH(node, discover->nodes.byname, state) {
         if (node->implement == mir_device &&
@@ -304,6 +380,8 @@ void pa_discover_profile_changed(struct userdata *u, pa_card *card)
         pa_log_debug("bluetooth profile changed to '%s' on card '%s'",
                      prof->name, card->name);
 
+        profile_switched(u, card);
+
         if (!prof->n_sinks && !prof->n_sources) {
             /* switched off but not unloaded yet */
             need_routing = FALSE;
@@ -333,6 +411,8 @@ void pa_discover_profile_changed(struct userdata *u, pa_card *card)
 
         stamp = pa_utils_get_stamp();
 
+        pa_audiomgr_begin_batch(u);
+
         handle_alsa_card(u, card);
 
         PA_HASHMAP_FOREACH(node, discover->nodes.byname, state) {
@@ -343,8 +423,76 @@ void pa_discover_profile_changed(struct userdata *u, pa_card *card)
                 destroy_node(u, node);
             }
         }
+
+        pa_audiomgr_end_batch(u);
+    }
+
+}
+
+pa_bool_t pa_discover_can_switch_profile(struct userdata *u, mir_node *node)
+{
+    pa_core         *core;
+    pa_card         *card;
+    pa_card_profile *prof;
+    profile_switch  *psw;
+    pa_usec_t        defer;
+
+    pa_assert(u);
+    pa_assert(node);
+    pa_assert_se((core = u->core));
+
+    if (node->implement != mir_device || !node->pacard.profile)
+        return TRUE;
+
+    if (node->type != mir_bluetooth_a2dp && node->type != mir_bluetooth_sco)
+        return TRUE;
+
+    if (!(card = pa_idxset_get_by_index(core->cards, node->pacard.index)) ||
+        !(prof = card->active_profile) ||
+        pa_streq(prof->name, node->pacard.profile))
+        return TRUE;
+
+    if (!(defer = profile_switch_deferral(u, card, node->pacard.profile)))
+        return TRUE;
+
+    pa_log_debug("switching '%s' => '%s' on card '%s' is not worth it "
+                 "for another %llu msec", prof->name, node->pacard.profile,
+                 card->name, (unsigned long long)(defer / PA_USEC_PER_MSEC));
+
+    /* reconsider the routing once the current profile has had its time */
+    if ((psw = get_profile_switch(u, card, FALSE)))
+        schedule_profile_recheck(psw, defer, PA_IDXSET_INVALID);
+
+    return FALSE;
+}
+
+int pa_discover_switch_profile(struct userdata *u,
+                               pa_card         *card,
+                               const char      *profile)
+{
+    profile_switch *psw;
+    char           *from;
+    pa_usec_t       begin;
+    int             sts;
+
+    pa_assert(u);
+    pa_assert(card);
+    pa_assert(profile);
+
+    from = card->active_profile ? pa_xstrdup(card->active_profile->name) :
+                                  NULL;
+    begin = pa_rtclock_now();
+
+    sts = pa_card_set_profile(card, profile, FALSE);
+
+    if (sts >= 0 && from && (psw = get_profile_switch(u, card, TRUE))) {
+        update_profile_switch_cost(psw, from, profile,
+                                   pa_rtclock_now() - begin);
     }
 
+    pa_xfree(from);
+
+    return sts;
 }
 
 void pa_discover_port_available_changed(struct userdata *u,
@@ -445,6 +593,9 @@ void pa_discover_add_sink(struct userdata *u, pa_sink *sink, pa_bool_t route)
     pa_assert_se((core = u->core));
     pa_assert_se((discover = u->discover));
 
+    /* streams parked for the lack of this sink can go once routed to it */
+    pa_discover_resume_parked_streams(u);
+
     module = sink->module;
 
     if ((card = sink->card)) {
@@ -491,8 +642,10 @@ void pa_discover_add_sink(struct userdata *u, pa_sink *sink, pa_bool_t route)
         if (route) {
             type = node->type;
 
-            if (type != mir_bluetooth_a2dp && type != mir_bluetooth_sco)
-                mir_router_make_routing(u);
+            if (type != mir_bluetooth_a2dp && type != mir_bluetooth_sco) {
+                mir_router_zone_changed(u, node->zone);
+                mir_router_make_zone_routing(u);
+            }
             else {
                 if (!u->state.profile)
                     schedule_deferred_routing(u);
@@ -823,6 +976,8 @@ void pa_discover_preroute_sink_input(struct userdata *u,
     mir_node          *node;
     pa_muxnode        *mux;
     pa_nodeset_resdef *resdef;
+    pa_router         *router;
+    pa_bool_t          parked;
 
     pa_assert(u);
     pa_assert(data);
@@ -831,6 +986,10 @@ void pa_discover_preroute_sink_input(struct userdata *u,
     pa_assert_se((multiplex = u->multiplex));
     pa_assert_se((pl = data->proplist));
 
+    /* whatever was pending never got put */
+    discover->resume_pending = PA_IDXSET_INVALID;
+    parked = FALSE;
+
     mnam = (m = data->module) ? m->name : "";
 
     if (pa_streq(mnam, "module-combine-sink")) {
@@ -891,13 +1050,27 @@ void pa_discover_preroute_sink_input(struct userdata *u,
         role = pa_proplist_gets(data->proplist, PA_PROP_MEDIA_ROLE);
         sink = make_output_prerouting(u, &fake, &data->channel_map, role,NULL);
 
+        if (!sink && type && (sink = pa_utils_get_null_sink(u))) {
+            /*
+             * nowhere to go yet. Rather than letting the core pick some
+             * audible default, keep it silent until the next routing
+             * pass finds its place
+             */
+            router = u->router;
+            router->preroute.parked++;
+            parked = TRUE;
+            mir_router_zone_changed(u, fake.zone);
+            core->mainloop->defer_enable(router->snapshot.settle, TRUE);
+
+            pa_log_debug("parking new sink-input on the null sink "
+                         "(%u streams parked so far)",
+                         router->preroute.parked);
+        }
+
         if (sink) {
-#if 0
-            if (fake.mux && !(data->flags & PA_SINK_INPUT_START_CORKED)) {
-                data->flags |= PA_SINK_INPUT_START_CORKED;
-                schedule_stream_uncorking(u, sink);
-            }
-#endif
+            if ((fake.mux || parked) &&
+                !(data->flags & PA_SINK_INPUT_START_CORKED))
+                schedule_stream_uncorking(u, data, sink);
 
             if (pa_sink_input_new_data_set_sink(data, sink, FALSE))
                 pa_log_debug("set sink %u for new sink-input", sink->index);
@@ -935,6 +1108,8 @@ void pa_discover_add_sink_input(struct userdata *u, pa_sink_input *sinp)
     pa_assert_se((multiplex = u->multiplex));
     pa_assert_se((pl = sinp->proplist));
 
+    stream_resume_put(u, sinp);
+
     resdef = NULL;
 
     if (!(media = pa_proplist_gets(sinp->proplist, PA_PROP_MEDIA_NAME)))
@@ -1047,7 +1222,7 @@ void pa_discover_add_sink_input(struct userdata *u, pa_sink_input *sinp)
                      node->amname, snod->amname);
         /* FIXME: and actually do it ... */
 
-        pa_fader_apply_volume_limits(u, pa_utils_get_stamp());
+        pa_fader_apply_zone_volume_limits(u, node->zone, pa_utils_get_stamp());
     }
 }
 
@@ -1088,10 +1263,13 @@ void pa_discover_remove_sink_input(struct userdata *u, pa_sink_input *sinp)
 
         }
 
+        mir_router_zone_changed(u, node->zone);
         destroy_node(u, node);
     }
 
-    if (node || had_properties)
+    if (node)
+        mir_router_make_zone_routing(u);
+    else if (had_properties)
         mir_router_make_routing(u);
 }
 
@@ -1407,9 +1585,10 @@ void pa_discover_remove_source_output(struct userdata  *u,
 
         }
 
+        mir_router_zone_changed(u, node->zone);
         destroy_node(u, node);
 
-        mir_router_make_routing(u);
+        mir_router_make_zone_routing(u);
     }
 }
 
@@ -2244,9 +2423,11 @@ static void set_bluetooth_profile(struct userdata *u, mir_node *node)
     pa_card *card;
     pa_device_port *port;
     pa_card_profile *prof, *make_active;
+    profile_switch *psw;
     void *state0, *state1;
     pa_bool_t available;
     pa_bool_t switch_off;
+    pa_usec_t defer;
     int nport;
 
     pa_assert(u);
@@ -2311,10 +2492,21 @@ static void set_bluetooth_profile(struct userdata *u, mir_node *node)
                 pa_log_debug("Do not switch to %s as active ports are existing "
                              "to the other direction", make_active->name);
             }
+            else if ((defer = profile_switch_deferral(u, card,
+                                                      make_active->name)))
+            {
+                pa_log_debug("Do not switch to %s for %llu msec as the "
+                             "current profile was set just recently",
+                             make_active->name,
+                             (unsigned long long)(defer / PA_USEC_PER_MSEC));
+
+                if ((psw = get_profile_switch(u, card, FALSE)))
+                    schedule_profile_recheck(psw, defer, node->index);
+            }
             else {
                 pa_log_debug("Set profile %s", make_active->name);
 
-                if (pa_card_set_profile(card, make_active->name, FALSE) < 0) {
+                if (pa_discover_switch_profile(u,card,make_active->name) < 0) {
                     pa_log_debug("Failed to change profile to %s",
                                  make_active->name);
                 }
@@ -2323,6 +2515,243 @@ static void set_bluetooth_profile(struct userdata *u, mir_node *node)
     }
 }
 
+static profile_switch *get_profile_switch(struct userdata *u,
+                                          pa_card         *card,
+                                          pa_bool_t        create)
+{
+    pa_discover    *discover;
+    profile_switch *psw;
+    void           *key;
+
+    pa_assert(u);
+    pa_assert(card);
+    pa_assert_se((discover = u->discover));
+
+    key = PA_UINT32_TO_PTR(card->index);
+
+    if (!(psw = pa_hashmap_get(discover->profsw, key)) && create) {
+        psw = pa_xnew0(profile_switch, 1);
+        psw->u = u;
+        psw->card = card->index;
+        psw->recheck = PA_IDXSET_INVALID;
+        psw->costs = pa_hashmap_new(pa_idxset_string_hash_func,
+                                    pa_idxset_string_compare_func);
+
+        pa_hashmap_put(discover->profsw, key, psw);
+    }
+
+    return psw;
+}
+
+static pa_usec_t profile_switch_cost(profile_switch *psw,
+                                     const char     *from,
+                                     const char     *to)
+{
+    profile_cost *pc;
+    char key[256];
+
+    pa_assert(psw);
+    pa_assert(from);
+    pa_assert(to);
+
+    snprintf(key, sizeof(key), "%s>%s", from, to);
+
+    if ((pc = pa_hashmap_get(psw->costs, key)))
+        return pc->usec;
+
+    return PROFILE_SWITCH_COST * PA_USEC_PER_MSEC;
+}
+
+static void update_profile_switch_cost(profile_switch *psw,
+                                       const char     *from,
+                                       const char     *to,
+                                       pa_usec_t       usec)
+{
+    profile_cost *pc;
+    char key[256];
+
+    pa_assert(psw);
+    pa_assert(from);
+    pa_assert(to);
+
+    snprintf(key, sizeof(key), "%s>%s", from, to);
+
+    if (!(pc = pa_hashmap_get(psw->costs, key))) {
+        pc = pa_xnew0(profile_cost, 1);
+        pc->key = pa_xstrdup(key);
+        pc->usec = PROFILE_SWITCH_COST * PA_USEC_PER_MSEC;
+
+        pa_hashmap_put(psw->costs, pc->key, pc);
+    }
+
+    /* a running average; a single slow switch should not dominate */
+    pc->usec = (pc->usec * 3 + usec) / 4;
+
+    pa_log_debug("profile switch %s took %llu usec (average %llu usec)",
+                 key, (unsigned long long)usec, (unsigned long long)pc->usec);
+}
+
+static void profile_switched(struct userdata *u, pa_card *card)
+{
+    profile_switch *psw;
+    const char     *to;
+    pa_usec_t       now;
+    pa_usec_t       dwell;
+
+    pa_assert(u);
+    pa_assert(card);
+    pa_assert(card->active_profile);
+
+    if (!(psw = get_profile_switch(u, card, TRUE)))
+        return;
+
+    to  = card->active_profile->name;
+    now = pa_rtclock_now();
+
+    if (psw->profile && pa_streq(psw->profile, to))
+        return;
+
+    /*
+     * switching again before the previous profile could have settled
+     * means we are flapping. Keep every new profile twice as long as
+     * the previous one until things calm down.
+     */
+    if (psw->changed && now < psw->changed + 2 * psw->dwell) {
+        if (psw->flaps < PROFILE_MAX_FLAPS)
+            psw->flaps++;
+    }
+    else
+        psw->flaps = 0;
+
+    /* the switch to protect against is the one that takes us back */
+    dwell = psw->profile ? profile_switch_cost(psw, to, psw->profile) :
+                           PROFILE_SWITCH_COST * PA_USEC_PER_MSEC;
+    dwell *= PROFILE_COST_FACTOR;
+
+    if (dwell < PROFILE_MIN_DWELL * PA_USEC_PER_SEC)
+        dwell = PROFILE_MIN_DWELL * PA_USEC_PER_SEC;
+
+    dwell <<= psw->flaps;
+
+    if (dwell > PROFILE_MAX_DWELL * PA_USEC_PER_SEC)
+        dwell = PROFILE_MAX_DWELL * PA_USEC_PER_SEC;
+
+    pa_xfree(psw->profile);
+    psw->profile = pa_xstrdup(to);
+    psw->changed = now;
+    psw->dwell   = dwell;
+
+    pa_log_debug("profile '%s' of card '%s' is kept for at least %llu msec",
+                 to, card->name, (unsigned long long)(dwell/PA_USEC_PER_MSEC));
+}
+
+static pa_usec_t profile_switch_deferral(struct userdata *u,
+                                         pa_card         *card,
+                                         const char      *profile)
+{
+    profile_switch *psw;
+    pa_usec_t       now;
+
+    pa_assert(u);
+    pa_assert(card);
+    pa_assert(profile);
+
+    if (!(psw = get_profile_switch(u, card, FALSE)) || !psw->changed)
+        return 0;
+
+    now = pa_rtclock_now();
+
+    if (now >= psw->changed + psw->dwell)
+        return 0;
+
+    return psw->changed + psw->dwell - now;
+}
+
+static void schedule_profile_recheck(profile_switch *psw,
+                                     pa_usec_t       delay,
+                                     uint32_t        node_index)
+{
+    pa_mainloop_api *mainloop;
+    struct timeval   when;
+
+    pa_assert(psw);
+    pa_assert(psw->u);
+    pa_assert_se((mainloop = psw->u->core->mainloop));
+
+    if (node_index != PA_IDXSET_INVALID)
+        psw->recheck = node_index;
+
+    pa_gettimeofday(&when);
+    pa_timeval_add(&when, delay);
+
+    if (psw->timer)
+        mainloop->time_restart(psw->timer, &when);
+    else {
+        psw->timer = mainloop->time_new(mainloop, &when,
+                                        profile_recheck_cb, psw);
+    }
+}
+
+static void profile_recheck_cb(pa_mainloop_api      *m,
+                               pa_time_event        *e,
+                               const struct timeval *tv,
+                               void                 *data)
+{
+    profile_switch  *psw = (profile_switch *)data;
+    struct userdata *u;
+    mir_node        *node;
+    uint32_t         index;
+
+    (void)tv;
+
+    pa_assert(m);
+    pa_assert(psw);
+    pa_assert(psw->timer == e);
+    pa_assert_se((u = psw->u));
+
+    m->time_free(e);
+    psw->timer = NULL;
+
+    index = psw->recheck;
+    psw->recheck = PA_IDXSET_INVALID;
+
+    pa_log_debug("dwell time of card %u is over. Reconsidering", psw->card);
+
+    if (index != PA_IDXSET_INVALID && (node = mir_node_find_by_index(u,index)))
+        set_bluetooth_profile(u, node);
+
+    mir_router_make_routing(u);
+}
+
+static void free_profile_cost(void *data, void *userdata)
+{
+    profile_cost *pc = (profile_cost *)data;
+
+    (void)userdata;
+
+    if (pc) {
+        pa_xfree(pc->key);
+        pa_xfree(pc);
+    }
+}
+
+static void free_profile_switch(void *data, void *userdata)
+{
+    profile_switch  *psw = (profile_switch *)data;
+    struct userdata *u = (struct userdata *)userdata;
+
+    pa_assert(u);
+
+    if (psw) {
+        if (psw->timer)
+            u->core->mainloop->time_free(psw->timer);
+
+        pa_hashmap_free(psw->costs, free_profile_cost, NULL);
+        pa_xfree(psw->profile);
+        pa_xfree(psw);
+    }
+}
+
 static void deferred_routing_cb(pa_mainloop_api *m, void *d)
 {
     struct userdata *u = d;
@@ -2465,62 +2894,251 @@ static void schedule_source_cleanup(struct userdata *u, mir_node *node)
 }
 
 
-#if 0
-static void stream_uncork_cb(pa_mainloop_api *m, void *d)
+static void schedule_stream_uncorking(struct userdata        *u,
+                                      pa_sink_input_new_data *data,
+                                      pa_sink                *sink)
 {
-    stream_uncork_t *suc = d;
-    struct userdata *u;
-    pa_core *core;
-    pa_sink *sink;
-    pa_sink_input *sinp;
-    uint32_t index;
+    pa_discover *discover;
 
-    (void)m;
+    pa_assert(u);
+    pa_assert(data);
+    pa_assert(sink);
+    pa_assert_se((discover = u->discover));
 
-    pa_assert(suc);
-    pa_assert((u = suc->u));
-    pa_assert((core = u->core));
+    pa_log_debug("scheduling stream uncorking on sink.%u", sink->index);
 
-    pa_log_debug("start uncorking stream");
+    /*
+     * the rest is done when the stream is put, see stream_resume_put().
+     * The core puts a sink-input right after creating it, so there is
+     * only one pending at a time.
+     */
+    data->flags |= PA_SINK_INPUT_START_CORKED;
+    discover->resume_pending = sink->index;
+}
+
+static void stream_resume_put(struct userdata *u, pa_sink_input *sinp)
+{
+    pa_discover   *discover;
+    stream_resume *sr;
+    uint32_t       index;
+    size_t         size;
+
+    pa_assert(u);
+    pa_assert(sinp);
+    pa_assert_se((discover = u->discover));
 
-    if (!(sink = pa_idxset_get_by_index(core->sinks, suc->index))) {
-        pa_log_debug("sink.%d gone", suc->index);
-        goto out;
+    index = discover->resume_pending;
+    discover->resume_pending = PA_IDXSET_INVALID;
+
+    if (index == PA_IDXSET_INVALID ||
+        !(sinp->flags & PA_SINK_INPUT_START_CORKED))
+        return;
+
+    if (!sinp->sink) {
+        pa_log("stream.%u has no sink. Uncorking it right away", sinp->index);
+        pa_sink_input_cork(sinp, FALSE);
+        return;
     }
 
-    if (!(sinp = pa_idxset_first(core->sink_inputs, &index))) {
-        pa_log_debug("sink_input is gone");
-        goto out;
+    if (sinp->sink->index != index)
+        return;                 /* not the one we started corked */
+
+    if (!(sr = pa_hashmap_get(discover->resume, PA_UINT32_TO_PTR(index)))) {
+        sr = pa_xnew0(stream_resume, 1);
+        sr->u = u;
+        sr->sink = index;
+
+        pa_hashmap_put(discover->resume, PA_UINT32_TO_PTR(index), sr);
     }
 
-    pa_sink_input_cork(sinp, FALSE);
+    if (sr->nstream >= sr->maxstream) {
+        sr->maxstream += STREAM_RESUME_BUCKET;
+        size = sizeof(uint32_t) * sr->maxstream;
+        sr->streams = pa_xrealloc(sr->streams, size);
+    }
 
-    pa_log_debug("stream.%u uncorked", sinp->index);
+    sr->streams[sr->nstream++] = sinp->index;
 
- out:
+    pa_log_debug("stream.%u waits for sink.%u (%u streams waiting)",
+                 sinp->index, index, sr->nstream);
 
-    pa_xfree(suc);
+    schedule_resume_tick(sr, 0);
 }
 
+void pa_discover_resume_parked_streams(struct userdata *u)
+{
+    pa_discover   *discover;
+    pa_sink       *ns;
+    stream_resume *sr;
 
-static void schedule_stream_uncorking(struct userdata *u, pa_sink *sink)
+    pa_assert(u);
+
+    if (!(discover = u->discover))
+        return;
+
+    if ((ns = pa_utils_get_null_sink(u)) &&
+        (sr = pa_hashmap_get(discover->resume, PA_UINT32_TO_PTR(ns->index))))
+    {
+        /* don't wait for the slow tick of the parked ones */
+        if (sr->timer) {
+            u->core->mainloop->time_free(sr->timer);
+            sr->timer = NULL;
+        }
+
+        schedule_resume_tick(sr, 0);
+    }
+}
+
+static void schedule_resume_tick(stream_resume *sr, pa_usec_t delay)
 {
-    pa_core *core;
-    stream_uncork_t *suc;
+    pa_mainloop_api *mainloop;
+    struct timeval   when;
+
+    pa_assert(sr);
+    pa_assert(sr->u);
+    pa_assert_se((mainloop = sr->u->core->mainloop));
+
+    if (sr->timer && !delay)
+        return;                 /* the next tick is coming anyway */
+
+    pa_gettimeofday(&when);
+    pa_timeval_add(&when, delay);
+
+    if (sr->timer)
+        mainloop->time_restart(sr->timer, &when);
+    else
+        sr->timer = mainloop->time_new(mainloop, &when, stream_resume_cb, sr);
+}
+
+static int resume_priority(struct userdata *u, pa_sink_input *sinp)
+{
+    pa_router *router;
+    int class;
 
     pa_assert(u);
-    pa_assert(sink);
+    pa_assert(sinp);
+    pa_assert_se((router = u->router));
+
+    class = pa_utils_get_stream_class(sinp->proplist);
+
+    if (class < 0 || class >= router->maplen)
+        return 0;
+
+    return router->priormap[class];
+}
+
+static void stream_resume_cb(pa_mainloop_api      *m,
+                             pa_time_event        *e,
+                             const struct timeval *tv,
+                             void                 *data)
+{
+    stream_resume   *sr = (stream_resume *)data;
+    struct userdata *u;
+    pa_core         *core;
+    pa_discover     *discover;
+    pa_sink         *sink;
+    pa_sink         *ns;
+    pa_sink_input   *sinp;
+    pa_sink_input   *best;
+    uint32_t         budget;
+    uint32_t         i, ibest;
+    int              priority, pri;
+    pa_bool_t        parked;
+
+    (void)tv;
+
+    pa_assert(m);
+    pa_assert(sr);
+    pa_assert(sr->timer == e);
+    pa_assert_se((u = sr->u));
     pa_assert_se((core = u->core));
+    pa_assert_se((discover = u->discover));
 
-    pa_log_debug("scheduling stream uncorking");
+    m->time_free(e);
+    sr->timer = NULL;
 
-    suc = pa_xnew0(stream_uncork_t, 1);
-    suc->u = u;
-    suc->index = sink->index;
+    if (!(sink = pa_idxset_get_by_index(core->sinks, sr->sink)))
+        pa_log_debug("sink.%u gone. Uncorking its streams anyway", sr->sink);
+    else if (!PA_SINK_IS_LINKED(pa_sink_get_state(sink))) {
+        pa_log_debug("sink.%u is not ready. Retry later", sr->sink);
+        schedule_resume_tick(sr, STREAM_RESUME_TICK);
+        return;
+    }
 
-    pa_mainloop_api_once(core->mainloop, stream_uncork_cb, suc);
+    /* streams on the null sink wait until routing moves them elsewhere */
+    parked = (ns = pa_utils_get_null_sink(u)) && ns->index == sr->sink;
+
+    /*
+     * every uncorked stream makes the sink rewind, so only a budget of them
+     * is uncorked in a tick, the most important ones first
+     */
+    for (budget = discover->uncork_budget;  budget > 0;  budget--) {
+        best = NULL;
+        ibest = priority = 0;
+
+        for (i = 0;  i < sr->nstream;  ) {
+            if (!(sinp = pa_idxset_get_by_index(core->sink_inputs,
+                                                sr->streams[i])))
+            {
+                sr->streams[i] = sr->streams[--sr->nstream];
+                continue;
+            }
+
+            if (parked && (!sinp->sink || sinp->sink == ns ||
+                           !PA_SINK_IS_LINKED(pa_sink_get_state(sinp->sink))))
+            {
+                i++;
+                continue;
+            }
+
+            pri = resume_priority(u, sinp);
+
+            if (!best || pri > priority) {
+                best = sinp;
+                ibest = i;
+                priority = pri;
+            }
+
+            i++;
+        }
+
+        if (!best)
+            break;
+
+        sr->streams[ibest] = sr->streams[--sr->nstream];
+
+        pa_sink_input_cork(best, FALSE);
+
+        pa_log_debug("stream.%u uncorked (priority %d)", best->index,priority);
+    }
+
+    if (sr->nstream > 0) {
+        pa_log_debug("%u streams are still waiting for sink.%u",
+                     sr->nstream, sr->sink);
+        schedule_resume_tick(sr, (parked && budget) ? STREAM_PARKED_TICK :
+                                                      STREAM_RESUME_TICK);
+    }
+    else {
+        pa_hashmap_remove(discover->resume, PA_UINT32_TO_PTR(sr->sink));
+        free_stream_resume(sr, u);
+    }
+}
+
+static void free_stream_resume(void *data, void *userdata)
+{
+    stream_resume   *sr = (stream_resume *)data;
+    struct userdata *u = (struct userdata *)userdata;
+
+    pa_assert(u);
+
+    if (sr) {
+        if (sr->timer)
+            u->core->mainloop->time_free(sr->timer);
+
+        pa_xfree(sr->streams);
+        pa_xfree(sr);
+    }
 }
-#endif
 
 /*
  * Local Variables:
@@ -67,10 +67,17 @@ struct pa_discover {
         pa_hashmap *byname;
         pa_hashmap *byptr;
     }               nodes;
+    pa_hashmap     *profsw;   /**< bluetooth card index -> profile
+                                   switch history */
+    pa_hashmap     *resume;   /**< sink index -> streams waiting to be
+                                   uncorked */
+    uint32_t        uncork_budget; /**< max. streams uncorked per tick */
+    uint32_t        resume_pending;/**< sink the sink-input being created
+                                        waits for, if any */
 };
 
 
-struct pa_discover *pa_discover_init(struct userdata *);
+struct pa_discover *pa_discover_init(struct userdata *, const char *);
 void  pa_discover_done(struct userdata *);
 
 void pa_discover_domain_up(struct userdata *);
@@ -80,6 +87,9 @@ void pa_discover_add_card(struct userdata *, pa_card *);
 void pa_discover_remove_card(struct userdata *, pa_card *);
 void pa_discover_profile_changed(struct userdata *, pa_card *);
 
+pa_bool_t pa_discover_can_switch_profile(struct userdata *, mir_node *);
+int pa_discover_switch_profile(struct userdata *, pa_card *, const char *);
+
 void pa_discover_port_available_changed(struct userdata *, pa_device_port *);
 
 void pa_discover_add_sink(struct userdata *, pa_sink *, pa_bool_t);
@@ -100,6 +110,8 @@ void pa_discover_preroute_source_output(struct userdata *,
 void pa_discover_add_source_output(struct userdata *, pa_source_output *);
 void pa_discover_remove_source_output(struct userdata *, pa_source_output *);
 
+void pa_discover_resume_parked_streams(struct userdata *);
+
 
 mir_node *pa_discover_find_node_by_key(struct userdata *, const char *);
 mir_node *pa_discover_find_node_by_ptr(struct userdata *, void *);
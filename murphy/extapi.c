@@ -23,8 +23,10 @@
 #include <sys/stat.h>
 
 #include <pulse/def.h>
+#include <pulse/timeval.h>
 #include <pulsecore/pulsecore-config.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/core-rtclock.h>
 #include <pulsecore/protocol-native.h>
 #include <pulsecore/tagstruct.h>
 #include <pulsecore/pstream-util.h>
@@ -33,6 +35,11 @@
 #include "node.h"
 #include "router.h"
 
+#define EXTAPI_RECORD_VERSION   1   /* version of the binary node records */
+#define EXTAPI_TOMBSTONE_MAX    64  /* removed node records kept for deltas */
+#define EXTAPI_BACKLOG_RETRY    (50 * PA_USEC_PER_MSEC)
+#define EXTAPI_BACKLOG_MAX      (500 * PA_USEC_PER_MSEC) /* max. postponement */
+
 enum {
     SUBCOMMAND_TEST,
     SUBCOMMAND_READ,
@@ -46,10 +53,54 @@ struct pa_nodeset {
     pa_idxset *nodes;
 };
 
+/*
+ * last known state of a visible node, as it was sent to the clients;
+ * removed nodes are kept as tombstones so that deltas can report them
+ */
+typedef struct {
+    uint32_t index;
+    uint32_t gen;       /* generation of the last change */
+    uint32_t pass;      /* sync pass that last saw the node */
+    pa_bool_t removed;
+    uint32_t direction;
+    uint32_t channels;
+    uint32_t location;
+    uint32_t privacy;
+    uint32_t type;
+    char *amname;
+    char *amdescr;
+    uint16_t amid;
+    char *paname;
+    uint32_t paidx;
+} node_record;
+
+/*
+ * a client subscribed to node change events; a subscriber has at most
+ * one event pending, which always carries the latest generation
+ */
+typedef struct {
+    pa_native_connection *conn;
+    pa_usec_t last;        /* when the last event was sent */
+    pa_usec_t stalled;     /* since when a backlog holds the event back */
+    pa_bool_t pending;     /* a change is waiting to be announced */
+} subscriber;
+
 struct pa_extapi {
     uint32_t conn_id;
     pa_hashmap *conns;
-    pa_idxset *subscribed;
+    pa_hashmap *subscribed; /* subscriber's by native connection */
+    pa_native_protocol *protocol;
+    pa_hook_slot *unlink;
+    pa_usec_t interval;     /* min. time between events to a subscriber */
+    pa_time_event *retry;   /* resend postponed events */
+    pa_mainloop_api *mainloop;
+    pa_defer_event *sync;  /* deferred diffing and event sending */
+    pa_bool_t unsent;      /* changes not yet announced to subscribers */
+    uint32_t generation;   /* bumped on every change of the node records */
+    uint32_t floor;        /* oldest generation deltas can be made from */
+    uint32_t pass;
+    uint32_t ntomb;
+    pa_hashmap *records;   /* node_record's by node index */
 };
 
 static const char *mir_direction_names[] = {
@@ -108,8 +159,26 @@ static const char *mir_privacy_names[] = {
 
 static void *conn_hash(uint32_t connid);
 
-struct pa_extapi *pa_extapi_init(struct userdata *u) {
+static void sync_cb(pa_mainloop_api *, pa_defer_event *, void *);
+static void send_events(struct userdata *);
+static void subscriber_free(void *, void *);
+static void retry_cb(pa_mainloop_api *, pa_time_event *,
+                     const struct timeval *, void *);
+static pa_hook_result_t connection_unlink_cb(pa_native_protocol *,
+                                             pa_native_connection *,
+                                             struct userdata *);
+static pa_bool_t sync_records(struct userdata *);
+static pa_bool_t record_differs(node_record *, mir_node *);
+static void record_fill(node_record *, mir_node *);
+static void record_clear(node_record *);
+static void record_free(void *, void *);
+static void prune_records(pa_extapi *);
+static void put_record(pa_tagstruct *, node_record *);
+static pa_bool_t str_equal(const char *, const char *);
+
+struct pa_extapi *pa_extapi_init(struct userdata *u, const char *interval_str) {
     pa_extapi *ap;
+    uint32_t interval;
 
     pa_assert(u);
 
@@ -120,8 +189,28 @@ struct pa_extapi *pa_extapi_init(struct userdata *u) {
     ap->conns = pa_hashmap_new(pa_idxset_trivial_hash_func,
                                pa_idxset_trivial_compare_func);
 
-    ap->subscribed = pa_idxset_new(pa_idxset_trivial_hash_func,
-                                   pa_idxset_trivial_compare_func);
+    ap->subscribed = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                    pa_idxset_trivial_compare_func);
+
+    if (!interval_str || pa_atou(interval_str, &interval) < 0)
+        interval = 0;
+    if (interval > 10000)
+        interval = 10000;
+
+    ap->interval = (pa_usec_t)interval * PA_USEC_PER_MSEC;
+
+    pa_log_info("extapi minimum event interval %u ms", interval);
+
+    ap->protocol = pa_native_protocol_get(u->core);
+    ap->unlink = pa_hook_connect(&pa_native_protocol_hooks(ap->protocol)[PA_NATIVE_HOOK_CONNECTION_UNLINK],
+                                 PA_HOOK_NORMAL, (pa_hook_cb_t)connection_unlink_cb, u);
+
+    ap->records = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                 pa_idxset_trivial_compare_func);
+
+    ap->mainloop = u->core->mainloop;
+    ap->sync = ap->mainloop->defer_new(ap->mainloop, sync_cb, u);
+    ap->mainloop->defer_enable(ap->sync, FALSE);
 
     return ap;
 }
@@ -133,7 +222,17 @@ void pa_extapi_done(struct userdata *u) {
         if (ap->conns)
             pa_hashmap_free(ap->conns, NULL,NULL);
         if (ap->subscribed)
-            pa_idxset_free(ap->subscribed, NULL, NULL);
+            pa_hashmap_free(ap->subscribed, subscriber_free, NULL);
+        if (ap->unlink)
+            pa_hook_slot_free(ap->unlink);
+        if (ap->protocol)
+            pa_native_protocol_unref(ap->protocol);
+        if (ap->retry)
+            ap->mainloop->time_free(ap->retry);
+        if (ap->records)
+            pa_hashmap_free(ap->records, record_free, NULL);
+        if (ap->sync)
+            ap->mainloop->defer_free(ap->sync);
         pa_xfree(ap);
     }
 }
@@ -175,9 +274,57 @@ int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connection *c, u
       uint32_t index;
       pa_proplist *prop;
       char buf[256];
-
-      if (!pa_tagstruct_eof(t))
-        goto fail;
+      uint32_t version, since, count;
+      pa_bool_t full;
+      node_record *rec;
+      void *state;
+
+      if (!pa_tagstruct_eof(t)) {
+          /*
+           * binary read: <version> <since generation>; replies with
+           * <version> <generation> <full> <count> and the node records
+           * that changed after 'since' or, if that is not possible, all
+           * the visible nodes with <full> set
+           */
+          if (pa_tagstruct_getu32(t, &version) < 0 ||
+              pa_tagstruct_getu32(t, &since) < 0 ||
+              !pa_tagstruct_eof(t))
+              goto fail;
+
+          if (version != EXTAPI_RECORD_VERSION) {
+              pa_log_debug("unsupported node record version %u", version);
+              goto fail;
+          }
+
+          if (sync_records(u)) {
+              u->extapi->unsent = TRUE;
+              u->core->mainloop->defer_enable(u->extapi->sync, TRUE);
+          }
+
+          full = (since < u->extapi->floor || since > u->extapi->generation);
+
+          count = 0;
+          PA_HASHMAP_FOREACH(rec, u->extapi->records, state) {
+              if (full ? !rec->removed : rec->gen > since)
+                  count++;
+          }
+
+          pa_log_debug("got read request to module-murphy-ivi "
+                       "(since %u, %u records%s)", since, count,
+                       full ? ", full" : "");
+
+          pa_tagstruct_putu32(reply, EXTAPI_RECORD_VERSION);
+          pa_tagstruct_putu32(reply, u->extapi->generation);
+          pa_tagstruct_put_boolean(reply, full);
+          pa_tagstruct_putu32(reply, count);
+
+          PA_HASHMAP_FOREACH(rec, u->extapi->records, state) {
+              if (full ? !rec->removed : rec->gen > since)
+                  put_record(reply, rec);
+          }
+
+          break;
+      }
 
       pa_log_debug("got read request to module-murphy-ivi");
 
@@ -278,11 +425,15 @@ int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connection *c, u
             goto fail;
 
         if (enabled) {
-            pa_idxset_put(u->extapi->subscribed, c, NULL);
+            if (!pa_hashmap_get(u->extapi->subscribed, c)) {
+                subscriber *sub = pa_xnew0(subscriber, 1);
+                sub->conn = c;
+                pa_hashmap_put(u->extapi->subscribed, c, sub);
+            }
             pa_log_debug("enabling subscribe in module-murphy-ivi");
         }
         else {
-            pa_idxset_remove_by_data(u->extapi->subscribed, c, NULL);
+            pa_xfree(pa_hashmap_remove(u->extapi->subscribed, c));
             pa_log_debug("disabling subscribe in module-murphy-ivi");
         }
         break;
@@ -306,29 +457,320 @@ int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connection *c, u
 }
 
 void extapi_signal_node_change(struct userdata *u) {
-    pa_native_connection *c;
-    uint32_t idx;
     pa_extapi *ap;
 
-    if ((ap = u->extapi)) {
+    /*
+     * the node records are diffed only after the caller has finished
+     * with the node (eg. destroyed it), so the event carries the
+     * generation that already includes the change
+     */
+    if ((ap = u->extapi))
+        ap->mainloop->defer_enable(ap->sync, TRUE);
+}
 
-        pa_log_debug("signalling node change to extapi subscribers");
+static void sync_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    struct userdata *u = userdata;
+    subscriber *sub;
+    void *state;
+    pa_extapi *ap;
 
-        for (c = pa_idxset_first(ap->subscribed, &idx); c; c = pa_idxset_next(ap->subscribed, &idx)) {
-            pa_tagstruct *t;
+    pa_assert(u);
+    pa_assert_se((ap = u->extapi));
 
-            t = pa_tagstruct_new(NULL, 0);
-            pa_tagstruct_putu32(t, PA_COMMAND_EXTENSION);
-            pa_tagstruct_putu32(t, 0);
-            pa_tagstruct_putu32(t, u->module->index);
-            pa_tagstruct_puts(t, "module-node-manager");
-            pa_tagstruct_putu32(t, SUBCOMMAND_EVENT);
+    /* however many changes were signalled, we get here once per iteration */
+    m->defer_enable(e, FALSE);
 
-            pa_pstream_send_tagstruct(pa_native_connection_get_pstream(c), t);
+    if (!sync_records(u) && !ap->unsent)
+        return;
+
+    ap->unsent = FALSE;
+
+    PA_HASHMAP_FOREACH(sub, ap->subscribed, state)
+        sub->pending = TRUE;
+
+    send_events(u);
+}
+
+static void send_events(struct userdata *u) {
+    pa_extapi *ap;
+    subscriber *sub;
+    pa_pstream *ps;
+    pa_usec_t now, next, delay;
+    struct timeval when;
+    void *state;
+
+    pa_assert(u);
+    pa_assert_se((ap = u->extapi));
+
+    now = pa_rtclock_now();
+    next = 0;
+
+    PA_HASHMAP_FOREACH(sub, ap->subscribed, state) {
+        pa_tagstruct *t;
+
+        if (!sub->pending)
+            continue;
+
+        ps = pa_native_connection_get_pstream(sub->conn);
+
+        /*
+         * rate limit per subscriber and don't pile up events behind
+         * the ones a slow client hasn't drained yet; the pending flag
+         * makes sure it gets the latest generation eventually. A client
+         * that never drains its backlog still gets the event once it
+         * has been held back for longer than the interval (or
+         * EXTAPI_BACKLOG_MAX if there's no interval)
+         */
+        if (sub->last && now < sub->last + ap->interval)
+            delay = sub->last + ap->interval - now;
+        else if (pa_pstream_is_pending(ps)) {
+            if (!sub->stalled)
+                sub->stalled = now;
+
+            if (now - sub->stalled <
+                (ap->interval ? ap->interval : EXTAPI_BACKLOG_MAX))
+                delay = EXTAPI_BACKLOG_RETRY;
+            else {
+                pa_log_debug("extapi subscriber has had a backlog for "
+                             "%llu ms; sending the event anyway",
+                             (unsigned long long)((now - sub->stalled) /
+                                                  PA_USEC_PER_MSEC));
+                delay = 0;
+            }
         }
+        else
+            delay = 0;
+
+        if (delay) {
+            if (!next || now + delay < next)
+                next = now + delay;
+            continue;
+        }
+
+        pa_log_debug("signalling node change to extapi subscriber "
+                     "(generation %u)", ap->generation);
+
+        t = pa_tagstruct_new(NULL, 0);
+        pa_tagstruct_putu32(t, PA_COMMAND_EXTENSION);
+        pa_tagstruct_putu32(t, 0);
+        pa_tagstruct_putu32(t, u->module->index);
+        pa_tagstruct_puts(t, "module-node-manager");
+        pa_tagstruct_putu32(t, SUBCOMMAND_EVENT);
+        pa_tagstruct_putu32(t, ap->generation);
+
+        pa_pstream_send_tagstruct(ps, t);
+
+        sub->pending = FALSE;
+        sub->last = now;
+        sub->stalled = 0;
+    }
+
+    if (next) {
+        pa_gettimeofday(&when);
+        pa_timeval_add(&when, next - now);
+
+        if (ap->retry)
+            ap->mainloop->time_restart(ap->retry, &when);
+        else
+            ap->retry = ap->mainloop->time_new(ap->mainloop, &when, retry_cb, u);
     }
 }
 
+static void retry_cb(pa_mainloop_api *m, pa_time_event *e,
+                     const struct timeval *tv, void *userdata) {
+    struct userdata *u = userdata;
+    pa_extapi *ap;
+
+    (void)tv;
+
+    pa_assert(u);
+    pa_assert_se((ap = u->extapi));
+    pa_assert(ap->retry == e);
+
+    m->time_free(e);
+    ap->retry = NULL;
+
+    send_events(u);
+}
+
+static void subscriber_free(void *data, void *userdata) {
+    (void)userdata;
+
+    pa_xfree(data);
+}
+
+static pa_hook_result_t connection_unlink_cb(pa_native_protocol *p,
+                                             pa_native_connection *c,
+                                             struct userdata *u) {
+    pa_extapi *ap;
+
+    (void)p;
+
+    pa_assert(c);
+    pa_assert(u);
+
+    if ((ap = u->extapi))
+        pa_xfree(pa_hashmap_remove(ap->subscribed, c));
+
+    return PA_HOOK_OK;
+}
+
+static pa_bool_t sync_records(struct userdata *u) {
+    pa_extapi *ap;
+    mir_node *node;
+    node_record *rec;
+    uint32_t idx;
+    uint32_t gen;
+    void *state;
+    pa_bool_t changed = FALSE;
+
+    pa_assert(u);
+    pa_assert_se((ap = u->extapi));
+
+    gen = ap->generation + 1;
+    ap->pass++;
+
+    PA_IDXSET_FOREACH(node, u->nodeset->nodes, idx) {
+        if (!node->visible || !node->available)
+            continue;
+
+        if (!(rec = pa_hashmap_get(ap->records, PA_UINT32_TO_PTR(node->index)))) {
+            rec = pa_xnew0(node_record, 1);
+            rec->index = node->index;
+            rec->removed = TRUE;
+            pa_hashmap_put(ap->records, PA_UINT32_TO_PTR(rec->index), rec);
+            ap->ntomb++;
+        }
+
+        if (rec->removed || record_differs(rec, node)) {
+            if (rec->removed) {
+                rec->removed = FALSE;
+                ap->ntomb--;
+            }
+            record_fill(rec, node);
+            rec->gen = gen;
+            changed = TRUE;
+        }
+
+        rec->pass = ap->pass;
+    }
+
+    PA_HASHMAP_FOREACH(rec, ap->records, state) {
+        if (!rec->removed && rec->pass != ap->pass) {
+            record_clear(rec);
+            rec->removed = TRUE;
+            rec->gen = gen;
+            ap->ntomb++;
+            changed = TRUE;
+        }
+    }
+
+    if (changed)
+        ap->generation = gen;
+
+    if (ap->ntomb > EXTAPI_TOMBSTONE_MAX)
+        prune_records(ap);
+
+    return changed;
+}
+
+static pa_bool_t record_differs(node_record *rec, mir_node *node) {
+    return rec->direction != (uint32_t)node->direction ||
+           rec->channels  != node->channels            ||
+           rec->location  != (uint32_t)node->location  ||
+           rec->privacy   != (uint32_t)node->privacy   ||
+           rec->type      != (uint32_t)node->type      ||
+           rec->amid      != node->amid                ||
+           rec->paidx     != node->paidx               ||
+           !str_equal(rec->amname, node->amname)       ||
+           !str_equal(rec->amdescr, node->amdescr)     ||
+           !str_equal(rec->paname, node->paname);
+}
+
+static void record_fill(node_record *rec, mir_node *node) {
+    record_clear(rec);
+
+    rec->direction = node->direction;
+    rec->channels = node->channels;
+    rec->location = node->location;
+    rec->privacy = node->privacy;
+    rec->type = node->type;
+    rec->amname = pa_xstrdup(node->amname);
+    rec->amdescr = pa_xstrdup(node->amdescr);
+    rec->amid = node->amid;
+    rec->paname = pa_xstrdup(node->paname);
+    rec->paidx = node->paidx;
+}
+
+static void record_clear(node_record *rec) {
+    pa_xfree(rec->amname);
+    pa_xfree(rec->amdescr);
+    pa_xfree(rec->paname);
+
+    rec->amname = rec->amdescr = rec->paname = NULL;
+}
+
+static void record_free(void *data, void *userdata) {
+    node_record *rec = data;
+
+    (void)userdata;
+
+    if (rec) {
+        record_clear(rec);
+        pa_xfree(rec);
+    }
+}
+
+static void prune_records(pa_extapi *ap) {
+    pa_hashmap *live;
+    node_record *rec;
+
+    /*
+     * forget all the tombstones; clients that are behind the current
+     * generation will get a full snapshot on their next read
+     */
+    live = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                          pa_idxset_trivial_compare_func);
+
+    while ((rec = pa_hashmap_steal_first(ap->records))) {
+        if (rec->removed)
+            record_free(rec, NULL);
+        else
+            pa_hashmap_put(live, PA_UINT32_TO_PTR(rec->index), rec);
+    }
+
+    pa_hashmap_free(ap->records, NULL, NULL);
+
+    ap->records = live;
+    ap->ntomb = 0;
+    ap->floor = ap->generation;
+}
+
+static void put_record(pa_tagstruct *t, node_record *rec) {
+    pa_tagstruct_putu32(t, rec->index);
+    pa_tagstruct_put_boolean(t, rec->removed);
+
+    if (!rec->removed) {
+        pa_tagstruct_putu32(t, rec->direction);
+        pa_tagstruct_putu32(t, rec->channels);
+        pa_tagstruct_putu32(t, rec->location);
+        pa_tagstruct_putu32(t, rec->privacy);
+        pa_tagstruct_putu32(t, rec->type);
+        pa_tagstruct_puts(t, rec->amname);
+        pa_tagstruct_puts(t, rec->amdescr);
+        pa_tagstruct_putu32(t, rec->amid);
+        pa_tagstruct_puts(t, rec->paname);
+        pa_tagstruct_putu32(t, rec->paidx);
+    }
+}
+
+static pa_bool_t str_equal(const char *s1, const char *s2) {
+    if (!s1 || !s2)
+        return s1 == s2;
+
+    return pa_streq(s1, s2);
+}
+
 static void *conn_hash(uint32_t connid)
 {
     return NULL + connid;
@@ -22,7 +22,7 @@
 
 #include "userdata.h"
 
-struct pa_extapi *pa_extapi_init(struct userdata *u);
+struct pa_extapi *pa_extapi_init(struct userdata *u, const char *interval_str);
 void pa_extapi_done(struct userdata *u);
 
 int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connection *c, uint32_t tag, pa_tagstruct *t);
@@ -33,6 +33,7 @@
 #include "node.h"
 #include "discover.h"
 #include "volume.h"
+#include "scripting.h"
 #include "utils.h"
 
 typedef struct {
@@ -80,6 +81,13 @@ void pa_fader_done(struct userdata *u)
 
 
 void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
+{
+    pa_fader_apply_zone_volume_limits(u, NULL, stamp);
+}
+
+void pa_fader_apply_zone_volume_limits(struct userdata *u,
+                                       const char      *zone,
+                                       uint32_t         stamp)
 {
     pa_core         *core;
     transition_time *transit;
@@ -87,7 +95,7 @@ void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
     pa_sink_input   *sinp;
     pa_cvolume_ramp_int  *ramp;
     mir_node        *node;
-    double           dB;
+    int              mB;
     pa_volume_t      newvol;
     pa_volume_t      oldvol;
     uint32_t         time;
@@ -102,10 +110,20 @@ void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
     transit = &u->fader->transit;
     rampit  = transit->fade_in > 0 &&  transit->fade_out > 0;
 
-    pa_log_debug("applying volume limits ...");
+    if (zone)
+        pa_log_debug("applying volume limits in zone '%s' ...", zone);
+    else
+        pa_log_debug("applying volume limits ...");
+
+    pa_scripting_gc_hold(u);
 
     PA_IDXSET_FOREACH(sink, core->sinks, i) {
         if ((node = pa_discover_find_node_by_ptr(u, sink))) {
+            if (zone && strcmp(zone, node->zone ? node->zone :
+                                             PA_ZONE_NAME_DEFAULT))
+                continue;
+
+
             pa_log_debug("   node '%s'", node->amname);
             
             PA_IDXSET_FOREACH(sinp, sink->inputs, j) {
@@ -116,8 +134,8 @@ void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
                 if (!class)
                     pa_log_debug("        skipping");
                 else {
-                    dB = mir_volume_apply_limits(u, node, class, stamp);
-                    newvol = pa_sw_volume_from_dB(dB);
+                    mB = mir_volume_apply_limits(u, node, class, stamp);
+                    newvol = mir_volume_from_mB(u, mB);
 
                     if (rampit) {
                         ramp   = &sinp->ramp;
@@ -136,16 +154,18 @@ void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
                     }
                     
                     if (oldvol == newvol)
-                        pa_log_debug("         attenuation %.2lf dB",dB);
+                        pa_log_debug("         attenuation %d mB", mB);
                     else {
-                        pa_log_debug("         attenuation %.2lf dB "
-                                     "transition time %u ms", dB, time);
+                        pa_log_debug("         attenuation %d mB "
+                                     "transition time %u ms", mB, time);
                         set_stream_volume_limit(u, sinp, newvol, time);
                     }
                 }
             } /* PA_IDXSET_FOREACH sinp */
         }
     } /* PA_IDXSET_FOREACH sink */
+
+    pa_scripting_gc_release(u);
 }
 
 
@@ -30,6 +30,8 @@ pa_fader *pa_fader_init(const char *, const char *);
 void pa_fader_done(struct userdata *);
 
 void pa_fader_apply_volume_limits(struct userdata *, uint32_t);
+void pa_fader_apply_zone_volume_limits(struct userdata *, const char *,
+                                       uint32_t);
 
 
 #endif  /* foomirfaderfoo */
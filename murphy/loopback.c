@@ -19,35 +19,90 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
 #include <pulsecore/pulsecore-config.h>
 
 #include <pulse/def.h>
+#include <pulse/timeval.h>
+#include <pulsecore/core-util.h>
 #include <pulsecore/thread.h>
+#include <pulsecore/asyncmsgq.h>
 #include <pulsecore/strlist.h>
 #include <pulsecore/time-smoother.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/sink-input.h>
+#include <pulsecore/source.h>
+#include <pulsecore/source-output.h>
 
 #include "userdata.h"
 
 #include "loopback.h"
 #include "utils.h"
 
+#define LOOPBACK_LATENCY_MARGIN    10   /* msec on top of the device minimum */
+#define LOOPBACK_LATENCY_MAX     2000   /* msec; upper limit of backing off */
+#define LOOPBACK_MONITOR_INTERVAL   1   /* sec between underrun checks */
+#define LOOPBACK_STABLE_SAMPLES    10   /* clean samples before tightening */
+
 typedef struct {
     const char *media_role;
     int         time;
 } latency_def;
 
+typedef struct {                /* sink-input state read in its IO thread */
+    pa_sink_input     *sink_input;
+    uint64_t           playing_for;
+    uint64_t           underrun_for;
+} underrun_probe;
+
+enum {
+    LOOPBACK_PROBE_UNDERRUN = 0,
+};
+
+typedef struct {                /* streams created by a loading loopback */
+    pa_sink_input     *sink_input;
+    pa_source_output  *source_output;
+} loopback_streams;
+
+
+static int get_latency(pa_loopback *, const char *);
+static void device_latency_range(pa_source *, pa_sink *,
+                                 uint32_t *, uint32_t *);
+static void set_latency_limits(pa_loopnode *, pa_source *, pa_sink *);
+static void apply_latency(pa_loopnode *, pa_sink_input *, pa_source_output *);
+static pa_bool_t underrun_since_last(pa_loopback *, pa_loopnode *,
+                                     pa_sink_input *, pa_source_output *);
+static int probe_process_msg(pa_msgobject *, int, void *, int64_t,
+                             pa_memchunk *);
+static void adjust_latency(pa_loopback *, pa_loopnode *);
+
+static void schedule_monitor(pa_loopback *);
+static void monitor_cb(pa_mainloop_api *, pa_time_event *,
+                       const struct timeval *, void *);
+
+static void free_latency_def(void *, void *);
 
-static int get_latency(const char *);
+static pa_hook_result_t sink_input_put_cb(pa_core *, pa_sink_input *,
+                                          loopback_streams *);
+static pa_hook_result_t source_output_put_cb(pa_core *, pa_source_output *,
+                                             loopback_streams *);
 
 
-pa_loopback *pa_loopback_init(void)
+pa_loopback *pa_loopback_init(pa_core *core)
 {
     pa_loopback *loopback = pa_xnew0(pa_loopback, 1);
 
+    pa_assert(core);
+
+    loopback->core = core;
+    loopback->latencies = pa_hashmap_new(pa_idxset_string_hash_func,
+                                         pa_idxset_string_compare_func);
+
+    loopback->probe = pa_msgobject_new(pa_msgobject);
+    loopback->probe->process_msg = probe_process_msg;
+
     return loopback;
 }
 
@@ -59,6 +114,47 @@ void pa_loopback_done(pa_loopback *loopback, pa_core *core)
     PA_LLIST_FOREACH_SAFE(loop,n, loopback->loopnodes) {
         pa_module_unload_by_index(core, loop->module_index, FALSE);
     }
+
+    if (loopback->monitor)
+        core->mainloop->time_free(loopback->monitor);
+
+    if (loopback->probe)
+        pa_msgobject_unref(loopback->probe);
+
+    pa_hashmap_free(loopback->latencies, free_latency_def, NULL);
+}
+
+
+int pa_loopback_set_latency(pa_loopback *loopback,
+                            const char  *media_role,
+                            uint32_t     msec)
+{
+    latency_def *def;
+
+    pa_assert(loopback);
+    pa_assert(media_role);
+
+    if ((def = pa_hashmap_remove(loopback->latencies, media_role)))
+        free_latency_def(def, NULL);
+
+    if (msec > LOOPBACK_LATENCY_MAX) {
+        pa_log("latency %u msec of role '%s' is out of range",
+               msec, media_role);
+        return -1;
+    }
+
+    if (msec > 0) {
+        def = pa_xnew0(latency_def, 1);
+        def->media_role = pa_xstrdup(media_role);
+        def->time = msec;
+
+        pa_hashmap_put(loopback->latencies, (void *)def->media_role, def);
+
+        pa_log_debug("loopback latency of role '%s' set to %u msec",
+                     media_role, msec);
+    }
+
+    return 0;
 }
 
 
@@ -83,7 +179,10 @@ pa_loopnode *pa_loopback_create(pa_loopback      *loopback,
     pa_sink_input     *sink_input;
     pa_source_output  *source_output;
     char               args[512];
-    uint32_t           idx;
+    uint32_t           latency;
+    loopback_streams   streams;
+    pa_hook_slot      *sinp_slot;
+    pa_hook_slot      *sout_slot;
 
     pa_assert(core);
     pa_assert(media_role);
@@ -99,15 +198,29 @@ pa_loopnode *pa_loopback_create(pa_loopback      *loopback,
                      sink_index);
         return NULL;
     }
-            
+
+    /*
+     * start from what the role asks for but never below what the
+     * devices at the two ends can do without underrunning
+     */
+    loop = pa_xnew0(pa_loopnode, 1);
+    set_latency_limits(loop, source, sink);
+
+    latency = get_latency(loopback, media_role);
+
+    if (latency < loop->latency.floor)
+        latency = loop->latency.floor;
+    if (latency > loop->latency.ceiling)
+        latency = loop->latency.ceiling;
+
+    loop->latency.target = latency;
 
     if (type == PA_LOOPBACK_SOURCE) {
         snprintf(args, sizeof(args), "source=\"%s\" sink=\"%s\" "
                  "latency_msec=%d "
                  "sink_input_properties=\"%s=%s %s=%u %s=%u %s=%u %s=%u\" "
                  "source_output_properties=\"%s=%s %s=%u\"",
-                 source->name, sink->name,
-                 get_latency(media_role),
+                 source->name, sink->name, latency,
                  PA_PROP_MEDIA_ROLE, media_role,
                  PA_PROP_NODE_INDEX, node_index,
                  PA_PROP_RESOURCE_PRIORITY, resource_priority,
@@ -121,8 +234,7 @@ pa_loopnode *pa_loopback_create(pa_loopback      *loopback,
                  "latency_msec=%d "
                  "sink_input_properties=\"%s=%s %s=%u\" "
                  "source_output_properties=\"%s=%s %s=%u %s=%u %s=%u %s=%u\"",
-                 source->name, sink->name,
-                 get_latency(media_role),
+                 source->name, sink->name, latency,
                  PA_PROP_MEDIA_ROLE, media_role,
                  PA_PROP_NODE_INDEX, node_index,
                  PA_PROP_MEDIA_ROLE, media_role,
@@ -134,20 +246,37 @@ pa_loopnode *pa_loopback_create(pa_loopback      *loopback,
 
     pa_log_debug("loading %s %s", modnam, args);
 
-    if (!(module = pa_module_load(core, modnam, args))) {
+    /*
+     * module-loopback puts its streams while it is being loaded; pick
+     * them up as they appear instead of scanning all the streams of
+     * the core afterwards
+     */
+    memset(&streams, 0, sizeof(streams));
+
+    sinp_slot = pa_hook_connect(&core->hooks[PA_CORE_HOOK_SINK_INPUT_PUT],
+                                PA_HOOK_EARLY,
+                                (pa_hook_cb_t)sink_input_put_cb, &streams);
+    sout_slot = pa_hook_connect(&core->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_PUT],
+                                PA_HOOK_EARLY,
+                                (pa_hook_cb_t)source_output_put_cb, &streams);
+
+    module = pa_module_load(core, modnam, args);
+
+    pa_hook_slot_free(sinp_slot);
+    pa_hook_slot_free(sout_slot);
+
+    if (!module) {
         pa_log("failed to load module '%s %s'. can't loopback", modnam, args);
+        pa_xfree(loop);
         return NULL;
     }
 
-    PA_IDXSET_FOREACH(sink_input, core->sink_inputs, idx) {
-        if (sink_input->module == module)
-            break;
-    }
+    if ((sink_input = streams.sink_input) && sink_input->module != module)
+        sink_input = NULL;
 
-    PA_IDXSET_FOREACH(source_output, core->source_outputs, idx) {
-        if (source_output->module == module)
-            break;
-    }
+    if ((source_output = streams.source_output) &&
+        source_output->module != module)
+        source_output = NULL;
 
     if (!sink_input || !source_output) {
         if (!sink_input) {
@@ -159,21 +288,27 @@ pa_loopnode *pa_loopback_create(pa_loopback      *loopback,
                    module->index);
         }
         pa_module_unload(core, module, FALSE);
+        pa_xfree(loop);
         return NULL;
     }
 
     pa_assert(sink_input->index != PA_IDXSET_INVALID);
     pa_assert(source_output->index != PA_IDXSET_INVALID);
 
-    loop = pa_xnew0(pa_loopnode, 1);
     loop->module_index = module->index;
     loop->node_index = node_index;
     loop->sink_input_index = sink_input->index;
     loop->source_output_index = source_output->index;
 
+    loop->latency.sink_index = sink->index;
+
     PA_LLIST_PREPEND(pa_loopnode, loopback->loopnodes, loop);
 
-    pa_log_debug("loopback succesfully loaded. Module index %u",module->index);
+    schedule_monitor(loopback);
+
+    pa_log_debug("loopback succesfully loaded. Module index %u, latency "
+                 "%u msec (%u - %u)", module->index, latency,
+                 loop->latency.floor, loop->latency.ceiling);
 
     return loop;
 }
@@ -222,14 +357,48 @@ int pa_loopback_print(pa_loopnode *loop, char *buf, int len)
     if (!loop)
         p += snprintf(p, e-p, "<not set>");
     else {
-        p += snprintf(p, e-p, "module %u, sink_input %u",
-                      loop->module_index, loop->sink_input_index);
+        p += snprintf(p, e-p, "module %u, sink_input %u, latency %u msec "
+                      "(%u underruns)", loop->module_index,
+                      loop->sink_input_index, loop->latency.target,
+                      loop->latency.underruns);
     }
     
     return p - buf;
 }
 
-static int get_latency(const char *media_role)
+static pa_hook_result_t sink_input_put_cb(pa_core          *core,
+                                          pa_sink_input    *sinp,
+                                          loopback_streams *streams)
+{
+    (void)core;
+
+    pa_assert(sinp);
+    pa_assert(streams);
+
+    if (!streams->sink_input && sinp->module &&
+        pa_streq(sinp->module->name, "module-loopback"))
+        streams->sink_input = sinp;
+
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t source_output_put_cb(pa_core          *core,
+                                             pa_source_output *sout,
+                                             loopback_streams *streams)
+{
+    (void)core;
+
+    pa_assert(sout);
+    pa_assert(streams);
+
+    if (!streams->source_output && sout->module &&
+        pa_streq(sout->module->name, "module-loopback"))
+        streams->source_output = sout;
+
+    return PA_HOOK_OK;
+}
+
+static int get_latency(pa_loopback *loopback, const char *media_role)
 {
     static latency_def  latencies[] = {
         { "phone"   , 50 },
@@ -239,8 +408,12 @@ static int get_latency(const char *media_role)
 
     latency_def *l;
 
+    pa_assert(loopback);
     pa_assert(media_role);
 
+    if ((l = pa_hashmap_get(loopback->latencies, media_role)))
+        return l->time;
+
     for (l = latencies;  l->media_role;  l++) {
         if (pa_streq(media_role, l->media_role))
             return l->time;
@@ -249,6 +422,315 @@ static int get_latency(const char *media_role)
     return 200;
 }
 
+static void device_latency_range(pa_source *source,
+                                 pa_sink   *sink,
+                                 uint32_t  *min,
+                                 uint32_t  *max)
+{
+    pa_usec_t smin, smax;
+    pa_usec_t kmin, kmax;
+
+    pa_assert(source);
+    pa_assert(sink);
+    pa_assert(min);
+    pa_assert(max);
+
+    if ((source->flags & PA_SOURCE_DYNAMIC_LATENCY))
+        pa_source_get_latency_range(source, &smin, &smax);
+    else
+        smin = smax = pa_source_get_fixed_latency(source);
+
+    if ((sink->flags & PA_SINK_DYNAMIC_LATENCY))
+        pa_sink_get_latency_range(sink, &kmin, &kmax);
+    else
+        kmin = kmax = pa_sink_get_fixed_latency(sink);
+
+    *min = (PA_MAX(smin, kmin) + PA_USEC_PER_MSEC - 1) / PA_USEC_PER_MSEC;
+    *max = PA_MIN(smax, kmax) / PA_USEC_PER_MSEC;
+}
+
+static void set_latency_limits(pa_loopnode *loop,
+                               pa_source   *source,
+                               pa_sink     *sink)
+{
+    uint32_t min, max;
+    uint32_t floor, ceiling;
+
+    pa_assert(loop);
+
+    device_latency_range(source, sink, &min, &max);
+
+    /*
+     * module-loopback asks a third of its latency from either end,
+     * hence the factor of three
+     */
+    floor   = min * 3 + LOOPBACK_LATENCY_MARGIN;
+    ceiling = max ? max * 3 : LOOPBACK_LATENCY_MAX;
+
+    if (ceiling > LOOPBACK_LATENCY_MAX)
+        ceiling = LOOPBACK_LATENCY_MAX;
+    if (floor > ceiling)
+        floor = ceiling;
+
+    loop->latency.floor   = floor;
+    loop->latency.ceiling = ceiling;
+}
+
+static void apply_latency(pa_loopnode      *loop,
+                          pa_sink_input    *sinp,
+                          pa_source_output *sout)
+{
+    pa_usec_t usec;
+    pa_usec_t inforce;
+    uint32_t  latency;
+
+    pa_assert(loop);
+    pa_assert(sinp);
+
+    usec = (pa_usec_t)loop->latency.target * PA_USEC_PER_MSEC / 3;
+
+    pa_sink_input_set_requested_latency(sinp, usec);
+
+    if (sout)
+        pa_source_output_set_requested_latency(sout, usec);
+
+    /*
+     * the sink clamps the request to its own range; track what it
+     * actually took, so that we don't keep on backing off to values
+     * that are never going to be in force
+     */
+    inforce = pa_sink_input_get_requested_latency(sinp);
+
+    if (inforce > 0 && inforce != (pa_usec_t)-1) {
+        latency = (uint32_t)((inforce * 3 + PA_USEC_PER_MSEC - 1) /
+                             PA_USEC_PER_MSEC);
+
+        if (latency != loop->latency.target) {
+            pa_log_debug("loopback (module %u) latency %u msec is in force "
+                         "instead of %u msec", loop->module_index, latency,
+                         loop->latency.target);
+            loop->latency.target = latency;
+        }
+    }
+}
+
+static pa_bool_t underrun_since_last(pa_loopback      *loopback,
+                                     pa_loopnode      *loop,
+                                     pa_sink_input    *sinp,
+                                     pa_source_output *sout)
+{
+    underrun_probe probe;
+    pa_bool_t underrun;
+    pa_bool_t seen;
+
+    pa_assert(loopback);
+    pa_assert(loop);
+    pa_assert(sinp);
+    pa_assert(sinp->sink);
+    pa_assert(sout);
+    pa_assert(sout->source);
+
+    /*
+     * a corked stream or a suspended device underruns for as long as it
+     * stays that way; that says nothing about the latency
+     */
+    if (pa_sink_input_get_state(sinp) != PA_SINK_INPUT_RUNNING      ||
+        pa_source_output_get_state(sout) != PA_SOURCE_OUTPUT_RUNNING ||
+        !PA_SINK_IS_OPENED(pa_sink_get_state(sinp->sink))           ||
+        !PA_SOURCE_IS_OPENED(pa_source_get_state(sout->source))       )
+    {
+        loop->latency.played = 0;
+        loop->latency.underrun = FALSE;
+        return FALSE;
+    }
+
+    /*
+     * the sink input keeps count of how long it has been playing since
+     * its last underrun, and for how long the current one has lasted.
+     * These belong to the IO thread of the sink, so ask it.
+     */
+    memset(&probe, 0, sizeof(probe));
+    probe.sink_input = sinp;
+
+    if (pa_asyncmsgq_send(sinp->sink->asyncmsgq, loopback->probe,
+                          LOOPBACK_PROBE_UNDERRUN, &probe, 0, NULL) < 0)
+        return FALSE;
+
+    if (probe.underrun_for == (uint64_t)-1)  /* hasn't started playing yet */
+        return FALSE;
+
+    underrun = (probe.underrun_for > 0);
+
+    /* a new underrun started, or one came and went since the last look */
+    seen = (underrun && !loop->latency.underrun) ||
+           probe.playing_for < loop->latency.played;
+
+    loop->latency.played = probe.playing_for;
+    loop->latency.underrun = underrun;
+
+    return seen;
+}
+
+static int probe_process_msg(pa_msgobject *o, int code, void *data,
+                             int64_t offset, pa_memchunk *chunk)
+{
+    underrun_probe *probe = (underrun_probe *)data;
+
+    (void)o;
+    (void)offset;
+    (void)chunk;
+
+    switch (code) {
+
+    case LOOPBACK_PROBE_UNDERRUN:
+        pa_assert(probe);
+        pa_assert(probe->sink_input);
+
+        probe->playing_for  = probe->sink_input->thread_info.playing_for;
+        probe->underrun_for = probe->sink_input->thread_info.underrun_for;
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+static void adjust_latency(pa_loopback *loopback, pa_loopnode *loop)
+{
+    pa_core          *core;
+    pa_sink_input    *sinp;
+    pa_source_output *sout;
+    uint32_t          latency;
+
+    pa_assert(loopback);
+    pa_assert(loop);
+    pa_assert_se((core = loopback->core));
+
+    sinp = pa_idxset_get_by_index(core->sink_inputs, loop->sink_input_index);
+    sout = pa_idxset_get_by_index(core->source_outputs,
+                                  loop->source_output_index);
+
+    if (!sinp || !sinp->sink || !sout || !sout->source)
+        return;
+
+    latency = loop->latency.target;
+
+    if (sinp->sink->index != loop->latency.sink_index) {
+        /* the router moved us; the new sink has its own limits */
+        set_latency_limits(loop, sout->source, sinp->sink);
+        loop->latency.sink_index = sinp->sink->index;
+        loop->latency.stable = 0;
+        loop->latency.played = 0;
+        loop->latency.underrun = FALSE;
+
+        if (latency < loop->latency.floor)
+            latency = loop->latency.floor;
+        if (latency > loop->latency.ceiling)
+            latency = loop->latency.ceiling;
+
+        loop->latency.target = latency;
+        apply_latency(loop, sinp, sout);
+        return;
+    }
+
+    /*
+     * module-loopback keeps its own queue at the latency it was loaded
+     * with; what we tune is the buffering requested from the devices.
+     * So go by the underruns the sink input actually had.
+     */
+    if (underrun_since_last(loopback, loop, sinp, sout)) {
+        loop->latency.underruns++;
+        loop->latency.stable = 0;
+
+        if (latency < loop->latency.ceiling) {
+            latency += latency / 2;
+
+            if (latency > loop->latency.ceiling)
+                latency = loop->latency.ceiling;
+        }
+    }
+    else if (++loop->latency.stable >= LOOPBACK_STABLE_SAMPLES) {
+        loop->latency.stable = 0;
+
+        if (latency > loop->latency.floor) {
+            latency -= latency / 8;
+
+            if (latency < loop->latency.floor)
+                latency = loop->latency.floor;
+        }
+    }
+
+    if (latency != loop->latency.target) {
+        pa_log_debug("loopback (module %u) latency %u -> %u msec "
+                     "(%u underruns)", loop->module_index,
+                     loop->latency.target, latency, loop->latency.underruns);
+
+        loop->latency.target = latency;
+        apply_latency(loop, sinp, sout);
+    }
+}
+
+static void schedule_monitor(pa_loopback *loopback)
+{
+    pa_mainloop_api *mainloop;
+    struct timeval when;
+
+    pa_assert(loopback);
+    pa_assert(loopback->core);
+    pa_assert_se((mainloop = loopback->core->mainloop));
+
+    if (loopback->monitor)
+        return;
+
+    pa_gettimeofday(&when);
+    pa_timeval_add(&when, LOOPBACK_MONITOR_INTERVAL * PA_USEC_PER_SEC);
+
+    loopback->monitor = mainloop->time_new(mainloop, &when,
+                                           monitor_cb, loopback);
+}
+
+static void monitor_cb(pa_mainloop_api      *m,
+                       pa_time_event        *e,
+                       const struct timeval *tv,
+                       void                 *data)
+{
+    pa_loopback *loopback = (pa_loopback *)data;
+    pa_loopnode *loop;
+    struct timeval when;
+
+    (void)tv;
+
+    pa_assert(m);
+    pa_assert(loopback);
+    pa_assert(loopback->monitor == e);
+
+    if (!loopback->loopnodes) {
+        m->time_free(e);
+        loopback->monitor = NULL;
+        return;
+    }
+
+    PA_LLIST_FOREACH(loop, loopback->loopnodes)
+        adjust_latency(loopback, loop);
+
+    pa_gettimeofday(&when);
+    pa_timeval_add(&when, LOOPBACK_MONITOR_INTERVAL * PA_USEC_PER_SEC);
+
+    m->time_restart(e, &when);
+}
+
+static void free_latency_def(void *data, void *userdata)
+{
+    latency_def *def = (latency_def *)data;
+
+    (void)userdata;
+
+    if (def) {
+        pa_xfree((void *)def->media_role);
+        pa_xfree(def);
+    }
+}
+
 
 /*
  * Local Variables:
@@ -21,6 +21,8 @@
 #define fooloopbackfoo
 
 #include <pulsecore/core.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/msgobject.h>
 #include <pulsecore/sink-input.h>
 
 #include "list.h"
@@ -34,6 +36,10 @@ typedef enum {
 } pa_loopback_type;
 
 typedef struct pa_loopback {
+    pa_core        *core;
+    pa_hashmap     *latencies;  /* media role -> configured latency */
+    pa_time_event  *monitor;    /* periodic underrun check */
+    pa_msgobject   *probe;      /* reads stream state in the IO threads */
     PA_LLIST_HEAD(pa_loopnode, loopnodes);
 } pa_loopback;
 
@@ -44,12 +50,26 @@ struct pa_loopnode {
     uint32_t   node_index;
     uint32_t   sink_input_index;
     uint32_t   source_output_index;
+    struct {
+        uint32_t   floor;       /* msec; the least the devices can do */
+        uint32_t   ceiling;     /* msec; the most we ever back off to */
+        uint32_t   target;      /* msec; currently requested latency */
+        uint32_t   sink_index;  /* sink the target was computed for */
+        uint32_t   stable;      /* consecutive samples with no underrun */
+        uint32_t   underruns;   /* underruns seen since loading */
+        uint64_t   played;      /* bytes played without underrun at the
+                                   last sample */
+        pa_bool_t  underrun;    /* whether it was underrunning at the
+                                   last sample */
+    }          latency;
 };
 
-pa_loopback *pa_loopback_init(void);
+pa_loopback *pa_loopback_init(pa_core *);
 
 void pa_loopback_done(pa_loopback *, pa_core *);
 
+int pa_loopback_set_latency(pa_loopback *, const char *, uint32_t);
+
 pa_loopnode *pa_loopback_create(pa_loopback *, pa_core *, pa_loopback_type,
                                 uint32_t, uint32_t, uint32_t, const char *,
                                 uint32_t, uint32_t, uint32_t);
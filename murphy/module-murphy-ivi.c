@@ -33,6 +33,7 @@
 #include <pulsecore/pulsecore-config.h>
 
 #include <pulse/timeval.h>
+#include <pulse/rtclock.h>
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/macro.h>
@@ -86,6 +87,7 @@ PA_MODULE_USAGE(
     "config_file=<policy configuration file> "
     "fade_out=<stream fade-out time in msec> "
     "fade_in=<stream fade-in time in msec> "
+    "lua_mem_limit=<max. memory of the Lua interpreter in kbytes> "
 #ifdef WITH_DOMCTL
     "murphy_domain_controller=<address of Murphy's domain controller service> "
 #endif
@@ -99,12 +101,17 @@ PA_MODULE_USAGE(
     "dbus_murphy_name=<policy daemon's name> "
     "dbus_audiomgr_path=<GenIVI audio manager's path> " 
     "dbus_audiomgr_name=<GenIVI audio manager's name> " 
+    "dbus_thread=<handle D-Bus in a separate thread: yes|no> "
 #else
     "audiomgr_socktype=<tcp|unix> "
     "audiomgr_address=<audiomgr socket address> "
     "audiomgr_port=<audiomgr tcp port> "
 #endif
     "null_sink_name=<name of the null sink> "
+    "mux_pool_size=<max. number of idle multiplexers kept loaded> "
+    "mux_idle_time=<sec after which an idle multiplexer is unloaded> "
+    "extapi_event_interval=<min. msec between node change events to a client> "
+    "uncork_budget=<max. number of waiting streams uncorked at a time> "
 );
 
 static const char* const valid_modargs[] = {
@@ -112,6 +119,7 @@ static const char* const valid_modargs[] = {
     "config_file",
     "fade_out",
     "fade_in",
+    "lua_mem_limit",
 #ifdef WITH_DOMCTL
     "murphy_domain_controller",
 #endif
@@ -125,12 +133,17 @@ static const char* const valid_modargs[] = {
     "dbus_murphy_name",
     "dbus_audiomgr_path",
     "dbus_audiomgr_name",
+    "dbus_thread",
 #else
     "audiomgr_socktype",
     "audiomgr_address",
     "audiomgr_port",
 #endif
     "null_sink_name",
+    "mux_pool_size",
+    "mux_idle_time",
+    "extapi_event_interval",
+    "uncork_budget",
     NULL
 };
 
@@ -142,6 +155,7 @@ int pa__init(pa_module *m) {
     const char      *cfgfile;
     const char      *fadeout;
     const char      *fadein;
+    const char      *memlimit;
 #ifdef WITH_DOMCTL
     const char      *ctladdr;
 #endif
@@ -155,13 +169,19 @@ int pa__init(pa_module *m) {
     const char      *mrpnam;
     const char      *ampath;
     const char      *amnam;
+    pa_bool_t        dbusthr;
 #else
     const char      *socktype;
     const char      *amaddr;
     const char      *amport;
 #endif
     const char      *nsnam;
+    const char      *evintvl;
+    const char      *mxpool;
+    const char      *mxidle;
+    const char      *uncork;
     const char      *cfgpath;
+    pa_usec_t        start, configured, synced;
     char             buf[4096];
 
     
@@ -176,6 +196,7 @@ int pa__init(pa_module *m) {
     cfgfile  = pa_modargs_get_value(ma, "config_file", DEFAULT_CONFIG_FILE);
     fadeout  = pa_modargs_get_value(ma, "fade_out", NULL);
     fadein   = pa_modargs_get_value(ma, "fade_in", NULL);
+    memlimit = pa_modargs_get_value(ma, "lua_mem_limit", NULL);
 #ifdef WITH_DOMCTL
     ctladdr  = pa_modargs_get_value(ma, "murphy_domain_controller", NULL);
 #endif
@@ -189,12 +210,22 @@ int pa__init(pa_module *m) {
     mrpnam   = pa_modargs_get_value(ma, "dbus_murphy_name", NULL);
     ampath   = pa_modargs_get_value(ma, "dbus_audiomgr_path", NULL);
     amnam    = pa_modargs_get_value(ma, "dbus_audiomgr_name", NULL);
+    dbusthr  = FALSE;
+
+    if (pa_modargs_get_value_boolean(ma, "dbus_thread", &dbusthr) < 0) {
+        pa_log("invalid value for 'dbus_thread'");
+        goto fail;
+    }
 #else
     socktype = pa_modargs_get_value(ma, "audiomgr_socktype", NULL);
     amaddr   = pa_modargs_get_value(ma, "audiomgr_address", NULL);
     amport   = pa_modargs_get_value(ma, "audiomgr_port", NULL);
 #endif
     nsnam    = pa_modargs_get_value(ma, "null_sink_name", NULL);
+    evintvl  = pa_modargs_get_value(ma, "extapi_event_interval", NULL);
+    mxpool   = pa_modargs_get_value(ma, "mux_pool_size", NULL);
+    mxidle   = pa_modargs_get_value(ma, "mux_idle_time", NULL);
+    uncork   = pa_modargs_get_value(ma, "uncork_budget", NULL);
 
     u = pa_xnew0(struct userdata, 1);
     u->core      = m->core;
@@ -204,21 +235,21 @@ int pa__init(pa_module *m) {
     u->audiomgr  = pa_audiomgr_init(u);
 #ifdef WITH_DBUS
     u->routerif  = pa_routerif_init(u, dbustype, ifnam, mrppath, mrpnam,
-                                    ampath, amnam);
+                                    ampath, amnam, dbusthr);
 #else
     u->routerif  = pa_routerif_init(u, socktype, amaddr, amport);
 #endif
-    u->discover  = pa_discover_init(u);
+    u->discover  = pa_discover_init(u, uncork);
     u->tracker   = pa_tracker_init(u);
     u->router    = pa_router_init(u);
     u->constrain = pa_constrain_init(u);
-    u->multiplex = pa_multiplex_init();
-    u->loopback  = pa_loopback_init();
+    u->multiplex = pa_multiplex_init(u->core, mxpool, mxidle);
+    u->loopback  = pa_loopback_init(u->core);
     u->fader     = pa_fader_init(fadeout, fadein);
     u->volume    = pa_mir_volume_init(u);
-    u->scripting = pa_scripting_init(u);
+    u->scripting = pa_scripting_init(u, memlimit);
     u->config    = pa_mir_config_init(u);
-    u->extapi    = pa_extapi_init(u);
+    u->extapi    = pa_extapi_init(u, evintvl);
     u->murphyif  = pa_murphyif_init(u, ctladdr, resaddr);
 
     u->state.sink   = PA_IDXSET_INVALID;
@@ -237,10 +268,22 @@ int pa__init(pa_module *m) {
 
     cfgpath = pa_utils_file_path(cfgdir, cfgfile, buf, sizeof(buf));
 
+    start = pa_rtclock_now();
+
     pa_mir_config_parse_file(u, cfgpath);
 
+    configured = pa_rtclock_now();
+
     pa_tracker_synchronize(u);
 
+    synced = pa_rtclock_now();
+
+    pa_log_info("startup: config load %llu usec, tracker sync %llu usec "
+                "(of which first routing pass %llu usec)",
+                (unsigned long long)(configured - start),
+                (unsigned long long)(synced - configured),
+                (unsigned long long)u->router->firstpass);
+
     mir_router_print_rtgroups(u, buf, sizeof(buf));
     pa_log_debug("%s", buf);
     
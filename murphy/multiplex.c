@@ -24,6 +24,9 @@
 #include <pulsecore/pulsecore-config.h>
 
 #include <pulse/def.h>
+#include <pulse/timeval.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/strlist.h>
 #include <pulsecore/time-smoother.h>
@@ -39,13 +42,54 @@
 #define DEFAULT_RESAMPLER "speex-fixed-3"
 #endif
 
+#define DEFAULT_POOL_SIZE  2
+#define DEFAULT_IDLE_TIME  30   /* sec */
+
+
+static pa_module *load_combine(pa_core *, pa_sink *, const char *, uint32_t);
+static pa_muxnode *pool_lease(pa_multiplex *, pa_core *, pa_sink *,
+                              uint32_t, const char *);
+static pa_bool_t pool_return(pa_multiplex *, pa_core *, pa_muxnode *);
+static void pool_schedule_refill(pa_multiplex *, pa_sink *, uint32_t,
+                                 const char *);
+static void pool_refill_cb(pa_mainloop_api *, pa_defer_event *, void *);
+static void pool_schedule_reaper(pa_multiplex *);
+static void pool_reaper_cb(pa_mainloop_api *, pa_time_event *,
+                           const struct timeval *, void *);
+static void muxnode_free(pa_muxnode *);
 
 static void copy_media_role_property(pa_sink *, pa_sink_input *);
 
 
-pa_multiplex *pa_multiplex_init(void)
+pa_multiplex *pa_multiplex_init(pa_core    *core,
+                                const char *pool_size_str,
+                                const char *idle_time_str)
 {
     pa_multiplex *multiplex = pa_xnew0(pa_multiplex, 1);
+    uint32_t size, idle;
+
+    pa_assert(core);
+
+    if (!pool_size_str || pa_atou(pool_size_str, &size) < 0)
+        size = DEFAULT_POOL_SIZE;
+
+    if (!idle_time_str || pa_atou(idle_time_str, &idle) < 0)
+        idle = DEFAULT_IDLE_TIME;
+
+    if (size > 16)
+        size = 16;
+
+    multiplex->pool.core = core;
+    multiplex->pool.size = size;
+    multiplex->pool.idle_time = (pa_usec_t)idle * PA_USEC_PER_SEC;
+    multiplex->pool.spare.sink_index = PA_IDXSET_INVALID;
+
+    multiplex->pool.refill = core->mainloop->defer_new(core->mainloop,
+                                                       pool_refill_cb,
+                                                       multiplex);
+    core->mainloop->defer_enable(multiplex->pool.refill, FALSE);
+
+    pa_log_info("multiplexer pool: size %u, idle time %u sec", size, idle);
 
     return multiplex;
 }
@@ -58,6 +102,22 @@ void pa_multiplex_done(pa_multiplex *multiplex, pa_core *core)
     PA_LLIST_FOREACH_SAFE(mux,n, multiplex->muxnodes) {
         pa_module_unload_by_index(core, mux->module_index, FALSE);
     }
+
+    PA_LLIST_FOREACH_SAFE(mux,n, multiplex->pool.idle) {
+        pa_module_unload_by_index(core, mux->module_index, FALSE);
+        PA_LLIST_REMOVE(pa_muxnode, multiplex->pool.idle, mux);
+        muxnode_free(mux);
+    }
+
+    multiplex->pool.nidle = 0;
+
+    if (multiplex->pool.reaper)
+        core->mainloop->time_free(multiplex->pool.reaper);
+
+    if (multiplex->pool.refill)
+        core->mainloop->defer_free(multiplex->pool.refill);
+
+    pa_xfree(multiplex->pool.spare.resampler);
 }
 
 
@@ -70,15 +130,12 @@ pa_muxnode *pa_multiplex_create(pa_multiplex   *multiplex,
                                 const char     *media_role,
                                 int             type)
 {
-    static char *modnam = "module-combine-sink";
-
     struct userdata *u;         /* combine's userdata! */
     struct output   *o;
     pa_muxnode      *mux;
     pa_sink         *sink;
     pa_sink_input   *sinp;
     pa_module       *module;
-    char             args[512];
     uint32_t         idx;
     uint32_t         channels;
 
@@ -95,22 +152,28 @@ pa_muxnode *pa_multiplex_create(pa_multiplex   *multiplex,
 
     channels = chmap->channels ? chmap->channels : sink->channel_map.channels;
 
-    snprintf(args, sizeof(args), "slaves=\"%s\" resample_method=\"%s\" "
-             "channels=%u", sink->name, resampler, channels);
-
-    if (!(module = pa_module_load(core, modnam, args))) {
-        pa_log("failed to load module '%s %s'. can't multiplex", modnam, args);
-        return NULL;
+    if ((mux = pool_lease(multiplex, core, sink, channels, resampler))) {
+        pa_assert_se((module = pa_idxset_get_by_index(core->modules,
+                                                      mux->module_index)));
+        pa_assert_se((u = module->userdata));
     }
+    else {
+        if (!(module = load_combine(core, sink, resampler, channels)))
+            return NULL;
 
-    pa_assert_se((u = module->userdata));
-    pa_assert(u->sink);
+        pa_assert_se((u = module->userdata));
+        pa_assert(u->sink);
 
-    u->no_reattach = TRUE;
+        mux = pa_xnew0(pa_muxnode, 1);
+        mux->module_index = module->index;
+        mux->sink_index = u->sink->index;
+        mux->channels = channels;
+        mux->resampler = pa_xstrdup(resampler);
+
+        /* have one ready for the next stream of this kind */
+        pool_schedule_refill(multiplex, sink, channels, resampler);
+    }
 
-    mux = pa_xnew0(pa_muxnode, 1);
-    mux->module_index = module->index;
-    mux->sink_index = u->sink->index;
     mux->defstream_index = PA_IDXSET_INVALID;
 
     PA_LLIST_PREPEND(pa_muxnode, multiplex->muxnodes, mux);
@@ -140,9 +203,12 @@ void pa_multiplex_destroy(pa_multiplex *multiplex,
     pa_assert(core);
 
     if (mux) {
-        pa_module_unload_by_index(core, mux->module_index, FALSE);
         PA_LLIST_REMOVE(pa_muxnode, multiplex->muxnodes, mux);
-        pa_xfree(mux);
+
+        if (!pool_return(multiplex, core, mux)) {
+            pa_module_unload_by_index(core, mux->module_index, FALSE);
+            muxnode_free(mux);
+        }
     }
 }
 
@@ -479,6 +545,266 @@ int pa_multiplex_print(pa_muxnode *mux, char *buf, int len)
     return p - buf;
 }
 
+static pa_module *load_combine(pa_core    *core,
+                               pa_sink    *sink,
+                               const char *resampler,
+                               uint32_t    channels)
+{
+    static char *modnam = "module-combine-sink";
+
+    struct userdata *u;         /* combine's userdata! */
+    pa_module       *module;
+    char             args[512];
+
+    snprintf(args, sizeof(args), "slaves=\"%s\" resample_method=\"%s\" "
+             "channels=%u", sink->name, resampler, channels);
+
+    if (!(module = pa_module_load(core, modnam, args))) {
+        pa_log("failed to load module '%s %s'. can't multiplex", modnam, args);
+        return NULL;
+    }
+
+    pa_assert_se((u = module->userdata));
+
+    u->no_reattach = TRUE;
+
+    return module;
+}
+
+static pa_muxnode *pool_lease(pa_multiplex *multiplex,
+                              pa_core      *core,
+                              pa_sink      *sink,
+                              uint32_t      channels,
+                              const char   *resampler)
+{
+    struct userdata *u;         /* combine's userdata! */
+    struct output   *o;
+    pa_module       *module;
+    pa_muxnode      *mux, *n;
+    uint32_t         idx;
+
+    PA_LLIST_FOREACH_SAFE(mux,n, multiplex->pool.idle) {
+        if (mux->channels != channels || !pa_streq(mux->resampler, resampler))
+            continue;
+
+        PA_LLIST_REMOVE(pa_muxnode, multiplex->pool.idle, mux);
+        multiplex->pool.nidle--;
+
+        if (!(module = pa_idxset_get_by_index(core->modules,
+                                              mux->module_index)))
+        {
+            pa_log_debug("pooled mux %u is gone", mux->module_index);
+            muxnode_free(mux);
+            continue;
+        }
+
+        pa_assert_se((u = module->userdata));
+
+        /* while suspended the outputs have no sink-inputs */
+        if ((o = pa_idxset_first(u->outputs, &idx)) && o->sink != sink) {
+            u->remove_slave(u, NULL, o->sink);
+            o = NULL;
+        }
+
+        pa_sink_suspend(u->sink, FALSE, PA_SUSPEND_USER);
+
+        if (!o && !u->add_slave(u, sink)) {
+            pa_log("failed to add slave to pooled mux %u", mux->module_index);
+            pa_module_unload_by_index(core, mux->module_index, FALSE);
+            muxnode_free(mux);
+            continue;
+        }
+
+        pa_log_debug("leased mux %u from the pool", mux->module_index);
+
+        return mux;
+    }
+
+    return NULL;
+}
+
+static pa_bool_t pool_return(pa_multiplex *multiplex,
+                             pa_core      *core,
+                             pa_muxnode   *mux)
+{
+    struct userdata *u;         /* combine's userdata! */
+    struct output   *o, *keep, *extra;
+    pa_module       *module;
+    uint32_t         idx;
+
+    if (multiplex->pool.nidle >= multiplex->pool.size)
+        return FALSE;
+
+    if (!(module = pa_idxset_get_by_index(core->modules, mux->module_index)))
+        return FALSE;
+
+    pa_assert_se((u = module->userdata));
+
+    /* the stream of the mux might be on its way out, but nothing else */
+    if (pa_idxset_size(u->sink->inputs) > 1)
+        return FALSE;
+
+    /* keep the default route so that a lease to the same sink is cheap */
+    keep = NULL;
+    PA_IDXSET_FOREACH(o, u->outputs, idx) {
+        if (o->sink_input && o->sink_input->index == mux->defstream_index) {
+            keep = o;
+            break;
+        }
+    }
+
+    for (;;) {
+        extra = NULL;
+        PA_IDXSET_FOREACH(o, u->outputs, idx) {
+            if (o != keep) {
+                extra = o;
+                break;
+            }
+        }
+        if (!extra)
+            break;
+        u->remove_slave(u, NULL, extra->sink);
+    }
+
+    if (keep && keep->sink_input)
+        pa_utils_unset_stream_routing_properties(keep->sink_input->proplist);
+
+    /* suspending unlinks the remaining output stream as well */
+    pa_sink_suspend(u->sink, TRUE, PA_SUSPEND_USER);
+
+    mux->defstream_index = PA_IDXSET_INVALID;
+    mux->idle_since = pa_rtclock_now();
+
+    PA_LLIST_PREPEND(pa_muxnode, multiplex->pool.idle, mux);
+    multiplex->pool.nidle++;
+
+    pa_log_debug("mux %u returned to the pool", mux->module_index);
+
+    pool_schedule_reaper(multiplex);
+
+    return TRUE;
+}
+
+static void pool_schedule_refill(pa_multiplex *multiplex,
+                                 pa_sink      *sink,
+                                 uint32_t      channels,
+                                 const char   *resampler)
+{
+    pa_mainloop_api *mainloop = multiplex->pool.core->mainloop;
+
+    if (multiplex->pool.nidle >= multiplex->pool.size)
+        return;
+
+    multiplex->pool.spare.sink_index = sink->index;
+    multiplex->pool.spare.channels = channels;
+    pa_xfree(multiplex->pool.spare.resampler);
+    multiplex->pool.spare.resampler = pa_xstrdup(resampler);
+
+    mainloop->defer_enable(multiplex->pool.refill, TRUE);
+}
+
+static void pool_refill_cb(pa_mainloop_api *m, pa_defer_event *e, void *data)
+{
+    pa_multiplex    *multiplex = (pa_multiplex *)data;
+    pa_core         *core;
+    struct userdata *u;         /* combine's userdata! */
+    pa_module       *module;
+    pa_sink         *sink;
+    pa_muxnode      *mux;
+
+    pa_assert(multiplex);
+    pa_assert_se((core = multiplex->pool.core));
+
+    m->defer_enable(e, FALSE);
+
+    if (multiplex->pool.nidle >= multiplex->pool.size)
+        return;
+
+    if (!(sink = pa_idxset_get_by_index(core->sinks,
+                                        multiplex->pool.spare.sink_index)))
+        return;
+
+    if (!(module = load_combine(core, sink, multiplex->pool.spare.resampler,
+                                multiplex->pool.spare.channels)))
+        return;
+
+    pa_assert_se((u = module->userdata));
+
+    pa_sink_suspend(u->sink, TRUE, PA_SUSPEND_USER);
+
+    mux = pa_xnew0(pa_muxnode, 1);
+    mux->module_index = module->index;
+    mux->sink_index = u->sink->index;
+    mux->defstream_index = PA_IDXSET_INVALID;
+    mux->channels = multiplex->pool.spare.channels;
+    mux->resampler = pa_xstrdup(multiplex->pool.spare.resampler);
+    mux->idle_since = pa_rtclock_now();
+
+    PA_LLIST_PREPEND(pa_muxnode, multiplex->pool.idle, mux);
+    multiplex->pool.nidle++;
+
+    pa_log_debug("mux %u pre-loaded to the pool", mux->module_index);
+
+    pool_schedule_reaper(multiplex);
+}
+
+static void pool_schedule_reaper(pa_multiplex *multiplex)
+{
+    pa_mainloop_api *mainloop = multiplex->pool.core->mainloop;
+    struct timeval   when;
+
+    if (multiplex->pool.reaper || !multiplex->pool.idle)
+        return;
+
+    pa_gettimeofday(&when);
+    pa_timeval_add(&when, multiplex->pool.idle_time);
+
+    multiplex->pool.reaper = mainloop->time_new(mainloop, &when,
+                                                pool_reaper_cb, multiplex);
+}
+
+static void pool_reaper_cb(pa_mainloop_api      *m,
+                           pa_time_event        *e,
+                           const struct timeval *tv,
+                           void                 *data)
+{
+    pa_multiplex *multiplex = (pa_multiplex *)data;
+    pa_core      *core;
+    pa_muxnode   *mux, *n;
+    pa_usec_t     now;
+
+    (void)tv;
+
+    pa_assert(multiplex);
+    pa_assert_se((core = multiplex->pool.core));
+    pa_assert(multiplex->pool.reaper == e);
+
+    m->time_free(e);
+    multiplex->pool.reaper = NULL;
+
+    now = pa_rtclock_now();
+
+    PA_LLIST_FOREACH_SAFE(mux,n, multiplex->pool.idle) {
+        if (now - mux->idle_since >= multiplex->pool.idle_time) {
+            pa_log_debug("reaping idle mux %u", mux->module_index);
+            pa_module_unload_by_index(core, mux->module_index, FALSE);
+            PA_LLIST_REMOVE(pa_muxnode, multiplex->pool.idle, mux);
+            multiplex->pool.nidle--;
+            muxnode_free(mux);
+        }
+    }
+
+    pool_schedule_reaper(multiplex);
+}
+
+static void muxnode_free(pa_muxnode *mux)
+{
+    if (mux) {
+        pa_xfree(mux->resampler);
+        pa_xfree(mux);
+    }
+}
+
 static void copy_media_role_property(pa_sink *sink, pa_sink_input *to)
 {
     uint32_t index;
@@ -29,6 +29,20 @@ typedef struct pa_muxnode pa_muxnode;
 
 typedef struct pa_multiplex {
     PA_LLIST_HEAD(pa_muxnode, muxnodes);
+    struct {
+        pa_core           *core;
+        PA_LLIST_HEAD(pa_muxnode, idle);  /* suspended, ready to lease */
+        unsigned           nidle;
+        unsigned           size;          /* max. number of idle muxes */
+        pa_usec_t          idle_time;     /* idle muxes are reaped after */
+        pa_time_event     *reaper;
+        pa_defer_event    *refill;
+        struct {                          /* what to pre-load next */
+            uint32_t       sink_index;
+            uint32_t       channels;
+            char          *resampler;
+        } spare;
+    } pool;
 } pa_multiplex;
 
 
@@ -37,9 +51,12 @@ struct pa_muxnode {
     uint32_t   module_index;
     uint32_t   sink_index;
     uint32_t   defstream_index;
+    uint32_t   channels;                  /* pool key: channels ... */
+    char      *resampler;                 /* ... and resampler */
+    pa_usec_t  idle_since;
 };
 
-pa_multiplex *pa_multiplex_init(void);
+pa_multiplex *pa_multiplex_init(pa_core *, const char *, const char *);
 
 void pa_multiplex_done(pa_multiplex *, pa_core *);
 
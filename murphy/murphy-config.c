@@ -167,6 +167,7 @@ pa_bool_t pa_mir_config_parse_file(struct userdata *u, const char *path)
     pa_module *module;
     pa_mir_config *config;
     int success;
+    size_t live, peak;
     char buf[4096];
 
     pa_assert(u);
@@ -178,6 +179,11 @@ pa_bool_t pa_mir_config_parse_file(struct userdata *u, const char *path)
     else {
         pa_log_info("%s: configuration file is '%s'", module->name, path);
         success =  pa_scripting_dofile(u, path);
+
+        pa_scripting_memstat(u, &live, &peak);
+        pa_log_info("%s: Lua memory after configuration: %lu bytes "
+                    "(peak %lu bytes)", module->name,
+                    (unsigned long)live, (unsigned long)peak);
     }
 
     if (!success) {
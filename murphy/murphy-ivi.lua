@@ -37,6 +37,7 @@ application_class {
         input = routing_group.phone_input,
         output = routing_group.phone_output
     },
+    latency = 50,
     roles = { phone = no_resource, carkit = no_resource }
 }
 
@@ -19,12 +19,13 @@
  */
 #include <sys/types.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
-#include <alloca.h>
 #include <errno.h>
 
 #include <pulse/utf8.h>
 #include <pulse/timeval.h>
+#include <pulse/rtclock.h>
 #include <pulsecore/pulsecore-config.h>
 #include <pulsecore/module.h>
 #include <pulsecore/llist.h>
@@ -78,6 +79,9 @@
 #define RSET_RELEASE    1
 #define RSET_ACQUIRE    2
 
+#define CONNECT_MIN_PERIOD  (1 * PA_USEC_PER_SEC)
+#define CONNECT_MAX_PERIOD  (64 * PA_USEC_PER_SEC)
+
 #define PUSH_VALUE(msg, tag, typ, val) \
     mrp_msg_append(msg, MRP_MSG_TAG_##typ(RESPROTO_##tag, val))
 
@@ -95,11 +99,45 @@ struct resource_attribute {
 
 struct resource_request {
     PA_LLIST_FIELDS(resource_request);
-    uint32_t nodidx;
-    uint16_t reqid;
-    uint32_t seqno;
+    uint32_t   nodidx;
+    uint16_t   reqid;
+    uint32_t   seqno;
+    mrp_msg_t *msg;       /**< message while queued for sending */
+    pa_bool_t  reconnect; /**< part of the (re)connect burst */
 };
 
+typedef struct {
+    uint32_t           nodidx;
+    pa_bool_t          acquire;
+    pa_bool_t          has_resdef;
+    pa_nodeset_resdef  resdef;
+} resource_journal;
+
+#endif
+
+#ifdef WITH_DOMCTL
+typedef struct {
+    int                 ncol;
+    mrp_domctl_value_t *values; /**< copy of the row */
+    uint32_t            gen;    /**< last notification the row was seen in */
+} domctl_row;
+
+typedef struct {
+    pa_hashmap *rows;    /**< last snapshot of the table, keyed by the
+                              first column */
+    int         keytype; /**< type of the first column */
+    uint32_t    gen;
+    pa_bool_t   disabled;
+} domctl_snapshot;
+
+typedef struct {
+    int                  ninsert;
+    int                  nupdate;
+    int                  ndelete;
+    int                  nrow;    /**< number of changed (new+updated) rows */
+    mrp_domctl_value_t **rows;    /**< the changed rows */
+    mrp_domctl_value_t  *deleted; /**< first column of the deleted rows */
+} domctl_diff;
 #endif
 
 typedef struct {
@@ -110,6 +148,7 @@ typedef struct {
     mrp_domctl_table_t   *tables;
     int                   nwatch;
     mrp_domctl_watch_t   *watches;
+    domctl_snapshot      *snapshots;
     pa_murphyif_watch_cb  watchcb;
 #endif
 } domctl_interface;
@@ -131,8 +170,11 @@ typedef struct {
     pa_bool_t        connected;
     struct {
         pa_time_event *evt;
-        pa_usec_t      period;
+        pa_usec_t      period;  /**< current (backed off) retry delay */
+        uint32_t       attempts;
+        unsigned int   seed;    /**< private PRNG state for the jitter */
     }                connect;
+    pa_hashmap      *journal;  /**< creates pending while disconnected */
     struct {
         uint32_t request;
         uint32_t reply;
@@ -141,8 +183,20 @@ typedef struct {
         pa_hashmap *rsetid;
         pa_hashmap *pid;
     }                nodes;
+    pa_hashmap      *lastrow;  /**< last table row seen for each rsetid */
+    struct {
+        pa_defer_event   *evt;
+        resource_request *tail;
+        PA_LLIST_HEAD(resource_request, reqs); /**< queued for sending */
+    }                batch;
+    struct {
+        pa_bool_t  active;
+        uint32_t   pending;
+        pa_usec_t  start;
+    }                reconnect;
+    pa_hashmap      *reqs;  /**< sent requests, keyed by seqno */
+    pa_mainloop_api *mainloop;
     PA_LLIST_HEAD(resource_attribute, attrs);
-    PA_LLIST_HEAD(resource_request, reqs);
 #endif
 } resource_interface;
 
@@ -157,7 +211,7 @@ struct pa_murphyif {
 
 #ifdef WITH_RESOURCES
 typedef struct {
-    const char *id;
+    uint32_t    id;
     pa_bool_t   autorel;
     int         state;
     pa_bool_t   grant;
@@ -165,14 +219,15 @@ typedef struct {
 } rset_data;
 
 typedef struct {
-    char       *pid;
+    uint32_t    pid;
     mir_node   *node;
     rset_data  *rset;
 } pid_hash;
 
 typedef struct {
     size_t      nnode;
-    mir_node  **nodes;
+    size_t      nalloc;
+    mir_node  **nodes;  /**< dense array of nnode entries */
     rset_data  *rset;
 } rset_hash;
 
@@ -183,6 +238,19 @@ typedef struct {
 static void domctl_connect_notify(mrp_domctl_t *,int,int,const char *,void *);
 static void domctl_watch_notify(mrp_domctl_t *,mrp_domctl_data_t *,int,void *);
 static void domctl_dump_data(mrp_domctl_data_t *);
+static pa_bool_t domctl_diff_table(domctl_snapshot *, mrp_domctl_data_t *,
+                                   domctl_diff *);
+static pa_bool_t domctl_snapshot_keyed(domctl_snapshot *, int);
+static void domctl_snapshot_clear(domctl_snapshot *);
+static void *domctl_value_key(mrp_domctl_value_t *);
+static pa_bool_t domctl_value_equal(mrp_domctl_value_t *,mrp_domctl_value_t *);
+static pa_bool_t domctl_row_equal(domctl_row *, mrp_domctl_value_t *, int);
+static void domctl_row_set(domctl_row *, mrp_domctl_value_t *, int);
+static void domctl_row_drop(domctl_snapshot *, domctl_row *);
+static void domctl_diff_done(domctl_diff *);
+static void domctl_value_copy(mrp_domctl_value_t *, mrp_domctl_value_t *);
+static void domctl_value_clear(mrp_domctl_value_t *);
+static void domctl_row_free(void *, void *);
 #endif
 
 #ifdef WITH_RESOURCES
@@ -194,13 +262,26 @@ static void       resource_xport_closed_evt(mrp_transport_t *, int, void *);
 static mrp_msg_t *resource_create_request(uint32_t, mrp_resproto_request_t);
 static pa_bool_t  resource_send_message(resource_interface *, mrp_msg_t *,
                                         uint32_t, uint16_t, uint32_t);
+static void       resource_flush_messages(pa_mainloop_api *, pa_defer_event *,
+                                          void *);
+static void       resource_request_free(void *, void *);
+static void       resource_reconnect(struct userdata *, resource_interface *);
+static void       resource_journal_add(resource_interface *, mir_node *,
+                                       pa_nodeset_resdef *, pa_bool_t);
+static void       resource_journal_remove(resource_interface *, mir_node *);
+static uint32_t   resource_journal_replay(struct userdata *,
+                                          resource_interface *);
+static void       resource_journal_free(void *, void *);
+static void       resource_reconnect_done(resource_interface *,
+                                          resource_request *);
 static pa_bool_t  resource_set_create_node(struct userdata *, mir_node *,
                                            pa_nodeset_resdef *, pa_bool_t);
-static pa_bool_t  resource_set_create_all(struct userdata *);
 static pa_bool_t  resource_set_destroy_node(struct userdata *, uint32_t);
 static pa_bool_t  resource_set_destroy_all(struct userdata *);
 static void       resource_set_notification(struct userdata *, const char *,
                                             int, mrp_domctl_value_t **);
+static void       resource_set_deletion(struct userdata *, const char *,
+                                        int, mrp_domctl_value_t *);
 
 static pa_bool_t  resource_push_attributes(mrp_msg_t *, resource_interface *,
                                            pa_proplist *);
@@ -239,22 +320,26 @@ static void rset_data_update(rset_data *, rset_data *);
 static void rset_data_free(rset_data *);
 
 static void        pid_hashmap_free(void *, void *);
-static int         pid_hashmap_put(struct userdata *, const char *,
+static int         pid_hashmap_put(struct userdata *, uint32_t,
                                    mir_node *, rset_data *);
-static mir_node   *pid_hashmap_get_node(struct userdata *, const char *);
-static rset_data  *pid_hashmap_get_rset(struct userdata *, const char *);
-static mir_node   *pid_hashmap_remove_node(struct userdata *, const char *);
-static rset_data  *pid_hashmap_remove_rset(struct userdata *, const char *);
+static mir_node   *pid_hashmap_get_node(struct userdata *, uint32_t);
+static rset_data  *pid_hashmap_get_rset(struct userdata *, uint32_t);
+static mir_node   *pid_hashmap_remove_node(struct userdata *, uint32_t);
+static rset_data  *pid_hashmap_remove_rset(struct userdata *, uint32_t);
 
 static void       rset_hashmap_free(void *, void *);
-static rset_hash *rset_hashmap_put(struct userdata *, const char *, mir_node *);
-static rset_hash *rset_hashmap_get(struct userdata *u, const char *rsetid);
-static int        rset_hashmap_remove(struct userdata *,const char *,mir_node*);
+static rset_hash *rset_hashmap_put(struct userdata *, uint32_t, mir_node *);
+static rset_hash *rset_hashmap_get(struct userdata *u, uint32_t rsetid);
+static int        rset_hashmap_remove(struct userdata *, uint32_t, mir_node *);
+
+static void       lastrow_free(void *, void *);
+static void       lastrow_put(struct userdata *, rset_data *);
+static void       lastrow_remove(struct userdata *, uint32_t);
 
 #endif
 
 static pa_proplist *get_node_proplist(struct userdata *, mir_node *);
-static const char *get_node_pid(struct userdata *, mir_node *);
+static uint32_t get_node_pid(struct userdata *, mir_node *);
 
 
 pa_murphyif *pa_murphyif_init(struct userdata *u,
@@ -289,6 +374,24 @@ pa_murphyif *pa_murphyif_init(struct userdata *u,
 
     rif->addr = pa_xstrdup(res_addr ? res_addr:RESPROTO_DEFAULT_ADDRESS);
 #ifdef WITH_RESOURCES
+    rif->seqno.request = 1;
+    rif->nodes.rsetid = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                       pa_idxset_trivial_compare_func);
+    rif->nodes.pid = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                    pa_idxset_trivial_compare_func);
+    rif->lastrow = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                  pa_idxset_trivial_compare_func);
+    rif->reqs = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                               pa_idxset_trivial_compare_func);
+    rif->journal = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                  pa_idxset_trivial_compare_func);
+    rif->mainloop = u->core->mainloop;
+    rif->batch.evt = rif->mainloop->defer_new(rif->mainloop,
+                                              resource_flush_messages, u);
+    rif->mainloop->defer_enable(rif->batch.evt, FALSE);
+    PA_LLIST_HEAD_INIT(resource_attribute, rif->attrs);
+    PA_LLIST_HEAD_INIT(resource_request, rif->batch.reqs);
+
     rif->alen = mrp_transport_resolve(NULL, rif->addr, &rif->saddr,
                                       sizeof(rif->saddr), &rif->atype);
     if (rif->alen <= 0) {
@@ -297,7 +400,8 @@ pa_murphyif *pa_murphyif_init(struct userdata *u,
     else {
         rif->inpres.tblidx = -1;
         rif->outres.tblidx = -1;
-        rif->connect.period = 1 * PA_USEC_PER_SEC;
+        rif->connect.period = CONNECT_MIN_PERIOD;
+        rif->connect.seed = (unsigned int)(pa_rtclock_now() ^ getpid());
 
         if (!resource_transport_create(u, murphyif)) {
             pa_log("failed to create resource transport");
@@ -308,14 +412,6 @@ pa_murphyif *pa_murphyif_init(struct userdata *u,
                 schedule_connect(u, rif);
         }
     }    
-
-    rif->seqno.request = 1;
-    rif->nodes.rsetid = pa_hashmap_new(pa_idxset_string_hash_func,
-                                       pa_idxset_string_compare_func);
-    rif->nodes.pid = pa_hashmap_new(pa_idxset_string_hash_func,
-                                    pa_idxset_string_compare_func);
-    PA_LLIST_HEAD_INIT(resource_attribute, rif->attrs);
-    PA_LLIST_HEAD_INIT(resource_request, rif->reqs);
 #endif
 
     return murphyif;
@@ -362,6 +458,12 @@ void pa_murphyif_done(struct userdata *u)
             pa_xfree(dif->watches);
         }
 
+        if (dif->snapshots) {
+            for (i = 0;  i < dif->nwatch;  i++)
+                domctl_snapshot_clear(dif->snapshots + i);
+            pa_xfree(dif->snapshots);
+        }
+
         pa_xfree((void *)dif->addr);
 #endif
 
@@ -370,14 +472,20 @@ void pa_murphyif_done(struct userdata *u)
 
         resource_transport_destroy(murphyif);
 
+        if (rif->batch.evt)
+            rif->mainloop->defer_free(rif->batch.evt);
+
         pa_hashmap_free(rif->nodes.rsetid, rset_hashmap_free, NULL);
         pa_hashmap_free(rif->nodes.pid, pid_hashmap_free, NULL);
+        pa_hashmap_free(rif->lastrow, lastrow_free, NULL);
+        pa_hashmap_free(rif->reqs, resource_request_free, NULL);
+        pa_hashmap_free(rif->journal, resource_journal_free, NULL);
 
         PA_LLIST_FOREACH_SAFE(attr, a, rif->attrs)
             resource_attribute_destroy(rif, attr);
 
-        PA_LLIST_FOREACH_SAFE(req, r, rif->reqs)
-            pa_xfree(req);
+        PA_LLIST_FOREACH_SAFE(req, r, rif->batch.reqs)
+            resource_request_free(req, NULL);
 
         pa_xfree((void *)rif->addr);
         pa_xfree((void *)rif->inpres.name);
@@ -464,6 +572,11 @@ void pa_murphyif_setup_domainctl(struct userdata *u, pa_murphyif_watch_cb wcb)
 
 #ifdef WITH_DOMCTL
     if (dif->ntable || dif->nwatch) {
+        if (dif->nwatch > 0) {
+            /* the rows are hashed once the type of their key is known */
+            dif->snapshots = pa_xnew0(domctl_snapshot, dif->nwatch);
+        }
+
         dif->ctl = mrp_domctl_create(name, murphyif->ml,
                                      dif->tables, dif->ntable,
                                      dif->watches, dif->nwatch,
@@ -598,12 +711,21 @@ void pa_murphyif_create_resource_set(struct userdata *u,
     pa_assert_se((murphyif = u->murphyif));
     rif = &murphyif->resource;
 
-    state = resource_transport_connect(rif);
+    /*
+     * while a reconnect is pending (or there is no transport at all) do
+     * not touch the socket; just journal the request. It will be replayed
+     * when the backed off connection attempt succeeds.
+     */
+    if (!rif->connected && (!rif->transp || rif->connect.evt))
+        state = DISCONNECTED;
+    else
+        state = resource_transport_connect(rif);
 
     switch (state) {
 
     case CONNECTING:
-        resource_set_create_all(u);
+        resource_journal_add(rif, node, resdef, TRUE);
+        resource_reconnect(u, rif);
         break;
 
     case CONNECTED:
@@ -611,6 +733,9 @@ void pa_murphyif_create_resource_set(struct userdata *u,
         break;
 
     case DISCONNECTED:
+        resource_journal_add(rif, node, resdef, TRUE);
+        if (!rif->connect.evt)
+            schedule_connect(u, rif);
         break;
     }
 }
@@ -619,26 +744,27 @@ void pa_murphyif_destroy_resource_set(struct userdata *u, mir_node *node)
 {
     pa_murphyif *murphyif;
     uint32_t rsetid;
-    char *e;
 
     pa_assert(u);
     pa_assert(node);
     pa_assert_se((murphyif = u->murphyif));
 
+#ifdef WITH_RESOURCES
+    resource_journal_remove(&murphyif->resource, node);
+#endif
+
     if (node->localrset && node->rsetid) {
 
         pa_murphyif_delete_node(u, node);
 
-        rsetid = strtoul(node->rsetid, &e, 10);
-
-        if (e == node->rsetid || *e) {
+        if (pa_atou(node->rsetid, &rsetid) < 0) {
             pa_log("can't destroy resource set: invalid rsetid '%s'",
                    node->rsetid);
         }
         else {
-            if (rset_hashmap_remove(u, node->rsetid, node) < 0) {
-                pa_log_debug("failed to remove resource set %s from hashmap",
-                             node->rsetid);
+            if (rset_hashmap_remove(u, rsetid, node) < 0) {
+                pa_log_debug("failed to remove resource set %u from hashmap",
+                             rsetid);
             }
 
             if (resource_set_destroy_node(u, rsetid))
@@ -661,10 +787,10 @@ int pa_murphyif_add_node(struct userdata *u, mir_node *node)
 #ifdef WITH_RESOURCES
     pa_murphyif *murphyif;
     resource_interface *rif;
-    const char *pid;
+    uint32_t pid;
+    uint32_t rsetid;
     rset_data *rset;
     rset_hash *rh;
-    char buf[64];
 
     pa_assert(u);
     pa_assert(node);
@@ -685,7 +811,7 @@ int pa_murphyif_add_node(struct userdata *u, mir_node *node)
                 return 0;
 
             if ((rset = pid_hashmap_remove_rset(u, pid))) {
-                pa_log_debug("found resource-set %s for node '%s'",
+                pa_log_debug("found resource-set %u for node '%s'",
                              rset->id, node->amname);
 
                 if (node_put_rset(u, node, rset)) {
@@ -705,11 +831,15 @@ int pa_murphyif_add_node(struct userdata *u, mir_node *node)
             }
         }
     }
+    else if (pa_atou(node->rsetid, &rsetid) < 0) {
+        pa_log("can't register resource set for node %u '%s': invalid "
+               "rsetid '%s'", node->paidx, node->amname, node->rsetid);
+    }
     else {
-        if ((rh = rset_hashmap_put(u, node->rsetid, node))) {
+        if ((rh = rset_hashmap_put(u, rsetid, node))) {
             rset = rh->rset;
 
-            pa_log_debug("enforce policies on node %u '%s' rsetid:%s autorel:%s "
+            pa_log_debug("enforce policies on node %u '%s' rsetid:%u autorel:%s "
                          "state:%s grant:%s policy:%s", node->paidx, node->amname,
                          rset->id, rset->autorel ? "yes":"no",
                          rset->state == RSET_ACQUIRE ? "acquire":"release",
@@ -731,8 +861,8 @@ void pa_murphyif_delete_node(struct userdata *u, mir_node *node)
 #ifdef WITH_RESOURCES
     pa_murphyif *murphyif;
     resource_interface *rif;
-    const char *pid;
-    mir_node *deleted;
+    uint32_t pid;
+    uint32_t rsetid;
 
     pa_assert(u);
     pa_assert(node);
@@ -747,14 +877,16 @@ void pa_murphyif_delete_node(struct userdata *u, mir_node *node)
                 if (node == pid_hashmap_get_node(u, pid))
                     pid_hashmap_remove_node(u, pid);
                 else {
-                    pa_log("pid %s seems to have multiple resource sets. "
+                    pa_log("pid %u seems to have multiple resource sets. "
                            "Refuse to delete node %u (%s) from hashmap",
                            pid, node->index, node->amname);
                 }
             }
         }
         else {
-            if (rset_hashmap_remove(u, node->rsetid, node) < 0) {
+            if (pa_atou(node->rsetid, &rsetid) < 0 ||
+                rset_hashmap_remove(u, rsetid, node) < 0)
+            {
                 pa_log("failed to remove node '%s' from rset hash", node->amname);
             }
         }
@@ -787,6 +919,8 @@ static void domctl_watch_notify(mrp_domctl_t *dc, mrp_domctl_data_t *tables,
     resource_interface *rif;
     mrp_domctl_data_t *t;
     mrp_domctl_watch_t *w;
+    domctl_diff diff;
+    pa_bool_t diffed;
     int i;
 
     MRP_UNUSED(dc);
@@ -811,14 +945,329 @@ static void domctl_watch_notify(mrp_domctl_t *dc, mrp_domctl_data_t *tables,
 
         w = dif->watches + t->id;
 
+        diffed = domctl_diff_table(dif->snapshots + t->id, t, &diff);
+
+        if (diffed) {
+            pa_log_debug("table '%s': %d new, %d updated, %d deleted row(s)",
+                         w->table, diff.ninsert, diff.nupdate, diff.ndelete);
+        }
+
 #ifdef WITH_RESOURCES
         if (t->id == rif->inpres.tblidx || t->id == rif->outres.tblidx) {
-            resource_set_notification(u, w->table, t->nrow, t->rows);
+            /*
+             * every row is remembered per rsetid, so nodes registering
+             * later on still get the state they missed here
+             */
+            if (diffed) {
+                resource_set_notification(u, w->table, diff.nrow, diff.rows);
+                resource_set_deletion(u, w->table, diff.ndelete,diff.deleted);
+            }
+            else
+                resource_set_notification(u, w->table, t->nrow, t->rows);
+
+            domctl_diff_done(&diff);
             continue;
         }
 #endif
 
-        dif->watchcb(u, w->table, t->nrow, t->rows);
+        /* imports mirror the full table, but there's no point calling
+           them when nothing has changed */
+        if (!diffed || diff.nrow > 0 || diff.ndelete > 0)
+            dif->watchcb(u, w->table, t->nrow, t->rows);
+        else
+            pa_log_debug("table '%s' is unchanged", w->table);
+
+        domctl_diff_done(&diff);
+    }
+}
+
+/*
+ * Compare the incoming table to the last snapshot, keying the rows by their
+ * first column (eg. the rsetid of the resource tables). The snapshot is
+ * updated as a side effect. Returns FALSE if the table can't be diffed (eg.
+ * non-unique keys or keys of no usable type), in which case the full table
+ * needs to be processed.
+ */
+static pa_bool_t domctl_diff_table(domctl_snapshot *snap, mrp_domctl_data_t *t,
+                                   domctl_diff *diff)
+{
+    mrp_domctl_value_t *row;
+    domctl_row *r, *stale;
+    void *state;
+    pa_bool_t valid;
+    int i;
+
+    pa_assert(snap);
+    pa_assert(t);
+    pa_assert(diff);
+
+    memset(diff, 0, sizeof(*diff));
+
+    if (snap->disabled)
+        return FALSE;
+
+    if (t->nrow > 0)
+        diff->rows = pa_xnew(mrp_domctl_value_t *, t->nrow);
+
+    valid = (t->ncolumn > 0);
+    snap->gen++;
+
+    for (i = 0;  i < t->nrow && valid;  i++) {
+        row = t->rows[i];
+
+        if (!domctl_snapshot_keyed(snap, row[0].type)) {
+            valid = FALSE;
+            break;
+        }
+
+        if (!(r = pa_hashmap_get(snap->rows, domctl_value_key(row)))) {
+            r = pa_xnew0(domctl_row, 1);
+            domctl_row_set(r, row, t->ncolumn);
+            pa_hashmap_put(snap->rows, domctl_value_key(r->values), r);
+
+            diff->ninsert++;
+            diff->rows[diff->nrow++] = row;
+        }
+        else if (r->gen == snap->gen) {
+            /* the key is not unique: can't diff this table */
+            pa_log_debug("table #%d has no unique first column; "
+                         "not diffing it", t->id);
+            snap->disabled = TRUE;
+            valid = FALSE;
+            break;
+        }
+        else if (!domctl_row_equal(r, row, t->ncolumn)) {
+            /* same key; the rest of the row is updated in place */
+            domctl_row_set(r, row, t->ncolumn);
+
+            diff->nupdate++;
+            diff->rows[diff->nrow++] = row;
+        }
+
+        r->gen = snap->gen;
+    }
+
+    if (!valid) {
+        /* drop the snapshot; the next notification will rebuild it */
+        domctl_snapshot_clear(snap);
+
+        diff->ninsert = diff->nupdate = diff->ndelete = diff->nrow = 0;
+        return FALSE;
+    }
+
+    if (!snap->rows)
+        return TRUE;            /* no rows ever, nothing deleted */
+
+    /* rows not seen in this round are gone. Removal is delayed by one
+       step so that the iterator never points to a removed entry */
+    stale = NULL;
+
+    PA_HASHMAP_FOREACH(r, snap->rows, state) {
+        if (stale)
+            domctl_row_drop(snap, stale);
+
+        if (r->gen != snap->gen) {
+            if (!diff->deleted) {
+                diff->deleted = pa_xnew0(mrp_domctl_value_t,
+                                         pa_hashmap_size(snap->rows));
+            }
+
+            diff->deleted[diff->ndelete++] = r->values[0];
+            stale = r;
+        }
+        else
+            stale = NULL;
+    }
+
+    if (stale)
+        domctl_row_drop(snap, stale);
+
+    return TRUE;
+}
+
+static pa_bool_t domctl_snapshot_keyed(domctl_snapshot *snap, int type)
+{
+    pa_assert(snap);
+
+    if (snap->rows && snap->keytype == type)
+        return TRUE;
+
+    if (snap->rows && pa_hashmap_size(snap->rows) > 0) {
+        pa_log_debug("the type of the first column changed; not diffing");
+        return FALSE;
+    }
+
+    domctl_snapshot_clear(snap);
+
+    switch (type) {
+    case MRP_DOMCTL_STRING:
+        snap->rows = pa_hashmap_new(pa_idxset_string_hash_func,
+                                    pa_idxset_string_compare_func);
+        break;
+    case MRP_DOMCTL_INTEGER:
+    case MRP_DOMCTL_UNSIGNED:
+        snap->rows = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                    pa_idxset_trivial_compare_func);
+        break;
+    default:
+        pa_log_debug("can't key rows by a column of type %d", type);
+        return FALSE;
+    }
+
+    snap->keytype = type;
+
+    return TRUE;
+}
+
+static void domctl_snapshot_clear(domctl_snapshot *snap)
+{
+    pa_assert(snap);
+
+    if (snap->rows) {
+        pa_hashmap_free(snap->rows, domctl_row_free, NULL);
+        snap->rows = NULL;
+    }
+}
+
+static void *domctl_value_key(mrp_domctl_value_t *v)
+{
+    pa_assert(v);
+
+    /* integers are keyed by their 32 bits, eg. the rsetid as it is */
+    if (v->type == MRP_DOMCTL_STRING)
+        return (void *)v->str;
+    else
+        return PA_UINT32_TO_PTR(v->u32);
+}
+
+static pa_bool_t domctl_value_equal(mrp_domctl_value_t *v1,
+                                    mrp_domctl_value_t *v2)
+{
+    pa_assert(v1);
+    pa_assert(v2);
+
+    if (v1->type != v2->type)
+        return FALSE;
+
+    switch (v1->type) {
+    case MRP_DOMCTL_STRING:
+        return (v1->str == v2->str) ||
+               (v1->str && v2->str && !strcmp(v1->str, v2->str));
+    case MRP_DOMCTL_INTEGER:
+        return v1->s32 == v2->s32;
+    case MRP_DOMCTL_UNSIGNED:
+        return v1->u32 == v2->u32;
+    case MRP_DOMCTL_DOUBLE:
+        return v1->dbl == v2->dbl;
+    default:
+        return FALSE;
+    }
+}
+
+static pa_bool_t domctl_row_equal(domctl_row *r, mrp_domctl_value_t *row,
+                                  int ncol)
+{
+    int i;
+
+    pa_assert(r);
+    pa_assert(row);
+
+    if (r->ncol != ncol)
+        return FALSE;
+
+    for (i = 0;  i < ncol;  i++) {
+        if (!domctl_value_equal(r->values + i, row + i))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void domctl_row_set(domctl_row *r, mrp_domctl_value_t *row, int ncol)
+{
+    int first, i;
+
+    pa_assert(r);
+    pa_assert(row);
+    pa_assert(ncol > 0);
+
+    /* an existing row keeps its first column; the hashmap refers to it */
+    first = r->values ? 1 : 0;
+
+    for (i = first;  i < r->ncol;  i++)
+        domctl_value_clear(r->values + i);
+
+    if (r->ncol != ncol) {
+        r->values = pa_xrealloc(r->values, sizeof(*r->values) * ncol);
+        r->ncol = ncol;
+    }
+
+    for (i = first;  i < ncol;  i++)
+        domctl_value_copy(r->values + i, row + i);
+}
+
+static void domctl_row_drop(domctl_snapshot *snap, domctl_row *r)
+{
+    pa_assert(snap);
+    pa_assert(r);
+
+    pa_hashmap_remove(snap->rows, domctl_value_key(r->values));
+
+    /* the first column was handed over to the diff */
+    memset(r->values, 0, sizeof(*r->values));
+
+    domctl_row_free(r, NULL);
+}
+
+static void domctl_diff_done(domctl_diff *diff)
+{
+    int i;
+
+    pa_assert(diff);
+
+    for (i = 0;  i < diff->ndelete;  i++)
+        domctl_value_clear(diff->deleted + i);
+
+    pa_xfree(diff->rows);
+    pa_xfree(diff->deleted);
+
+    memset(diff, 0, sizeof(*diff));
+}
+
+static void domctl_value_copy(mrp_domctl_value_t *dst, mrp_domctl_value_t *src)
+{
+    pa_assert(dst);
+    pa_assert(src);
+
+    *dst = *src;
+
+    if (src->type == MRP_DOMCTL_STRING)
+        dst->str = pa_xstrdup(src->str);
+}
+
+static void domctl_value_clear(mrp_domctl_value_t *v)
+{
+    pa_assert(v);
+
+    if (v->type == MRP_DOMCTL_STRING)
+        pa_xfree((void *)v->str);
+
+    memset(v, 0, sizeof(*v));
+}
+
+static void domctl_row_free(void *row, void *userdata)
+{
+    domctl_row *r = (domctl_row *)row;
+    int i;
+
+    (void)userdata;
+
+    if (r) {
+        for (i = 0;  i < r->ncol;  i++)
+            domctl_value_clear(r->values + i);
+
+        pa_xfree(r->values);
+        pa_xfree(r);
     }
 }
 
@@ -961,24 +1410,215 @@ static pa_bool_t resource_send_message(resource_interface *rif,
                                        uint32_t            seqno)
 {
     resource_request *req;
-    pa_bool_t success = TRUE;
 
-    if (!mrp_transport_send(rif->transp, msg)) {
-        pa_log("failed to send resource message");
-        success = FALSE;
-    }
+    pa_assert(rif);
+    pa_assert(msg);
+
+    /*
+     * requests are queued here and flushed back-to-back from a deferred
+     * event at the end of the current main loop iteration. The replies
+     * are matched back by their sequence number.
+     */
+    req = pa_xnew0(resource_request, 1);
+    req->nodidx    = nodidx;
+    req->reqid     = reqid;
+    req->seqno     = seqno;
+    req->msg       = msg;
+    req->reconnect = rif->reconnect.active;
+
+    if (req->reconnect && reqid == RESPROTO_CREATE_RESOURCE_SET)
+        rif->reconnect.pending++;
+
+    if (!rif->batch.tail)
+        PA_LLIST_PREPEND(resource_request, rif->batch.reqs, req);
     else {
-        req = pa_xnew0(resource_request, 1);
-        req->nodidx = nodidx;
-        req->reqid  = reqid;
-        req->seqno  = seqno;
+        PA_LLIST_INSERT_AFTER(resource_request, rif->batch.reqs,
+                              rif->batch.tail, req);
+    }
+
+    rif->batch.tail = req;
 
-        PA_LLIST_PREPEND(resource_request, rif->reqs, req);
+    if (rif->batch.evt && rif->mainloop)
+        rif->mainloop->defer_enable(rif->batch.evt, TRUE);
+
+    return TRUE;
+}
+
+static void resource_flush_messages(pa_mainloop_api *a, pa_defer_event *e,
+                                    void *void_u)
+{
+    struct userdata *u = (struct userdata *)void_u;
+    pa_murphyif *murphyif;
+    resource_interface *rif;
+    resource_request *req, *n;
+    mir_node *node;
+    uint32_t nsent, nfail;
+
+    pa_assert(a);
+    pa_assert(e);
+    pa_assert(u);
+    pa_assert_se((murphyif = u->murphyif));
+
+    rif = &murphyif->resource;
+
+    a->defer_enable(e, FALSE);
+
+    nsent = nfail = 0;
+
+    PA_LLIST_FOREACH_SAFE(req, n, rif->batch.reqs) {
+        PA_LLIST_REMOVE(resource_request, rif->batch.reqs, req);
+
+        if (rif->connected && rif->transp &&
+            mrp_transport_send(rif->transp, req->msg))
+        {
+            mrp_msg_unref(req->msg);
+            req->msg = NULL;
+
+            pa_hashmap_put(rif->reqs, PA_UINT32_TO_PTR(req->seqno), req);
+            nsent++;
+        }
+        else {
+            pa_log("failed to send resource message (reqid:%u seqno:%u)",
+                   req->reqid, req->seqno);
+
+            if (req->reqid == RESPROTO_CREATE_RESOURCE_SET &&
+                (node = mir_node_find_by_index(u, req->nodidx)) &&
+                !node->rsetid)
+            {
+                node->localrset = FALSE;
+                resource_journal_add(rif, node, NULL, FALSE);
+            }
+
+            resource_reconnect_done(rif, req);
+            resource_request_free(req, NULL);
+            nfail++;
+        }
     }
 
-    mrp_msg_unref(msg);
+    rif->batch.tail = NULL;
 
-    return success;
+    pa_log_debug("flushed %u resource request(s) (%u failed)",
+                 nsent + nfail, nfail);
+}
+
+static void resource_request_free(void *r, void *userdata)
+{
+    resource_request *req = (resource_request *)r;
+
+    (void)userdata;
+
+    if (req) {
+        if (req->msg)
+            mrp_msg_unref(req->msg);
+        pa_xfree(req);
+    }
+}
+
+static void resource_reconnect(struct userdata *u, resource_interface *rif)
+{
+    pa_assert(u);
+    pa_assert(rif);
+
+    rif->reconnect.start   = pa_rtclock_now();
+    rif->reconnect.pending = 0;
+    rif->reconnect.active  = TRUE;
+
+    resource_journal_replay(u, rif);
+
+    rif->reconnect.active  = FALSE;
+
+    pa_log_info("resource transport (re)connected after %u attempt(s): "
+                "requested %u resource set(s)", rif->connect.attempts,
+                rif->reconnect.pending);
+
+    rif->connect.attempts = 0;
+    rif->connect.period = CONNECT_MIN_PERIOD;
+}
+
+static void resource_reconnect_done(resource_interface *rif,
+                                    resource_request *req)
+{
+    pa_assert(rif);
+    pa_assert(req);
+
+    if (req->reconnect && req->reqid == RESPROTO_CREATE_RESOURCE_SET &&
+        rif->reconnect.pending > 0 && --rif->reconnect.pending == 0)
+    {
+        pa_log_info("all streams enforced %llu usec after resource "
+                    "transport (re)connect",
+                    (unsigned long long)(pa_rtclock_now() -
+                                         rif->reconnect.start));
+    }
+}
+
+static void resource_journal_add(resource_interface *rif, mir_node *node,
+                                 pa_nodeset_resdef *resdef, pa_bool_t acquire)
+{
+    resource_journal *jr;
+
+    pa_assert(rif);
+    pa_assert(node);
+
+    if (!(jr = pa_hashmap_get(rif->journal, PA_UINT32_TO_PTR(node->index)))) {
+        jr = pa_xnew0(resource_journal, 1);
+        jr->nodidx = node->index;
+
+        pa_hashmap_put(rif->journal, PA_UINT32_TO_PTR(node->index), jr);
+    }
+
+    jr->acquire |= acquire;
+
+    if (resdef) {
+        jr->has_resdef = TRUE;
+        jr->resdef = *resdef;
+    }
+}
+
+static void resource_journal_remove(resource_interface *rif, mir_node *node)
+{
+    pa_assert(rif);
+    pa_assert(node);
+
+    if (rif->journal)
+        pa_xfree(pa_hashmap_remove(rif->journal, PA_UINT32_TO_PTR(node->index)));
+}
+
+static uint32_t resource_journal_replay(struct userdata *u,
+                                        resource_interface *rif)
+{
+    resource_journal *jr;
+    mir_node *node;
+    uint32_t nreq, ndrop;
+
+    pa_assert(u);
+    pa_assert(rif);
+
+    nreq = ndrop = 0;
+
+    while ((jr = pa_hashmap_steal_first(rif->journal))) {
+        if (!(node = mir_node_find_by_index(u, jr->nodidx)) || node->rsetid)
+            ndrop++;
+        else {
+            node->localrset = resource_set_create_node(u, node,
+                                  jr->has_resdef ? &jr->resdef : NULL,
+                                  jr->acquire);
+            nreq++;
+        }
+
+        pa_xfree(jr);
+    }
+
+    pa_log_debug("replayed %u journalled resource request(s), dropped %u",
+                 nreq, ndrop);
+
+    return nreq;
+}
+
+static void resource_journal_free(void *jr, void *userdata)
+{
+    (void)userdata;
+
+    pa_xfree(jr);
 }
 
 static pa_bool_t resource_set_create_node(struct userdata *u,
@@ -1095,32 +1735,6 @@ static pa_bool_t resource_set_create_node(struct userdata *u,
     return success;
 }
 
-static pa_bool_t resource_set_create_all(struct userdata *u)
-{
-    uint32_t idx;
-    mir_node *node;
-    pa_bool_t success;
-
-    pa_assert(u);
-
-    success = TRUE;
-
-    idx = PA_IDXSET_INVALID;
-
-    while ((node = pa_nodeset_iterate_nodes(u, &idx))) {
-        if ((node->implement == mir_stream && !node->loop) ||
-            (node->implement == mir_device &&  node->loop)   )
-        {
-            if (!node->rsetid) {
-                node->localrset = resource_set_create_node(u, node, NULL, FALSE);
-                success &= node->localrset;
-            }
-        }
-    }
-
-    return success;
-}
-
 static pa_bool_t resource_set_destroy_node(struct userdata *u, uint32_t rsetid)
 {
     pa_murphyif *murphyif;
@@ -1158,7 +1772,6 @@ static pa_bool_t resource_set_destroy_all(struct userdata *u)
     uint32_t idx;
     mir_node *node;
     uint32_t rsetid;
-    char *e;
     pa_bool_t success;
 
     pa_assert(u);
@@ -1171,17 +1784,27 @@ static pa_bool_t resource_set_destroy_all(struct userdata *u)
     idx = PA_IDXSET_INVALID;
 
     while ((node = pa_nodeset_iterate_nodes(u, &idx))) {
-        if (node->implement == mir_stream && node->localrset) {
+        /*
+         * streams and looped back devices with a resource set of our own
+         * (or none at all) get one again when the transport is back
+         */
+        if (((node->implement == mir_stream && !node->loop) ||
+             (node->implement == mir_device &&  node->loop)   ) &&
+            (node->localrset || !node->rsetid))
+        {
             pa_log_debug("destroying resource set for '%s'", node->amname);
 
-            if (rif->connected && node->rsetid) {
-                rsetid = strtoul(node->rsetid, &e, 10);
+            if (!rif->connected)
+                resource_journal_add(rif, node, NULL, FALSE);
 
-                if (e == node->rsetid || *e)
+            if (node->rsetid) {
+                if (pa_atou(node->rsetid, &rsetid) < 0)
                     success = FALSE;
                 else {
-                    rset_hashmap_remove(u, node->rsetid, node);
-                    success &= resource_set_destroy_node(u, rsetid);
+                    rset_hashmap_remove(u, rsetid, node);
+
+                    if (rif->connected)
+                        success &= resource_set_destroy_node(u, rsetid);
                 }
             }
 
@@ -1210,12 +1833,11 @@ static void resource_set_notification(struct userdata *u,
     mrp_domctl_value_t *cgrant;
     mrp_domctl_value_t *cpid;
     mrp_domctl_value_t *cpolicy;
-    char rsetid[32];
-    const char *pid;
-    mir_node *node, **nodes;
+    uint32_t pid;
+    mir_node *node;
     rset_hash *rh;
     rset_data rset, *rs;
-    size_t i, size;
+    size_t i;
 
     pa_assert(u);
     pa_assert(table);
@@ -1245,10 +1867,10 @@ static void resource_set_notification(struct userdata *u,
             continue;
         }
 
-        snprintf(rsetid, sizeof(rsetid), "%d", crsetid->s32);
-        pid = cpid->str;
+        if (!cpid->str || pa_atou(cpid->str, &pid) < 0)
+            pid = 0;
 
-        rset.id      = rsetid;
+        rset.id      = crsetid->u32;
         rset.autorel = cautorel->s32;
         rset.state   = cstate->s32;
         rset.grant   = cgrant->s32;
@@ -1269,15 +1891,27 @@ static void resource_set_notification(struct userdata *u,
             continue;
         }
 
-        if (!(rh = rset_hashmap_get(u, rset.id))) {
+        lastrow_put(u, &rset);
+
+        if ((rh = rset_hashmap_get(u, rset.id))) {
+            /* the whole table is delivered on every change */
+            rs = rh->rset;
+
+            if (rs->state   == rset.state   &&
+                rs->grant   == rset.grant   &&
+                rs->autorel == rset.autorel &&
+                pa_streq(rs->policy, rset.policy))
+                continue;
+        }
+        else {
             if (!pid) {
-                pa_log_debug("can't find node for resource set %s "
+                pa_log_debug("can't find node for resource set %u "
                              "(pid in resource set unknown)", rset.id);
                 continue;
             }
 
             if ((node = pid_hashmap_remove_node(u, pid))) {
-                pa_log_debug("found node %s for resource-set '%s'",
+                pa_log_debug("found node %s for resource-set '%u'",
                              node->amname, rset.id);
 
                 if (!(rh = node_put_rset(u, node, &rset))) {
@@ -1291,17 +1925,17 @@ static void resource_set_notification(struct userdata *u,
                     if (!(rs = pid_hashmap_get_rset(u, pid)))
                         pa_log("failed to add resource set to pid hash");
                     else {
-                        if (!pa_streq(rs->id, rset.id)) {
-                            pa_log("process %s appears to have multiple resour"
-                                   "ce sets (%s and %s)", pid, rs->id,rset.id);
+                        if (rs->id != rset.id) {
+                            pa_log("process %u appears to have multiple resour"
+                                   "ce sets (%u and %u)", pid, rs->id,rset.id);
                         }
-                        pa_log_debug("update resource-set %s data in "
-                                     "pid hash (pid %s)", rs->id, pid);
+                        pa_log_debug("update resource-set %u data in "
+                                     "pid hash (pid %u)", rs->id, pid);
                         rset_data_copy(rs, &rset);
                     }
                 }
                 else {
-                    pa_log_debug("can't find node for resource set %s. "
+                    pa_log_debug("can't find node for resource set %u. "
                                  "Beleive the stream will appear later on",
                                  rset.id);
                 }
@@ -1312,15 +1946,13 @@ static void resource_set_notification(struct userdata *u,
 
         rset_data_update(rh->rset, &rset);
 
-        /* we need to make a copy of this as node_enforce_resource_policy()
-           will delete/modify it */
-        size = sizeof(mir_node *) * (rh->nnode + 1);
-        nodes = alloca(size);
-        memcpy(nodes, rh->nodes, size);
+        /* node_enforce_resource_policy() might remove the node from the
+           array. Walking it backwards keeps the yet unvisited part intact */
+        for (i = rh->nnode;  i-- > 0; ) {
+            node = rh->nodes[i];
 
-        for (i = 0;  (node = nodes[i]);  i++) {
-            pa_log_debug("%u: resource notification for node '%s' autorel:%s "
-                         "state:%s grant:%s pid:%s policy:%s", i,
+            pa_log_debug("%zu: resource notification for node '%s' autorel:%s "
+                         "state:%s grant:%s pid:%u policy:%s", i,
                          node->amname, rset.autorel ? "yes":"no",
                          rset.state == RSET_ACQUIRE ? "acquire":"release",
                          rset.grant ? "yes":"no", pid, rset.policy);
@@ -1330,6 +1962,59 @@ static void resource_set_notification(struct userdata *u,
     }
 }
 
+static void resource_set_deletion(struct userdata *u,
+                                  const char *table,
+                                  int nkey,
+                                  mrp_domctl_value_t *keys)
+{
+    pa_murphyif *murphyif;
+    resource_interface *rif;
+    mrp_domctl_value_t *crsetid;
+    uint32_t rsetid;
+    rset_hash *rh;
+    pid_hash *ph;
+    void *state;
+    int k;
+
+    pa_assert(u);
+    pa_assert(table);
+
+    pa_assert_se((murphyif = u->murphyif));
+    rif = &murphyif->resource;
+
+    for (k = 0;  k < nkey;  k++) {
+        crsetid = keys + k;
+
+        if (crsetid->type != MRP_DOMCTL_UNSIGNED) {
+            pa_log("invalid rsetid type %d in '%s'", crsetid->type, table);
+            continue;
+        }
+
+        rsetid = crsetid->u32;
+
+        pa_log_debug("resource set %u was deleted", rsetid);
+
+        lastrow_remove(u, rsetid);
+
+        /* forget the row parked for a stream that never showed up */
+        PA_HASHMAP_FOREACH(ph, rif->nodes.pid, state) {
+            if (!ph->node && ph->rset && ph->rset->id == rsetid) {
+                rset_data_free(pid_hashmap_remove_rset(u, ph->pid));
+                break;
+            }
+        }
+
+        /*
+         * rows vanish also when murphy restarts, so the nodes of the set
+         * keep the state they have until a new row says otherwise
+         */
+        if ((rh = rset_hashmap_get(u, rsetid))) {
+            pa_log_debug("%zu node(s) keep the last state of resource set %u",
+                         rh->nnode, rsetid);
+        }
+    }
+}
+
 
 static pa_bool_t resource_push_attributes(mrp_msg_t *msg,
                                           resource_interface *rif,
@@ -1422,8 +2107,7 @@ static void resource_recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
     void     *curs = NULL;
     uint32_t  seqno;
     uint16_t  reqid;
-    uint32_t  nodidx;
-    resource_request *req, *n;
+    resource_request *req;
     mir_node *node;
 
     MRP_UNUSED(transp);
@@ -1443,46 +2127,41 @@ static void resource_recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
         return;
     }
 
-    PA_LLIST_FOREACH_SAFE(req, n, rif->reqs) {
-        if (req->seqno <= seqno) {
-            nodidx = req->nodidx;
-            
-            if (req->reqid == reqid) {
-                PA_LLIST_REMOVE(resource_request, rif->reqs, req);
-                pa_xfree(req);
-            }
-            
-            if (!(node = mir_node_find_by_index(u, nodidx))) {
-                if (reqid != RESPROTO_DESTROY_RESOURCE_SET) {
-                    pa_log("got response (reqid:%u seqno:%u) but can't "
-                           "find the corresponding node", reqid, seqno);
-                    resource_set_create_response_abort(u, msg, &curs);
-                }
-            }
-            else {
-                if (req->seqno < seqno) {
-                    pa_log("unanswered request %d", req->seqno);
-                }
-                else {
-                    pa_log_debug("got response (reqid:%u seqno:%u "
-                                 "node:'%s')", reqid, seqno,
-                                 node ? node->amname : "<unknown>");
-                    
-                    switch (reqid) {
-                    case RESPROTO_CREATE_RESOURCE_SET:
-                        resource_set_create_response(u, node, msg, &curs);
-                        break;
-                    case RESPROTO_DESTROY_RESOURCE_SET:
-                        break;
-                    default:
-                        pa_log("ignoring unsupported resource request "
-                               "type %u", reqid);
-                        break;
-                    }
-                }
-            }
-        } /* PA_LLIST_FOREACH_SAFE */
+    if (!(req = pa_hashmap_remove(rif->reqs, PA_UINT32_TO_PTR(seqno)))) {
+        pa_log("got response (reqid:%u seqno:%u) to an unknown request",
+               reqid, seqno);
+        return;
+    }
+
+    if (req->reqid != reqid) {
+        pa_log("mismatching response (reqid:%u seqno:%u) to request %u",
+               reqid, seqno, req->reqid);
+    }
+    else if (!(node = mir_node_find_by_index(u, req->nodidx))) {
+        if (reqid != RESPROTO_DESTROY_RESOURCE_SET) {
+            pa_log("got response (reqid:%u seqno:%u) but can't "
+                   "find the corresponding node", reqid, seqno);
+            resource_set_create_response_abort(u, msg, &curs);
+        }
+    }
+    else {
+        pa_log_debug("got response (reqid:%u seqno:%u node:'%s')",
+                     reqid, seqno, node->amname);
+
+        switch (reqid) {
+        case RESPROTO_CREATE_RESOURCE_SET:
+            resource_set_create_response(u, node, msg, &curs);
+            break;
+        case RESPROTO_DESTROY_RESOURCE_SET:
+            break;
+        default:
+            pa_log("ignoring unsupported resource request type %u", reqid);
+            break;
+        }
     }
+
+    resource_reconnect_done(rif, req);
+    resource_request_free(req, NULL);
 }
 
 
@@ -1700,6 +2379,7 @@ static pa_bool_t resource_transport_create(struct userdata *u,
 static void resource_transport_destroy(pa_murphyif *murphyif)
 {
     resource_interface *rif;
+    resource_request *req;
 
     pa_assert(murphyif);
     rif = &murphyif->resource;
@@ -1709,6 +2389,14 @@ static void resource_transport_destroy(pa_murphyif *murphyif)
 
     rif->transp = NULL;
     rif->connected = FALSE;
+
+    /* no reply is going to come to the requests sent so far */
+    if (rif->reqs) {
+        while ((req = pa_hashmap_steal_first(rif->reqs)))
+            resource_request_free(req, NULL);
+    }
+
+    rif->reconnect.pending = 0;
 }
 
 static void connect_attempt(pa_mainloop_api *a,
@@ -1735,11 +2423,13 @@ static void connect_attempt(pa_mainloop_api *a,
         switch (state) {
 
         case CONNECTING:
-            resource_set_create_all(u);
+            resource_reconnect(u, rif);
             cancel_schedule(u, rif);
             break;
 
         case CONNECTED:
+            rif->connect.attempts = 0;
+            rif->connect.period = CONNECT_MIN_PERIOD;
             cancel_schedule(u, rif);
             break;
             
@@ -1756,14 +2446,33 @@ static void schedule_connect(struct userdata *u, resource_interface *rif)
     pa_mainloop_api *mainloop;
     struct timeval when;
     pa_time_event *tev;
+    pa_usec_t delay;
 
     pa_assert(u);
     pa_assert(rif);
     pa_assert_se((core = u->core));
     pa_assert_se((mainloop = core->mainloop));
 
+    /*
+     * jittered exponential backoff: wait somewhere in [period/2, period]
+     * and double the period for the next round, up to the maximum
+     */
+    delay = rif->connect.period / 2 +
+            (pa_usec_t)rand_r(&rif->connect.seed) %
+            (rif->connect.period / 2 + 1);
+
+    if (rif->connect.period < CONNECT_MAX_PERIOD / 2)
+        rif->connect.period *= 2;
+    else
+        rif->connect.period = CONNECT_MAX_PERIOD;
+
+    rif->connect.attempts++;
+
+    pa_log_debug("next resource transport connect attempt in %llu msec",
+                 (unsigned long long)(delay / PA_USEC_PER_MSEC));
+
     pa_gettimeofday(&when);
-    pa_timeval_add(&when, rif->connect.period);
+    pa_timeval_add(&when, delay);
 
     if ((tev = rif->connect.evt))
         mainloop->time_restart(tev, &when);
@@ -1800,7 +2509,6 @@ static rset_hash *node_put_rset(struct userdata *u, mir_node *node, rset_data *r
     pa_assert(u);
     pa_assert(node);
     pa_assert(rset);
-    pa_assert(rset->id);
 
     pa_assert(node->implement == mir_stream);
     pa_assert(node->direction == mir_input || node->direction == mir_output);
@@ -1808,12 +2516,12 @@ static rset_hash *node_put_rset(struct userdata *u, mir_node *node, rset_data *r
     pa_assert_se((murphyif = u->murphyif));
     rif = &murphyif->resource;
 
-    pa_log_debug("setting rsetid %s for node %s", rset->id, node->amname);
+    pa_log_debug("setting rsetid %u for node %s", rset->id, node->amname);
 
     if (node->rsetid) {
         pa_xfree(node->rsetid);
     }
-    node->rsetid = pa_xstrdup(rset->id);
+    node->rsetid = pa_sprintf_malloc("%u", rset->id);
 
     if (!(pl = get_node_proplist(u, node))) {
         pa_log("can't obtain property list for node %s", node->amname);
@@ -1826,7 +2534,7 @@ static rset_hash *node_put_rset(struct userdata *u, mir_node *node, rset_data *r
         return NULL;
     }
 
-    if (!(rh = rset_hashmap_put(u, node->rsetid, node))) {
+    if (!(rh = rset_hashmap_put(u, rset->id, node))) {
         pa_log("conflicting rsetid %s for %s", node->rsetid, node->amname);
         return NULL;
     }
@@ -1869,12 +2577,11 @@ static rset_data *rset_data_dup(rset_data *orig)
     rset_data *dup;
 
     pa_assert(orig);
-    pa_assert(orig->id);
     pa_assert(orig->policy);
 
     dup = pa_xnew0(rset_data, 1);
 
-    dup->id      = pa_xstrdup(orig->id);
+    dup->id      = orig->id;
     dup->autorel = orig->autorel;
     dup->state   = orig->state;
     dup->grant   = orig->grant;
@@ -1885,17 +2592,13 @@ static rset_data *rset_data_dup(rset_data *orig)
 
 static void rset_data_copy(rset_data *dst, rset_data *src)
 {
-    rset_data *dup;
-
     pa_assert(dst);
     pa_assert(src);
-    pa_assert(src->id);
     pa_assert(src->policy);
 
-    pa_xfree((void *)dst->id);
     pa_xfree((void *)dst->policy);
 
-    dst->id      = pa_xstrdup(src->id);
+    dst->id      = src->id;
     dst->autorel = src->autorel;
     dst->state   = src->state;
     dst->grant   = src->grant;
@@ -1905,29 +2608,26 @@ static void rset_data_copy(rset_data *dst, rset_data *src)
 
 static void rset_data_update(rset_data *dst, rset_data *src)
 {
-    rset_data *dup;
-
     pa_assert(dst);
-    pa_assert(dst->id);
     pa_assert(src);
-    pa_assert(src->id);
     pa_assert(src->policy);
 
-    pa_assert_se(pa_streq(src->id, dst->id));
-
-    pa_xfree((void *)dst->policy);
+    pa_assert_se(src->id == dst->id);
 
     dst->autorel = src->autorel;
     dst->state   = src->state;
     dst->grant   = src->grant;
-    dst->policy  = pa_xstrdup(src->policy);
+
+    if (!pa_streq(dst->policy, src->policy)) {
+        pa_xfree((void *)dst->policy);
+        dst->policy = pa_xstrdup(src->policy);
+    }
 }
 
 
 static void rset_data_free(rset_data *rset)
 {
     if (rset) {
-        pa_xfree((void *)rset->id);
         pa_xfree((void *)rset->policy);
         pa_xfree(rset);
     }
@@ -1940,13 +2640,12 @@ static void pid_hashmap_free(void *p, void *userdata)
     (void)userdata;
 
     if (ph) {
-        pa_xfree((void *)ph->pid);
         rset_data_free(ph->rset);
         pa_xfree(ph);
     }
 }
 
-static int pid_hashmap_put(struct userdata *u, const char *pid,
+static int pid_hashmap_put(struct userdata *u, uint32_t pid,
                            mir_node *node, rset_data *rset)
 {
     pa_murphyif *murphyif;
@@ -1961,11 +2660,11 @@ static int pid_hashmap_put(struct userdata *u, const char *pid,
     rif = &murphyif->resource;
 
     ph = pa_xnew0(pid_hash, 1);
-    ph->pid = pa_xstrdup(pid);
+    ph->pid = pid;
     ph->node = node;
     ph->rset = rset;
 
-    if (pa_hashmap_put(rif->nodes.pid, ph->pid, ph) == 0)
+    if (pa_hashmap_put(rif->nodes.pid, PA_UINT32_TO_PTR(pid), ph) == 0)
         return 0;
     else
         pid_hashmap_free(ph, NULL);
@@ -1973,7 +2672,7 @@ static int pid_hashmap_put(struct userdata *u, const char *pid,
     return -1;
 }
 
-static mir_node *pid_hashmap_get_node(struct userdata *u, const char *pid)
+static mir_node *pid_hashmap_get_node(struct userdata *u, uint32_t pid)
 {
     pa_murphyif *murphyif;
     resource_interface *rif;
@@ -1985,13 +2684,13 @@ static mir_node *pid_hashmap_get_node(struct userdata *u, const char *pid)
     
     rif = &murphyif->resource;
 
-    if ((ph = pa_hashmap_get(rif->nodes.pid, pid)))
+    if ((ph = pa_hashmap_get(rif->nodes.pid, PA_UINT32_TO_PTR(pid))))
         return ph->node;
 
     return NULL;
 }
 
-static rset_data *pid_hashmap_get_rset(struct userdata *u, const char *pid)
+static rset_data *pid_hashmap_get_rset(struct userdata *u, uint32_t pid)
 {
     pa_murphyif *murphyif;
     resource_interface *rif;
@@ -2003,13 +2702,13 @@ static rset_data *pid_hashmap_get_rset(struct userdata *u, const char *pid)
     
     rif = &murphyif->resource;
 
-    if ((ph = pa_hashmap_get(rif->nodes.pid, pid)))
+    if ((ph = pa_hashmap_get(rif->nodes.pid, PA_UINT32_TO_PTR(pid))))
         return ph->rset;
 
     return NULL;
 }
 
-static mir_node *pid_hashmap_remove_node(struct userdata *u, const char *pid)
+static mir_node *pid_hashmap_remove_node(struct userdata *u, uint32_t pid)
 {
     pa_murphyif *murphyif;
     resource_interface *rif;
@@ -2021,17 +2720,17 @@ static mir_node *pid_hashmap_remove_node(struct userdata *u, const char *pid)
 
     rif = &murphyif->resource;
 
-    if (!(ph = pa_hashmap_remove(rif->nodes.pid, pid)))
+    if (!(ph = pa_hashmap_remove(rif->nodes.pid, PA_UINT32_TO_PTR(pid))))
         node = NULL;
     else if (!(node = ph->node))
-        pa_hashmap_put(rif->nodes.pid, ph->pid, ph);
+        pa_hashmap_put(rif->nodes.pid, PA_UINT32_TO_PTR(ph->pid), ph);
     else
         pid_hashmap_free(ph, NULL);
 
     return node;
 }
 
-static rset_data *pid_hashmap_remove_rset(struct userdata *u, const char *pid)
+static rset_data *pid_hashmap_remove_rset(struct userdata *u, uint32_t pid)
 {
     pa_murphyif *murphyif;
     resource_interface *rif;
@@ -2045,10 +2744,10 @@ static rset_data *pid_hashmap_remove_rset(struct userdata *u, const char *pid)
 
     rif = &murphyif->resource;
 
-    if (!(ph = pa_hashmap_remove(rif->nodes.pid, pid)))
+    if (!(ph = pa_hashmap_remove(rif->nodes.pid, PA_UINT32_TO_PTR(pid))))
         rset = NULL;
     else if (!(rset = ph->rset))
-        pa_hashmap_put(rif->nodes.pid, ph->pid, ph);
+        pa_hashmap_put(rif->nodes.pid, PA_UINT32_TO_PTR(ph->pid), ph);
     else {
         ph->rset = NULL;
         pid_hashmap_free(ph, NULL);
@@ -2072,7 +2771,7 @@ static void rset_hashmap_free(void *r, void *userdata)
 }
 
 static rset_hash *rset_hashmap_put(struct userdata *u,
-                                   const char *rsetid,
+                                   uint32_t rsetid,
                                    mir_node *node)
 {
     pa_murphyif *murphyif;
@@ -2082,98 +2781,94 @@ static rset_hash *rset_hashmap_put(struct userdata *u,
     size_t i;
 
     pa_assert(u);
-    pa_assert(rsetid);
     pa_assert(node);
     pa_assert_se((murphyif = u->murphyif));
     
     rif = &murphyif->resource;
 
-    if ((rh = pa_hashmap_get(rif->nodes.rsetid, rsetid))) {
+    if ((rh = pa_hashmap_get(rif->nodes.rsetid, PA_UINT32_TO_PTR(rsetid)))) {
         for (i = 0;  i < rh->nnode;  i++) {
             if (rh->nodes[i] == node)
                 return NULL;
         }
 
-        i = rh->nnode++;
-        rh->nodes = pa_xrealloc(rh->nodes, sizeof(mir_node *) * (rh->nnode+1));
+        if (rh->nnode >= rh->nalloc) {
+            rh->nalloc *= 2;
+            rh->nodes = pa_xrealloc(rh->nodes, sizeof(mir_node *)*rh->nalloc);
+        }
     }
     else {
-        rset = pa_xnew0(rset_data, 1);
+        /* the row of the resource set might have arrived already */
+        if ((rset = pa_hashmap_get(rif->lastrow, PA_UINT32_TO_PTR(rsetid))))
+            rset = rset_data_dup(rset);
+        else {
+            rset = pa_xnew0(rset_data, 1);
 
-        rset->id = pa_xstrdup(rsetid);
-        rset->policy = pa_xstrdup("unknown");
+            rset->id = rsetid;
+            rset->policy = pa_xstrdup("unknown");
+        }
 
         rh = pa_xnew0(rset_hash, 1);
 
-        rh->nnode = 1;
-        rh->nodes = pa_xnew0(mir_node *, 2);
-        rh->rset  = rset;
-
-        pa_hashmap_put(rif->nodes.rsetid, rh->rset->id, rh);
+        rh->nalloc = 2;
+        rh->nodes  = pa_xnew0(mir_node *, rh->nalloc);
+        rh->rset   = rset;
 
-        i = 0;
+        pa_hashmap_put(rif->nodes.rsetid, PA_UINT32_TO_PTR(rsetid), rh);
     }
 
+    rh->nodes[rh->nnode++] = node;
 
-    rh->nodes[i+0] = node;
-    rh->nodes[i+1] = NULL;
-
-    pa_log("    depth: %u", rh->nnode);
+    pa_log_debug("    depth: %zu", rh->nnode);
 
     return rh;
 }
 
-static rset_hash *rset_hashmap_get(struct userdata *u, const char *rsetid)
+static rset_hash *rset_hashmap_get(struct userdata *u, uint32_t rsetid)
 {
     pa_murphyif *murphyif;
     resource_interface *rif;
-    rset_hash *rh;
 
     pa_assert(u);
-    pa_assert(rsetid);
-    pa_assert(murphyif = u->murphyif);
+    pa_assert_se((murphyif = u->murphyif));
     
     rif = &murphyif->resource;
 
-    if ((rh = pa_hashmap_get(rif->nodes.rsetid, rsetid)))
-        return rh;
-
-    return NULL;
+    return pa_hashmap_get(rif->nodes.rsetid, PA_UINT32_TO_PTR(rsetid));
 }
 
 static int rset_hashmap_remove(struct userdata *u,
-                               const char *rsetid,
+                               uint32_t rsetid,
                                mir_node *node)
 {
     pa_murphyif *murphyif;
     resource_interface *rif;
     rset_hash *rh;
-    size_t i,j;
+    size_t i;
 
     pa_assert(u);
     pa_assert_se((murphyif = u->murphyif));
 
     rif = &murphyif->resource;
 
-    if ((rh = pa_hashmap_get(rif->nodes.rsetid, rsetid))) {
+    if ((rh = pa_hashmap_get(rif->nodes.rsetid, PA_UINT32_TO_PTR(rsetid)))) {
 
-        pa_log("    depth: %u", rh->nnode);
+        pa_log_debug("    depth: %zu", rh->nnode);
 
         for (i = 0;  i < rh->nnode;  i++) {
             if (node == rh->nodes[i]) {
                 if (rh->nnode <= 1) {
-                    pa_hashmap_remove(rif->nodes.rsetid, rsetid);
+                    pa_hashmap_remove(rif->nodes.rsetid,
+                                      PA_UINT32_TO_PTR(rsetid));
                     rset_hashmap_free(rh, NULL);
-                    return 0;
                 }
                 else {
-                    for (j = i;  j < rh->nnode;  j++)
-                        rh->nodes[j] = rh->nodes[j+1];
-
+                    memmove(rh->nodes + i, rh->nodes + i + 1,
+                            sizeof(mir_node *) * (rh->nnode - i - 1));
                     rh->nnode--;
-
-                    return 0;
                 }
+
+                return 0;
             }
         }
     }
@@ -2181,6 +2876,46 @@ static int rset_hashmap_remove(struct userdata *u,
     return -1;
 }
 
+static void lastrow_free(void *r, void *userdata)
+{
+    (void)userdata;
+
+    rset_data_free((rset_data *)r);
+}
+
+static void lastrow_put(struct userdata *u, rset_data *rset)
+{
+    pa_murphyif *murphyif;
+    resource_interface *rif;
+    rset_data *last;
+
+    pa_assert(u);
+    pa_assert(rset);
+    pa_assert_se((murphyif = u->murphyif));
+
+    rif = &murphyif->resource;
+
+    if ((last = pa_hashmap_get(rif->lastrow, PA_UINT32_TO_PTR(rset->id))))
+        rset_data_update(last, rset);
+    else {
+        last = rset_data_dup(rset);
+        pa_hashmap_put(rif->lastrow, PA_UINT32_TO_PTR(last->id), last);
+    }
+}
+
+static void lastrow_remove(struct userdata *u, uint32_t rsetid)
+{
+    pa_murphyif *murphyif;
+    resource_interface *rif;
+
+    pa_assert(u);
+    pa_assert_se((murphyif = u->murphyif));
+
+    rif = &murphyif->resource;
+
+    rset_data_free(pa_hashmap_remove(rif->lastrow, PA_UINT32_TO_PTR(rsetid)));
+}
+
 #endif
 
 static pa_proplist *get_node_proplist(struct userdata *u, mir_node *node)
@@ -2207,16 +2942,22 @@ static pa_proplist *get_node_proplist(struct userdata *u, mir_node *node)
     return NULL;
 }
 
-static const char *get_node_pid(struct userdata *u, mir_node *node)
+static uint32_t get_node_pid(struct userdata *u, mir_node *node)
 {
     pa_proplist *pl;
+    const char *pidstr;
+    uint32_t pid;
 
     pa_assert(u);
  
-    if (node && (pl = get_node_proplist(u, node)))
-        return pa_proplist_gets(pl, PA_PROP_APPLICATION_PROCESS_ID);
+    if (node && (pl = get_node_proplist(u, node))) {
+        pidstr = pa_proplist_gets(pl, PA_PROP_APPLICATION_PROCESS_ID);
 
-    return NULL;
+        if (pidstr && pa_atou(pidstr, &pid) == 0)
+            return pid;
+    }
+
+    return 0;
 }
 
 /*
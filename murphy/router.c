@@ -25,16 +25,19 @@
 #include <pulsecore/pulsecore-config.h>
 
 #include <pulse/proplist.h>
+#include <pulse/rtclock.h>
 #include <pulsecore/module.h>
 
 #include "router.h"
 #include "node.h"
 #include "switch.h"
+#include "discover.h"
 #include "constrain.h"
 #include "volume.h"
 #include "fader.h"
 #include "utils.h"
 #include "classify.h"
+#include "scripting.h"
 
 
 static void rtgroup_destroy(struct userdata *, mir_rtgroup *);
@@ -46,7 +49,21 @@ static void add_rtentry(struct userdata *, mir_direction, mir_rtgroup *,
                         mir_node *);
 static void remove_rtentry(struct userdata *, mir_rtentry *);
 
-static void make_explicit_routes(struct userdata *, uint32_t);
+static mir_rtzone *get_zone(pa_router *, const char *);
+static mir_rtzone *home_zone(pa_router *, const char *);
+static void zone_free(void *, void *);
+static void reap_zones(pa_router *);
+static const char *zone_name(mir_node *);
+static void zone_insert(struct userdata *, mir_rtzone *, mir_node *);
+static void zone_move_streams(struct userdata *, mir_rtzone *, mir_rtzone *,
+                              const char *);
+static void count_wide(int *, uint32_t, int);
+static uint32_t foreign_wide(int *, uint32_t);
+static void route_changed_zones(struct userdata *);
+static mir_node *route_zone(struct userdata *, mir_rtzone *, mir_node *);
+static void add_zonewide_limits(struct userdata *, mir_rtzone *, uint32_t);
+
+static void make_explicit_routes(struct userdata *, mir_rtzone *, uint32_t);
 static mir_node *find_default_route(struct userdata *, mir_node *, uint32_t);
 static void implement_preroute(struct userdata *, mir_node *, mir_node *,
                                uint32_t);
@@ -56,11 +73,15 @@ static void implement_default_route(struct userdata *, mir_node *, mir_node *,
 static int uint32_cmp(uint32_t, uint32_t);
 
 static int node_priority(struct userdata *, mir_node *);
+static pa_bool_t top_priority_class(pa_router *, int);
 
 static int volume_class(mir_node *);
+static uint32_t class_mask(int);
 
 static int print_routing_table(pa_hashmap *, const char *, char *, int);
 
+static void settle_routing_cb(pa_mainloop_api *, pa_defer_event *, void *);
+
 
 static void pa_hashmap_rtgroup_free(void *rtg, void *u)
 {
@@ -85,8 +106,18 @@ pa_router *pa_router_init(struct userdata *u)
 
     router->priormap = pa_xnew0(int, num_classes);
 
-    MIR_DLIST_INIT(router->nodlist);
+    router->zones = pa_hashmap_new(pa_idxset_string_hash_func,
+                                   pa_idxset_string_compare_func);
+    router->zonewide = class_mask(mir_phone);
+
+    get_zone(router, PA_ZONE_NAME_DEFAULT);
+
     MIR_DLIST_INIT(router->connlist);
+
+    router->snapshot.settle = u->core->mainloop->defer_new(u->core->mainloop,
+                                                           settle_routing_cb,
+                                                           u);
+    u->core->mainloop->defer_enable(router->snapshot.settle, FALSE);
     
     return router;
 }
@@ -95,12 +126,9 @@ void pa_router_done(struct userdata *u)
 {
     pa_router      *router;
     mir_connection *conn, *c;
-    mir_node       *e,*n;
 
     if (u && (router = u->router)) {
-        MIR_DLIST_FOR_EACH_SAFE(mir_node, rtprilist, e,n, &router->nodlist) {
-            MIR_DLIST_UNLINK(mir_node, rtprilist, e);
-        }
+        pa_hashmap_free(router->zones, zone_free, NULL);
 
         MIR_DLIST_FOR_EACH_SAFE(mir_connection,link, conn,c,&router->connlist){
             MIR_DLIST_UNLINK(mir_connection, link, conn);
@@ -114,6 +142,10 @@ void pa_router_done(struct userdata *u)
         pa_xfree(router->classmap.output);
 
         pa_xfree(router->priormap);
+
+        if (router->snapshot.settle)
+            u->core->mainloop->defer_free(router->snapshot.settle);
+
         pa_xfree(router);
 
         u->router = NULL;
@@ -136,6 +168,7 @@ void mir_router_assign_class_priority(struct userdata *u,
         pa_log_debug("assigning priority %d to class '%s'",
                      pri, mir_node_type_str(class));
         priormap[class] = pri;
+        router->snapshot.valid = FALSE;
     }
 }
 
@@ -207,6 +240,7 @@ void mir_router_destroy_rtgroup(struct userdata *u,
     }
     else {
         rtgroup_destroy(u, rtg);
+        router->snapshot.valid = FALSE;
         pa_log_debug("routing group '%s' destroyed", name);
     }
 }
@@ -254,6 +288,7 @@ pa_bool_t mir_router_assign_class_to_rtgroup(struct userdata *u,
     }
 
     classmap[class] = rtg;
+    router->snapshot.valid = FALSE;
 
     pa_log_debug("class '%s' assigned to %s routing group '%s'",
                  clnam, direction, rtgrpnam);
@@ -267,19 +302,32 @@ void mir_router_register_node(struct userdata *u, mir_node *node)
 {
     pa_router   *router;
     mir_rtgroup *rtg;
+    mir_rtzone  *zone;
+    mir_rtzone  *defzone;
     void        *state;
-    int          priority;
-    mir_node    *before;
 
     pa_assert(u);
     pa_assert(node);
     pa_assert_se((router = u->router));
+
+    if (node->implement == mir_device)
+        router->snapshot.valid = FALSE;
     
     if (node->direction == mir_output) {
         if (node->implement == mir_device) {
             PA_HASHMAP_FOREACH(rtg, router->rtgroups.output, state) {
                 add_rtentry(u, mir_output, rtg, node);
             }
+
+            /*
+             * the streams of a zone without devices are routed in the
+             * default zone; the first device brings them home
+             */
+            zone = get_zone(router, zone_name(node));
+
+            if (!zone->ndevice++ &&
+                (defzone = get_zone(router, PA_ZONE_NAME_DEFAULT)) != zone)
+                zone_move_streams(u, defzone, zone, zone->name);
         }
         return;
     }
@@ -301,17 +349,7 @@ void mir_router_register_node(struct userdata *u, mir_node *node)
                 return;
         }
 
-        priority = node_priority(u, node);
-            
-        MIR_DLIST_FOR_EACH(mir_node, rtprilist, before, &router->nodlist) {
-            if (priority < node_priority(u, before)) {
-                MIR_DLIST_INSERT_BEFORE(mir_node, rtprilist, node,
-                                        &before->rtprilist);
-                return;
-            }
-        }
-            
-        MIR_DLIST_APPEND(mir_node, rtprilist, node, &router->nodlist);
+        zone_insert(u, home_zone(router, zone_name(node)), node);
 
         return;
     }
@@ -321,16 +359,30 @@ void mir_router_unregister_node(struct userdata *u, mir_node *node)
 {
     pa_router *router;
     mir_rtentry *rte, *n;
+    mir_rtzone *zone;
     
     pa_assert(u);
     pa_assert(node);
     pa_assert_se((router = u->router));
 
+    if (node->implement == mir_device)
+        router->snapshot.valid = FALSE;
+
     MIR_DLIST_FOR_EACH_SAFE(mir_rtentry,nodchain, rte,n, &node->rtentries) {
         remove_rtentry(u, rte);
     }
 
     MIR_DLIST_UNLINK(mir_node, rtprilist, node);
+
+    if (node->implement == mir_device && node->direction == mir_output &&
+        (zone = pa_hashmap_get(router->zones, zone_name(node))) &&
+        zone->ndevice > 0 && !--zone->ndevice &&
+        strcmp(zone->name, PA_ZONE_NAME_DEFAULT))
+    {
+        /* the zone is reaped by the next routing pass */
+        zone_move_streams(u, zone, get_zone(router, PA_ZONE_NAME_DEFAULT),
+                          NULL);
+    }
 }
 
 mir_connection *mir_router_add_explicit_route(struct userdata *u,
@@ -422,51 +474,51 @@ int mir_router_print_rtgroups(struct userdata *u, char *buf, int len)
 mir_node *mir_router_make_prerouting(struct userdata *u, mir_node *data)
 {
     pa_router     *router;
-    mir_node      *start;
-    mir_node      *end;
-    int            priority;
-    pa_bool_t      done;
+    mir_rtzone    *zone;
     mir_node      *target;
-    uint32_t       stamp;
 
     pa_assert(u);
     pa_assert_se((router = u->router));
     pa_assert_se((data->implement == mir_stream));
 
-    priority = node_priority(u, data);
-    done = FALSE;
-    target = NULL;
-    stamp = pa_utils_new_stamp();
+    pa_scripting_gc_hold(u);
 
-    make_explicit_routes(u, stamp);
+    zone = home_zone(router, zone_name(data));
 
-    MIR_DLIST_FOR_EACH_BACKWARD(mir_node, rtprilist, start, &router->nodlist) {
-        if (start->implement == mir_device) {
-#if 0
-            if (start->direction == mir_output)
-                continue;       /* we should never get here */
-            if (!start->mux && !start->loop)
-                continue;       /* skip not looped back input nodes */
-#endif
-            if (!start->loop)
-                continue;       /* only looped back devices routed here */
-        }
+    /*
+     * if nothing changed since the last routing pass of the zone its
+     * decisions still stand. Route the new stream the way that pass would
+     * have done and leave the rest of the zone to a pass in the main loop.
+     */
+    if (router->snapshot.valid && zone->stamp &&
+        (target = find_default_route(u, data, zone->stamp)) &&
+        target->paidx != PA_IDXSET_INVALID)
+    {
+        implement_preroute(u, data, target, zone->stamp);
 
-        if (priority >= node_priority(u, start)) {
-            if ((target = find_default_route(u, data, stamp)))
-                implement_preroute(u, data, target, stamp);
-            done = TRUE;
-        }
+        router->preroute.hits++;
+        zone->dirty = TRUE;
+        u->core->mainloop->defer_enable(router->snapshot.settle, TRUE);
 
-        if (start->stamp >= stamp)
-            continue;
+        pa_log_debug("'%s' prerouted from snapshot to '%s' (%u hits, "
+                     "%u misses)", data->amname, target->amname,
+                     router->preroute.hits, router->preroute.misses);
 
-        if ((end = find_default_route(u, start, stamp)))
-            implement_default_route(u, start, end, stamp);
-    }    
+        pa_scripting_gc_release(u);
 
-    if (!done && (target = find_default_route(u, data, stamp)))
-        implement_preroute(u, data, target, stamp);
+        return target;
+    }
+
+    router->preroute.misses++;
+
+    target = route_zone(u, zone, data);
+
+    add_zonewide_limits(u, zone, zone->stamp);
+
+    /* a new zone-wide stream affects the other zones as well */
+    route_changed_zones(u);
+
+    pa_scripting_gc_release(u);
 
     return target;
 }
@@ -474,46 +526,45 @@ mir_node *mir_router_make_prerouting(struct userdata *u, mir_node *data)
 
 void mir_router_make_routing(struct userdata *u)
 {
-    static pa_bool_t ongoing_routing;
-
     pa_router  *router;
-    mir_node   *start;
-    mir_node   *end;
-    uint32_t    stamp;
+    mir_rtzone *zone;
+    void       *state;
 
     pa_assert(u);
     pa_assert_se((router = u->router));
 
-    if (ongoing_routing)
-        return;
+    PA_HASHMAP_FOREACH(zone, router->zones, state) {
+        zone->dirty = TRUE;
+    }
 
-    ongoing_routing = TRUE;
-    stamp = pa_utils_new_stamp();
+    mir_router_make_zone_routing(u);
+}
 
-    make_explicit_routes(u, stamp);
+void mir_router_zone_changed(struct userdata *u, const char *name)
+{
+    pa_router  *router;
+    mir_rtzone *zone;
 
-    MIR_DLIST_FOR_EACH_BACKWARD(mir_node,rtprilist, start, &router->nodlist) {
-        if (start->implement == mir_device) {
-#if 0
-            if (start->direction == mir_output)
-                continue;       /* we should never get here */
-            if (!start->mux && !start->loop)
-                continue;       /* skip not looped back input nodes */
-#endif
-            if (!start->loop)
-                continue;       /* only looped back devices routed here */
-        }
+    pa_assert(u);
+    pa_assert_se((router = u->router));
 
-        if (start->stamp >= stamp)
-            continue;
+    zone = home_zone(router, name ? name : PA_ZONE_NAME_DEFAULT);
+    zone->dirty = TRUE;
+}
 
-        if ((end = find_default_route(u, start, stamp)))
-            implement_default_route(u, start, end, stamp);
-    }    
+void mir_router_make_zone_routing(struct userdata *u)
+{
+    pa_router  *router;
 
-    pa_fader_apply_volume_limits(u, stamp);
+    pa_assert(u);
+    pa_assert_se((router = u->router));
 
-    ongoing_routing = FALSE;
+    router->snapshot.valid = FALSE;
+    u->core->mainloop->defer_enable(router->snapshot.settle, FALSE);
+
+    route_changed_zones(u);
+
+    router->snapshot.valid = TRUE;
 }
 
 
@@ -777,7 +828,352 @@ static void remove_rtentry(struct userdata *u, mir_rtentry *rte)
     rtgroup_update_module_property(u, node->direction, rtg);
 }
 
-static void make_explicit_routes(struct userdata *u, uint32_t stamp)
+static mir_rtzone *get_zone(pa_router *router, const char *name)
+{
+    mir_rtzone *zone;
+
+    pa_assert(router);
+    pa_assert(name);
+
+    if (!(zone = pa_hashmap_get(router->zones, name))) {
+        zone = pa_xnew0(mir_rtzone, 1);
+        zone->name = pa_xstrdup(name);
+        MIR_DLIST_INIT(zone->nodlist);
+
+        pa_hashmap_put(router->zones, zone->name, zone);
+
+        pa_log_debug("routing zone '%s' created", name);
+    }
+
+    return zone;
+}
+
+static mir_rtzone *home_zone(pa_router *router, const char *name)
+{
+    mir_rtzone *zone;
+
+    pa_assert(router);
+    pa_assert(name);
+
+    /*
+     * zones are named by the clients, too. Don't create them for that;
+     * a zone exists for its devices and the rest goes to the default
+     */
+    if (!(zone = pa_hashmap_get(router->zones, name)) || !zone->ndevice)
+        zone = get_zone(router, PA_ZONE_NAME_DEFAULT);
+
+    return zone;
+}
+
+static void zone_free(void *data, void *userdata)
+{
+    mir_rtzone *zone = (mir_rtzone *)data;
+    mir_node   *e, *n;
+
+    (void)userdata;
+
+    if (zone) {
+        MIR_DLIST_FOR_EACH_SAFE(mir_node, rtprilist, e,n, &zone->nodlist) {
+            MIR_DLIST_UNLINK(mir_node, rtprilist, e);
+        }
+
+        pa_xfree(zone->name);
+        pa_xfree(zone);
+    }
+}
+
+static void reap_zones(pa_router *router)
+{
+    mir_rtzone *zone;
+    void       *state;
+
+    pa_assert(router);
+
+    /* removing the current entry is fine while iterating */
+    PA_HASHMAP_FOREACH(zone, router->zones, state) {
+        if (!zone->ndevice && strcmp(zone->name, PA_ZONE_NAME_DEFAULT)) {
+            pa_log_debug("routing zone '%s' removed", zone->name);
+
+            pa_hashmap_remove(router->zones, zone->name);
+            zone_free(zone, NULL);
+        }
+    }
+}
+
+static const char *zone_name(mir_node *node)
+{
+    pa_assert(node);
+
+    return node->zone ? node->zone : PA_ZONE_NAME_DEFAULT;
+}
+
+static void zone_insert(struct userdata *u, mir_rtzone *zone, mir_node *node)
+{
+    mir_node *before;
+    int       priority;
+
+    pa_assert(u);
+    pa_assert(zone);
+    pa_assert(node);
+
+    priority = node_priority(u, node);
+
+    MIR_DLIST_FOR_EACH(mir_node, rtprilist, before, &zone->nodlist) {
+        if (priority < node_priority(u, before)) {
+            MIR_DLIST_INSERT_BEFORE(mir_node, rtprilist, node,
+                                    &before->rtprilist);
+            return;
+        }
+    }
+
+    MIR_DLIST_APPEND(mir_node, rtprilist, node, &zone->nodlist);
+}
+
+static void zone_move_streams(struct userdata *u,
+                              mir_rtzone      *from,
+                              mir_rtzone      *to,
+                              const char      *name)
+{
+    mir_node *node, *n;
+
+    pa_assert(u);
+    pa_assert(from);
+    pa_assert(to);
+
+    MIR_DLIST_FOR_EACH_SAFE(mir_node, rtprilist, node,n, &from->nodlist) {
+        if (name && strcmp(zone_name(node), name))
+            continue;
+
+        pa_log_debug("'%s' is routed in zone '%s' from now on",
+                     node->amname, to->name);
+
+        MIR_DLIST_UNLINK(mir_node, rtprilist, node);
+        zone_insert(u, to, node);
+
+        from->dirty = to->dirty = TRUE;
+    }
+}
+
+static void count_wide(int *nwide, uint32_t wide, int inc)
+{
+    int i;
+
+    for (i = 0;  wide;  i++, wide >>= 1) {
+        if (wide & 1)
+            nwide[i] += inc;
+    }
+}
+
+static uint32_t foreign_wide(int *nwide, uint32_t own)
+{
+    uint32_t foreign = 0;
+    int i;
+
+    /* classes routed in some zone, not counting the given one */
+    for (i = 0;  i < 32;  i++) {
+        if (nwide[i] > (int)((own >> i) & 1))
+            foreign |= ((uint32_t)1) << i;
+    }
+
+    return foreign;
+}
+
+static void route_changed_zones(struct userdata *u)
+{
+    static pa_bool_t ongoing_routing;
+
+    pa_router  *router;
+    mir_rtzone *zone;
+    void       *state;
+    uint32_t    foreign;
+    uint32_t    wide;
+    int         nwide[32];
+    pa_bool_t   dirty;
+    int         npass;
+    int         round;
+    pa_usec_t   begin;
+
+    pa_assert(u);
+    pa_assert_se((router = u->router));
+
+    if (ongoing_routing)
+        return;
+
+    ongoing_routing = TRUE;
+    begin = pa_rtclock_now();
+    pa_scripting_gc_hold(u);
+
+    npass = round = 0;
+
+    reap_zones(router);
+
+    /* number of zones routing each of the zone-wide classes */
+    memset(nwide, 0, sizeof(nwide));
+
+    PA_HASHMAP_FOREACH(zone, router->zones, state) {
+        count_wide(nwide, zone->wide, 1);
+    }
+
+    /*
+     * the zone-wide classes of a zone depend only on its own streams, so
+     * the second round re-routes at most the zones that were routed before
+     * a zone-wide change in some other zone, and the third finds nothing
+     */
+    do {
+        dirty = FALSE;
+
+        PA_HASHMAP_FOREACH(zone, router->zones, state) {
+            /*
+             * the zone-wide classes of the other zones are part of the
+             * input of the zone; if they changed the zone needs a pass
+             */
+            foreign = foreign_wide(nwide, zone->wide);
+
+            if (foreign != zone->foreign) {
+                zone->foreign = foreign;
+                zone->dirty = TRUE;
+            }
+
+            if (!zone->dirty)
+                continue;
+
+            wide = zone->wide;
+
+            route_zone(u, zone, NULL);
+
+            count_wide(nwide, wide, -1);
+            count_wide(nwide, zone->wide, 1);
+
+            add_zonewide_limits(u, zone, zone->stamp);
+            pa_fader_apply_zone_volume_limits(u, zone->name, zone->stamp);
+
+            npass++;
+            dirty = TRUE;
+        }
+    } while (dirty && ++round < 3);
+
+    pa_scripting_gc_release(u);
+
+    if (npass) {
+        router->lastpass = pa_rtclock_now() - begin;
+
+        if (!router->firstpass)
+            router->firstpass = router->lastpass;
+
+        pa_log_debug("%d zone routing pass(es) took %lu usec",
+                     npass, (unsigned long)router->lastpass);
+
+        /* the pass might have moved streams off the null sink */
+        pa_discover_resume_parked_streams(u);
+    }
+
+    ongoing_routing = FALSE;
+}
+
+static mir_node *route_zone(struct userdata *u,
+                            mir_rtzone      *zone,
+                            mir_node        *data)
+{
+    pa_router *router;
+    mir_node  *start;
+    mir_node  *end;
+    mir_node  *target;
+    int        priority;
+    pa_bool_t  done;
+    uint32_t   stamp;
+
+    pa_assert(u);
+    pa_assert(zone);
+    pa_assert_se((router = u->router));
+
+    priority = data ? node_priority(u, data) : 0;
+    done = data ? FALSE : TRUE;
+    target = NULL;
+    stamp = pa_utils_new_stamp();
+
+    pa_log_debug("routing zone '%s'", zone->name);
+
+    zone->dirty = FALSE;
+    zone->wide = 0;
+
+    make_explicit_routes(u, zone, stamp);
+
+    MIR_DLIST_FOR_EACH_BACKWARD(mir_node,rtprilist, start, &zone->nodlist) {
+        if (start->implement == mir_device) {
+#if 0
+            if (start->direction == mir_output)
+                continue;       /* we should never get here */
+            if (!start->mux && !start->loop)
+                continue;       /* skip not looped back input nodes */
+#endif
+            if (!start->loop)
+                continue;       /* only looped back devices routed here */
+        }
+
+        if (data && priority >= node_priority(u, start)) {
+            if ((target = find_default_route(u, data, stamp))) {
+                implement_preroute(u, data, target, stamp);
+                zone->wide |= class_mask(volume_class(data)) & router->zonewide;
+            }
+            done = TRUE;
+        }
+
+        if (start->stamp >= stamp)
+            continue;
+
+        if ((end = find_default_route(u, start, stamp))) {
+            implement_default_route(u, start, end, stamp);
+            zone->wide |= class_mask(volume_class(start)) & router->zonewide;
+        }
+    }    
+
+    if (!done && (target = find_default_route(u, data, stamp))) {
+        implement_preroute(u, data, target, stamp);
+        zone->wide |= class_mask(volume_class(data)) & router->zonewide;
+    }
+
+    zone->stamp = stamp;
+
+    return target;
+}
+
+static void add_zonewide_limits(struct userdata *u,
+                                mir_rtzone      *zone,
+                                uint32_t         stamp)
+{
+    pa_core  *core;
+    pa_sink  *sink;
+    mir_node *node;
+    uint32_t  idx;
+    int       class;
+
+    pa_assert(u);
+    pa_assert(zone);
+    pa_assert_se((core = u->core));
+
+    if (!zone->foreign)
+        return;
+
+    /* only the devices that got streams in this pass have any to limit */
+    PA_IDXSET_FOREACH(sink, core->sinks, idx) {
+        if (!(node = pa_discover_find_node_by_ptr(u, sink)) ||
+            node->vlim.stamp != stamp ||
+            strcmp(zone_name(node), zone->name))
+            continue;
+
+        for (class = mir_application_class_begin;
+             class < mir_application_class_end;
+             class++)
+        {
+            if (zone->foreign & class_mask(class))
+                mir_volume_add_limiting_class(u, node, class, stamp);
+        }
+    }
+}
+
+static void make_explicit_routes(struct userdata *u,
+                                 mir_rtzone      *zone,
+                                 uint32_t         stamp)
 {
     pa_router *router;
     mir_connection *conn;
@@ -785,6 +1181,7 @@ static void make_explicit_routes(struct userdata *u, uint32_t stamp)
     mir_node *to;
 
     pa_assert(u);
+    pa_assert(zone);
     pa_assert_se((router = u->router));
 
     MIR_DLIST_FOR_EACH_BACKWARD(mir_connection,link, conn, &router->connlist) {
@@ -799,14 +1196,19 @@ static void make_explicit_routes(struct userdata *u, uint32_t stamp)
             continue;
         }
 
+        if (home_zone(router, zone_name(from)) != zone)
+            continue;           /* routed with the zone of its source */
+
         if (!mir_switch_setup_link(u, from, to, TRUE))
             continue;
 
         if (from->implement == mir_stream)
             from->stamp = stamp;
 
-        if (to->implement == mir_device)
+        if (to->implement == mir_device) {
             mir_volume_add_limiting_class(u, to, volume_class(from), stamp);
+            zone->wide |= class_mask(volume_class(from)) & router->zonewide;
+        }
     }
 }
 
@@ -819,14 +1221,20 @@ static mir_node *find_default_route(struct userdata *u,
     mir_node_type  class  = pa_classify_guess_application_class(start);
     mir_rtgroup  **classmap;
     mir_node      *end;
+    mir_node      *fallback;
     mir_rtgroup   *rtg;
     mir_rtentry   *rte;
+    const char    *zone;
+    pa_bool_t      urgent;
 
     if (class < 0 || class > router->maplen) {
         pa_log_debug("can't route '%s': class %d is out of range (0 - %d)",
                      start->amname, class, router->maplen);
         return NULL;
     }
+
+    /* the most important class (eg. phone) doesn't wait for any dwell */
+    urgent = top_priority_class(router, class);
     
     switch (start->direction) {
     case mir_input:     classmap = router->classmap.output;     break;
@@ -844,7 +1252,11 @@ static mir_node *find_default_route(struct userdata *u,
     pa_log_debug("using '%s' router group when routing '%s'",
                  rtg->name, start->amname);
 
-        
+    /* a stream of a zone without devices is routed in the default zone */
+    zone = home_zone(router, zone_name(start))->name;
+
+    fallback = NULL;
+
     MIR_DLIST_FOR_EACH_BACKWARD(mir_rtentry, link, rte, &rtg->entries) {
         if (!(end = rte->node)) {
             pa_log("   node was null in mir_rtentry");
@@ -861,6 +1273,12 @@ static mir_node *find_default_route(struct userdata *u,
             continue;
         }
 
+        if (strcmp(zone_name(end), zone)) {
+            pa_log_debug("   '%s' is in another zone. Skipping...",
+                         end->amname);
+            continue;
+        }
+
         if (end->paidx == PA_IDXSET_INVALID && !end->paport) {
             /* requires profile change. We do it only for BT headsets */
             if (end->type != mir_bluetooth_a2dp &&
@@ -880,11 +1298,26 @@ static mir_node *find_default_route(struct userdata *u,
                 continue;
             }
         }
+
+        if (!urgent && !pa_discover_can_switch_profile(u, end)) {
+            /* prefer a device that works as it is now, if there is any */
+            pa_log_debug("   '%s' would need a profile switch. "
+                         "Looking for an alternative...", end->amname);
+            if (!fallback)
+                fallback = end;
+            continue;
+        }
         
         pa_log_debug("routing '%s' => '%s'", start->amname, end->amname);
 
         return end;
     }
+
+    if (fallback) {
+        pa_log_debug("no alternative. routing '%s' => '%s' anyway",
+                     start->amname, fallback->amname);
+        return fallback;
+    }
     
     pa_log_debug("could not find route for '%s'", start->amname);
 
@@ -918,6 +1351,22 @@ static void implement_default_route(struct userdata *u,
 }
 
 
+static void settle_routing_cb(pa_mainloop_api *m,
+                              pa_defer_event  *e,
+                              void            *d)
+{
+    struct userdata *u = (struct userdata *)d;
+
+    pa_assert(m);
+    pa_assert(e);
+    pa_assert(u);
+
+    m->defer_enable(e, FALSE);
+
+    mir_router_make_zone_routing(u);
+}
+
+
 static int uint32_cmp(uint32_t v1, uint32_t v2)
 {
     if (v1 > v2)
@@ -945,6 +1394,26 @@ static int node_priority(struct userdata *u, mir_node *node)
     return router->priormap[class];
 }
 
+static pa_bool_t top_priority_class(pa_router *router, int class)
+{
+    int top;
+    int i;
+
+    pa_assert(router);
+    pa_assert(router->priormap);
+
+    if (class < 0 || class >= router->maplen)
+        return FALSE;
+
+    for (top = 0, i = 0;  i < router->maplen;  i++) {
+        if (router->priormap[i] > top)
+            top = router->priormap[i];
+    }
+
+    /* with no priorities assigned no class is special */
+    return top > 0 && router->priormap[class] == top;
+}
+
 static int volume_class(mir_node *node)
 {
     int device_class[mir_device_class_end - mir_device_class_begin] = {
@@ -967,6 +1436,15 @@ static int volume_class(mir_node *node)
     return mir_node_type_unknown;
 }
 
+static uint32_t class_mask(int class)
+{
+    if (class < mir_application_class_begin ||
+        class >= mir_application_class_end)
+        return 0;
+
+    return ((uint32_t)1) << (class - mir_application_class_begin);
+}
+
 
 static int print_routing_table(pa_hashmap  *table,
                                const char  *type,
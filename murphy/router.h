@@ -45,12 +45,42 @@ struct pa_router {
     int                  maplen;   /**< length of the class- and priormap */
     pa_rtgroup_classmap  classmap; /**< to map device node types to rtgroups */
     int                 *priormap; /**< stream node priorities */
-    mir_dlist            nodlist;  /**< priorized list of the stream nodes
-                                        (entry in node: rtprilist) */
+    pa_hashmap          *zones;    /**< mir_rtzone's hashed by zone name */
+    uint32_t             zonewide; /**< mask of the classes that limit the
+                                        volume in every zone */
     mir_dlist            connlist; /**< listhead of the connections */
+    pa_usec_t            firstpass;/**< duration of the first routing pass */
+    pa_usec_t            lastpass; /**< duration of the last routing pass */
+    struct {
+        pa_bool_t        valid;    /**< whether the last pass can be reused */
+        pa_defer_event  *settle;   /**< zone pass after a cheap preroute */
+    }                    snapshot;
+    struct {
+        uint32_t         hits;     /**< prerouted from the snapshot */
+        uint32_t         misses;   /**< prerouted by a full pass */
+        uint32_t         parked;   /**< put on the null sink for the time
+                                        being */
+    }                    preroute;
 };
 
 
+/*
+ * zones are routed independently. Streams are routed only to the devices
+ * of their own zone and every zone has its own pass and stamp. The only
+ * dependency between the zones are the zone-wide classes, eg. a phone
+ * call in any zone ducks the streams of every zone.
+ */
+struct mir_rtzone {
+    char         *name;      /**< name of the zone */
+    mir_dlist     nodlist;   /**< priorized list of the stream nodes of
+                                  the zone (entry in node: rtprilist) */
+    uint32_t      stamp;     /**< stamp of the last pass of the zone */
+    uint32_t      wide;      /**< zone-wide classes routed in the zone */
+    uint32_t      foreign;   /**< zone-wide classes of the other zones */
+    pa_bool_t     dirty;     /**< whether the zone needs a pass */
+    int           ndevice;   /**< number of output devices in the zone */
+};
+
 struct mir_rtentry {
     mir_dlist    link;        /**< rtgroup chain */
     mir_dlist    nodchain;    /**< node chain */
@@ -98,6 +128,9 @@ void mir_router_unregister_node(struct userdata *, mir_node *);
 mir_node *mir_router_make_prerouting(struct userdata *, mir_node *);
 void mir_router_make_routing(struct userdata *);
 
+void mir_router_zone_changed(struct userdata *, const char *);
+void mir_router_make_zone_routing(struct userdata *);
+
 mir_connection *mir_router_add_explicit_route(struct userdata *, uint16_t,
                                               mir_node *, mir_node *);
 void mir_router_remove_explicit_route(struct userdata *, mir_connection *);
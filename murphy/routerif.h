@@ -56,7 +56,7 @@ enum am_method {
 pa_routerif *pa_routerif_init(struct userdata *, const char *,
                               const char *, const char *,
                               const char *, const char *,
-                              const char *);
+                              const char *, pa_bool_t);
 #else
 pa_routerif *pa_routerif_init(struct userdata *, const char *,
                               const char *, const char *);
@@ -75,6 +75,10 @@ pa_bool_t pa_routerif_register_node(struct userdata *, am_method,
                                     am_nodereg_data *);
 pa_bool_t pa_routerif_unregister_node(struct userdata *, am_method,
                                       am_nodeunreg_data *);
+int pa_routerif_register_nodes(struct userdata *, int, am_method *,
+                               am_nodereg_data **);
+int pa_routerif_unregister_nodes(struct userdata *, int, am_method *,
+                                 am_nodeunreg_data **);
 pa_bool_t pa_routerif_acknowledge(struct userdata *, am_method, am_ack_data *);
 
 #endif  /* foorouteriffoo */
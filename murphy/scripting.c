@@ -22,6 +22,13 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/pulsecore-config.h>
 #include <pulsecore/core-util.h>
@@ -53,6 +60,24 @@
 
 #define USERDATA           "murphy_ivi_userdata"
 
+#define POOL_GRANULARITY   16     /* size class step and object alignment */
+#define POOL_MAX_OBJSIZE   256    /* bigger objects bypass the pool */
+#define POOL_NCLASS        (POOL_MAX_OBJSIZE / POOL_GRANULARITY)
+#define POOL_SLAB_SIZE     4096
+#define POOL_GC_DEBT       (16 * 1024)
+#define POOL_GC_HEADROOM(l) ((l) / 4) /* collect before a hold this close
+                                         to the memory limit */
+
+#define BYTECODE_MAGIC     "MIVILUAC"
+#define BYTECODE_SUFFIX    "c"
+
+#define GC_STEP_SIZE       4      /* kbytes per incremental GC step */
+#define GC_IDLE_BUDGET     (1 * PA_USEC_PER_MSEC)
+#define GC_IDLE_INTERVAL   (20 * PA_USEC_PER_MSEC) /* between GC slices */
+
+#define POOL_CLASS(s)      (((s) - 1) / POOL_GRANULARITY)
+#define POOL_OBJSIZE(c)    (((c) + 1) * POOL_GRANULARITY)
+
 #undef  MRP_LUA_ENTER
 #define MRP_LUA_ENTER                                           \
     pa_log_debug("%s() enter", __FUNCTION__)
@@ -68,11 +93,59 @@
 #define MRP_LUA_LEAVE_NOARG                                     \
     pa_log_debug("%s() leave", __FUNCTION__)
 
-typedef void (*update_func_t)(struct userdata *);
+typedef void (*update_func_t)(struct userdata *, scripting_import *);
+
+typedef struct {
+    char            magic[8];     /**< BYTECODE_MAGIC */
+    char            version[16];  /**< LUA_RELEASE of the compiler */
+    uint64_t        hash;         /**< FNV-1a hash of the source */
+    uint64_t        size;         /**< size of the source file */
+    uint32_t        pathlen;      /**< length of source path incl. '\0' */
+    uint32_t        codelen;      /**< length of the bytecode */
+} bytecode_header;
+
+typedef struct {
+    char           *buf;
+    size_t          len;
+} bytecode_buffer;
+
+typedef struct pool_chunk  pool_chunk;
+typedef struct pool_slab   pool_slab;
+
+struct pool_chunk {
+    pool_chunk *next;
+};
+
+struct pool_slab {
+    pool_slab  *next;
+};
+
+typedef struct {
+    size_t          limit;    /**< max. bytes Lua may use; 0 = unlimited */
+    size_t          live;     /**< bytes currently in use by Lua */
+    size_t          peak;     /**< highest value of live */
+    size_t          debt;     /**< bytes allocated and not yet paid off
+                                   by idle GC steps */
+    pool_chunk     *free[POOL_NCLASS]; /**< free lists per size class */
+    pool_slab      *slabs;    /**< every slab we ever allocated */
+} lua_pool;
+
+typedef struct {
+    int             hold;     /**< nesting level of critical sections */
+    uint32_t        nstep;    /**< number of idle steps so far */
+    uint32_t        ncycle;   /**< number of completed GC cycles */
+    pa_usec_t       last;     /**< duration of the last step */
+    pa_usec_t       max;      /**< duration of the longest step */
+    pa_usec_t       total;    /**< time spent with idle GC altogether */
+} gc_stat;
 
 struct pa_scripting {
     lua_State *L;
     pa_bool_t configured;
+    lua_pool pool;
+    gc_stat gc;
+    pa_mainloop_api *mainloop;
+    pa_time_event *gctimer;
 };
 
 struct scripting_import {
@@ -81,6 +154,8 @@ struct scripting_import {
     mrp_lua_strarray_t *columns;
     const char         *condition;
     pa_value           *values;
+    pa_bool_t          *changed;  /**< per row change flags of last update */
+    int                 nchanged; /**< number of rows changed */
     mrp_funcbridge_t   *update;
 };
 
@@ -131,6 +206,7 @@ struct scripting_apclass {
     const char         *class;
     mir_node_type       type;
     int                 priority;
+    int                 latency;
     route_t            *route;
     map_t              *roles;
     map_t              *binaries;
@@ -192,8 +268,10 @@ typedef enum {
     OUTPUT,
     TABLES,
     UPDATE,
+    CHANGED,
     COMPARE,
     COLUMNS,
+    LATENCY,
     PRIVACY,
     BINARIES,
     CHANNELS,
@@ -210,6 +288,8 @@ typedef enum {
     DESCRIPTION,
 } field_t;
 
+static int field_table = LUA_NOREF;   /* registry ref of name->field_t map */
+
 static int  import_create(lua_State *);
 static int  import_getfield(lua_State *);
 static int  import_setfield(lua_State *);
@@ -220,9 +300,13 @@ static int  import_link(lua_State *);
 
 static void import_data_changed(struct userdata *, const char *,
                                 int, mrp_domctl_value_t **);
+static pa_bool_t import_update_cell(pa_value *, mrp_domctl_value_t *);
+static int import_changed_push(lua_State *, scripting_import *);
 static bool update_bridge(lua_State *, void *, const char *,
                           mrp_funcbridge_value_t *, char *,
                           mrp_funcbridge_value_t *);
+static void make_routes_update(struct userdata *, scripting_import *);
+static void make_volumes_update(struct userdata *, scripting_import *);
 
 static void array_class_create(lua_State *);
 static pa_value *array_create(lua_State *, int, mrp_lua_strarray_t *);
@@ -305,10 +389,19 @@ static map_t *map_check(lua_State *, int);
 static int map_push(lua_State *, map_t *);
 static void map_destroy(map_t *);
 
+static void field_table_create(lua_State *);
 static field_t field_check(lua_State *, int, const char **);
 static field_t field_name_to_type(const char *, size_t);
 static int make_id(char *buf, size_t len, const char *fmt, ...);
 
+static char *source_read(const char *, size_t *);
+static uint64_t source_hash(const char *, size_t);
+static pa_bool_t bytecode_load(lua_State *, const char *, const char *,
+                               uint64_t, size_t);
+static void bytecode_save(lua_State *, const char *, const char *,
+                          uint64_t, size_t);
+static int bytecode_writer(lua_State *, const void *, size_t, void *);
+
 static void setup_murphy_interface(struct userdata *);
 static char *comma_separated_list(mrp_lua_strarray_t *, char *, int);
 
@@ -316,6 +409,13 @@ static bool define_constants(lua_State *);
 static bool register_methods(lua_State *);
 
 static void *alloc(void *, void *, size_t, size_t);
+static void *pool_get(lua_pool *, size_t);
+static void pool_put(lua_pool *, void *, size_t);
+static void pool_refill(lua_pool *, int);
+static void pool_free_slabs(lua_pool *);
+static void schedule_gc(pa_scripting *);
+static void gc_idle_cb(pa_mainloop_api *, pa_time_event *,
+                       const struct timeval *, void *);
 static int panic(lua_State *);
 
 
@@ -433,16 +533,30 @@ MRP_LUA_CLASS_DEF_SIMPLE (
 );
 
 
-pa_scripting *pa_scripting_init(struct userdata *u)
+pa_scripting *pa_scripting_init(struct userdata *u, const char *memlimit_str)
 {
     pa_scripting *scripting;
+    pa_mainloop_api *mainloop;
+    uint32_t memlimit;
     lua_State *L;
 
     pa_assert(u);
+    pa_assert(u->core);
+    pa_assert_se((mainloop = u->core->mainloop));
 
     scripting = pa_xnew0(pa_scripting, 1);
 
-    if (!(L = lua_newstate(alloc, u)))
+    if (!memlimit_str || pa_atou(memlimit_str, &memlimit) < 0)
+        memlimit = 0;
+
+    scripting->pool.limit = (size_t)memlimit * 1024;
+
+    scripting->mainloop = mainloop;
+
+    if (memlimit)
+        pa_log_info("Lua memory is limited to %u kbytes", memlimit);
+
+    if (!(L = lua_newstate(alloc, scripting)))
         pa_log("failed to initialize Lua");
     else {
         lua_atpanic(L, &panic);
@@ -457,6 +571,7 @@ pa_scripting *pa_scripting_init(struct userdata *u)
         mrp_lua_create_object_class(L, VOLLIM_CLASS);
 
         array_class_create(L);
+        field_table_create(L);
 
         define_constants(L);
         register_methods(L);
@@ -474,18 +589,104 @@ pa_scripting *pa_scripting_init(struct userdata *u)
 void pa_scripting_done(struct userdata *u)
 {
     pa_scripting *scripting;
+    pa_mainloop_api *mainloop;
 
     if (u && (scripting = u->scripting)) {
+        pa_log_info("Lua memory usage: %lu bytes (peak %lu bytes)",
+                    (unsigned long)scripting->pool.live,
+                    (unsigned long)scripting->pool.peak);
+        pa_log_info("Lua idle GC: %u steps, %u cycles, %llu usec "
+                    "(longest step %llu usec)",
+                    scripting->gc.nstep, scripting->gc.ncycle,
+                    (unsigned long long)scripting->gc.total,
+                    (unsigned long long)scripting->gc.max);
+
+        if (scripting->gctimer && (mainloop = scripting->mainloop))
+            mainloop->time_free(scripting->gctimer);
+
+        pool_free_slabs(&scripting->pool);
+
         pa_xfree(scripting);
         u->scripting = NULL;
     }
 }
 
+void pa_scripting_memstat(struct userdata *u, size_t *live, size_t *peak)
+{
+    pa_scripting *scripting;
+
+    pa_assert(u);
+    pa_assert_se((scripting = u->scripting));
+
+    if (live)
+        *live = scripting->pool.live;
+    if (peak)
+        *peak = scripting->pool.peak;
+}
+
+void pa_scripting_gc_hold(struct userdata *u)
+{
+    pa_scripting *scripting;
+    lua_pool *pool;
+
+    pa_assert(u);
+
+    if ((scripting = u->scripting) && scripting->L) {
+        if (scripting->gc.hold++ == 0) {
+            pool = &scripting->pool;
+
+            /*
+             * the collector can't run from within alloc(), and Lua 5.1
+             * has no emergency collection, so free the garbage now rather
+             * than fail an allocation on the limit while it is stopped
+             */
+            if (pool->limit &&
+                pool->live + POOL_GC_HEADROOM(pool->limit) > pool->limit)
+            {
+                lua_gc(scripting->L, LUA_GCCOLLECT, 0);
+                pool->debt = 0;
+                scripting->gc.ncycle++;
+            }
+
+            lua_gc(scripting->L, LUA_GCSTOP, 0);
+        }
+    }
+}
+
+void pa_scripting_gc_release(struct userdata *u)
+{
+    pa_scripting *scripting;
+
+    pa_assert(u);
+
+    if ((scripting = u->scripting) && scripting->L) {
+        pa_assert(scripting->gc.hold > 0);
+
+        /*
+         * outside the critical sections the collector runs as usual, and
+         * is also stepped from a timer if enough was allocated to be
+         * worth it
+         */
+        if (--scripting->gc.hold == 0) {
+            lua_gc(scripting->L, LUA_GCRESTART, 0);
+            schedule_gc(scripting);
+        }
+    }
+}
+
 pa_bool_t pa_scripting_dofile(struct userdata *u, const char *file)
 {
     pa_scripting *scripting;
     lua_State *L;
     pa_bool_t success;
+    pa_bool_t cached;
+    int status;
+    pa_usec_t start, loaded, end;
+    char *source;
+    size_t srclen;
+    uint64_t hash;
+    char cache[PATH_MAX];
+    char chunk[PATH_MAX];
 
     pa_assert(u);
     pa_assert(file);
@@ -493,7 +694,39 @@ pa_bool_t pa_scripting_dofile(struct userdata *u, const char *file)
     pa_assert_se((scripting = u->scripting));
     pa_assert_se((L = scripting->L));
 
-    if (luaL_loadfile(L, file) || lua_pcall(L, 0, 0, 0)) {
+    if (snprintf(cache,sizeof(cache), "%s" BYTECODE_SUFFIX,file) >= PATH_MAX)
+        cache[0] = '\0';
+
+    start = pa_rtclock_now();
+
+    /*
+     * the cache is keyed on the content of the source, so an edit is
+     * noticed regardless of the timestamps
+     */
+    if (!(source = source_read(file, &srclen))) {
+        cached = FALSE;
+        status = luaL_loadfile(L, file);
+    }
+    else {
+        hash = source_hash(source, srclen);
+
+        if ((cached = cache[0] && bytecode_load(L,file,cache,hash,srclen)))
+            status = 0;
+        else {
+            snprintf(chunk, sizeof(chunk), "@%s", file);
+
+            status = luaL_loadbuffer(L, source, srclen, chunk);
+
+            if (status == 0 && cache[0])
+                bytecode_save(L, file, cache, hash, srclen);
+        }
+
+        pa_xfree(source);
+    }
+
+    loaded = pa_rtclock_now();
+
+    if (status || lua_pcall(L, 0, 0, 0)) {
         success = FALSE;
         pa_log("%s", lua_tostring(L, -1));
         lua_pop(L, 1);
@@ -502,6 +735,13 @@ pa_bool_t pa_scripting_dofile(struct userdata *u, const char *file)
         success =TRUE;
         scripting->configured = TRUE;
         setup_murphy_interface(u);
+
+        end = pa_rtclock_now();
+
+        pa_log_info("'%s' %s in %llu usec, executed in %llu usec", file,
+                    cached ? "loaded from bytecode cache" : "compiled",
+                    (unsigned long long)(loaded - start),
+                    (unsigned long long)(end - loaded));
     }
 
     return success;
@@ -574,6 +814,8 @@ static int import_create(lua_State *L)
     imp->columns = columns;
     imp->condition = condition;
     imp->values = array_create(L, maxrow, NULL);
+    imp->changed = pa_xnew0(pa_bool_t, maxrow);
+    imp->nchanged = 0;
     imp->update = update;
 
     for (i = 0, rows = imp->values->array;  i < maxrow;   i++) {
@@ -619,6 +861,7 @@ static int import_getfield(lua_State *L)
             case COLUMNS:     mrp_lua_push_strarray(L, imp->columns);    break;
             case CONDITION:   lua_pushstring(L, imp->condition);         break;
             case MAXROW:      lua_pushinteger(L, -imp->values->type);    break;
+            case CHANGED:     import_changed_push(L, imp);               break;
             default:          lua_pushnil(L);                            break;
             }
         }
@@ -661,6 +904,7 @@ static void import_destroy(void *data)
     pa_xfree((void *)imp->table);
     mrp_lua_free_strarray(imp->columns);
     pa_xfree((void *)imp->condition);
+    pa_xfree(imp->changed);
 
     MRP_LUA_LEAVE_NOARG;
 }
@@ -718,11 +962,12 @@ static void import_data_changed(struct userdata *u,
     scripting_import *imp;
     mrp_domctl_value_t *mrow;
     mrp_domctl_value_t *mcol;
-    pa_value *ptval, *prval, *pcval;
+    pa_value *ptval, *prval;
     pa_value **prow;
     pa_value **pcol;
     int maxcol;
     int maxrow;
+    pa_bool_t rowchg;
     mrp_funcbridge_value_t arg;
     mrp_funcbridge_value_t ret;
     char t;
@@ -752,6 +997,7 @@ static void import_data_changed(struct userdata *u,
         pa_assert(!strcmp(table, imp->table));
         pa_assert(imp->columns);
         pa_assert(imp->update);
+        pa_assert(imp->changed);
         pa_assert_se((ptval = imp->values));
         pa_assert_se((prow = ptval->array));
         
@@ -763,6 +1009,8 @@ static void import_data_changed(struct userdata *u,
 
         pa_log_debug("import '%s' found", imp->table);
 
+        imp->nchanged = 0;
+
         for (i = 0; i < maxrow;  i++) {
             pa_assert_se((prval = prow[i]));
             pa_assert_se((pcol = prval->array));
@@ -771,53 +1019,120 @@ static void import_data_changed(struct userdata *u,
 
             mrow = (i < nrow) ? mval[i] : NULL;
 
-            for (j = 0;  j < maxcol;  j++) {
-                pcval = pcol[j];
+            for (j = 0, rowchg = FALSE;  j < maxcol;  j++) {
                 mcol = mrow ? mrow + j : &empty;
-
-                switch (mcol->type) {
-                case MRP_DOMCTL_STRING:
-                    pa_assert(!pcval->type || pcval->type == pa_value_string);
-                    pa_xfree((void *)pcval->string);
-                    pcval->type = pa_value_string;
-                    pcval->string = pa_xstrdup(mcol->str);
-                    break;
-                case MRP_DOMCTL_INTEGER:
-                    pa_assert(!pcval->type || pcval->type == pa_value_integer);
-                    pcval->type = pa_value_integer;
-                    pcval->integer = mcol->s32;
-                    break;
-                case MRP_DOMCTL_UNSIGNED:
-                    pa_assert(!pcval->type || pcval->type == pa_value_unsignd);
-                    pcval->type = pa_value_unsignd;
-                    pcval->unsignd = mcol->u32;
-                    break;
-                case MRP_DOMCTL_DOUBLE:
-                    pa_assert(!pcval->type || pcval->type ==pa_value_floating);
-                    pcval->type = pa_value_floating;
-                    pcval->floating = mcol->dbl;
-                    break;
-                default:
-                    if (pcval->type == pa_value_string)
-                        pa_xfree((void *)pcval->string);
-                    memset(pcval, 0, sizeof(pa_value));
-                    break;
-                }
+                rowchg |= import_update_cell(pcol[j], mcol);
             }
+
+            if ((imp->changed[i] = rowchg))
+                imp->nchanged++;
         }
 
-        arg.pointer = imp;
+        if (!imp->nchanged)
+            pa_log_debug("import '%s': no change in content", imp->table);
+        else {
+            pa_log_debug("import '%s': %d row(s) changed",
+                         imp->table, imp->nchanged);
 
-        if (!mrp_funcbridge_call_from_c(L, imp->update, "o", &arg, &t, &ret)) {
-            pa_log("failed to call %s:update method (%s)",
-                   imp->table, ret.string);
-            pa_xfree((void *)ret.string);
+            arg.pointer = imp;
+
+            if (!mrp_funcbridge_call_from_c(L, imp->update, "o",
+                                            &arg, &t, &ret))
+            {
+                pa_log("failed to call %s:update method (%s)",
+                       imp->table, ret.string);
+                pa_xfree((void *)ret.string);
+            }
         }
     }
 
     lua_pop(L, 2);
 }
 
+static pa_bool_t import_update_cell(pa_value *pcval, mrp_domctl_value_t *mcol)
+{
+    size_t len;
+
+    pa_assert(pcval);
+    pa_assert(mcol);
+
+    switch (mcol->type) {
+
+    case MRP_DOMCTL_STRING:
+        pa_assert(!pcval->type || pcval->type == pa_value_string);
+
+        if (pcval->type == pa_value_string && pcval->string && mcol->str) {
+            if (pa_streq(pcval->string, mcol->str))
+                return FALSE;
+
+            /* reuse the existing buffer if the new value fits into it */
+            if ((len = strlen(mcol->str)) <= strlen(pcval->string)) {
+                memcpy((char *)pcval->string, mcol->str, len + 1);
+                return TRUE;
+            }
+        }
+
+        pa_xfree((void *)pcval->string);
+        pcval->type = pa_value_string;
+        pcval->string = pa_xstrdup(mcol->str);
+        return TRUE;
+
+    case MRP_DOMCTL_INTEGER:
+        pa_assert(!pcval->type || pcval->type == pa_value_integer);
+        if (pcval->type == pa_value_integer && pcval->integer == mcol->s32)
+            return FALSE;
+        pcval->type = pa_value_integer;
+        pcval->integer = mcol->s32;
+        return TRUE;
+
+    case MRP_DOMCTL_UNSIGNED:
+        pa_assert(!pcval->type || pcval->type == pa_value_unsignd);
+        if (pcval->type == pa_value_unsignd && pcval->unsignd == mcol->u32)
+            return FALSE;
+        pcval->type = pa_value_unsignd;
+        pcval->unsignd = mcol->u32;
+        return TRUE;
+
+    case MRP_DOMCTL_DOUBLE:
+        pa_assert(!pcval->type || pcval->type == pa_value_floating);
+        if (pcval->type == pa_value_floating && pcval->floating == mcol->dbl)
+            return FALSE;
+        pcval->type = pa_value_floating;
+        pcval->floating = mcol->dbl;
+        return TRUE;
+
+    default:
+        if (!pcval->type)
+            return FALSE;
+        if (pcval->type == pa_value_string)
+            pa_xfree((void *)pcval->string);
+        memset(pcval, 0, sizeof(pa_value));
+        return TRUE;
+    }
+}
+
+static int import_changed_push(lua_State *L, scripting_import *imp)
+{
+    int maxrow;
+    int i, n;
+
+    pa_assert(L);
+    pa_assert(imp);
+
+    maxrow = -imp->values->type;
+
+    lua_createtable(L, imp->nchanged, 0);
+
+    for (i = n = 0;  i < maxrow;  i++) {
+        if (imp->changed[i]) {
+            lua_pushinteger(L, i+1);
+            lua_rawseti(L, -2, ++n);
+        }
+    }
+
+    return 1;
+}
+
 
 static bool update_bridge(lua_State *L, void *data, const char *signature,
                           mrp_funcbridge_value_t *args,
@@ -846,12 +1161,35 @@ static bool update_bridge(lua_State *L, void *data, const char *signature,
         success = true;
         *ret_type = MRP_FUNCBRIDGE_NO_DATA;
         memset(ret_val, 0, sizeof(mrp_funcbridge_value_t));
-        update(u);
+        update(u, imp);
     }
 
     return success;
 }
 
+static void make_routes_update(struct userdata *u, scripting_import *imp)
+{
+    pa_assert(u);
+    pa_assert(imp);
+
+    pa_log_debug("'%s' changed in %d row(s). Routing ...",
+                 imp->table, imp->nchanged);
+
+    mir_router_make_routing(u);
+}
+
+static void make_volumes_update(struct userdata *u, scripting_import *imp)
+{
+    pa_assert(u);
+    pa_assert(imp);
+
+    /* the limits of every stream depend on the whole table */
+    pa_log_debug("'%s' changed in %d row(s). Applying volume limits ...",
+                 imp->table, imp->nchanged);
+
+    mir_volume_make_limiting(u);
+}
+
 
 
 static void array_class_create(lua_State *L)
@@ -1563,6 +1901,7 @@ static int apclass_create(lua_State *L)
     const char *class = NULL;
     mir_node_type type = -1;
     int priority = -1;
+    int latency = 0;
     route_t *route = NULL;
     map_t *roles = NULL;
     map_t *binaries = NULL;
@@ -1586,6 +1925,7 @@ static int apclass_create(lua_State *L)
         case CLASS:       class = luaL_checkstring(L, -1);             break;
         case NODE_TYPE:   type = luaL_checkint(L, -1);                 break;
         case PRIORITY:    priority = luaL_checkint(L, -1);             break;
+        case LATENCY:     latency = luaL_checkint(L, -1);              break;
         case ROUTE:       route = route_check(L, -1);                  break;
         case ROLES:       roles = map_check(L, -1);                    break;
         case BINARIES:    binaries = map_check(L, -1);                 break;
@@ -1603,6 +1943,8 @@ static int apclass_create(lua_State *L)
         luaL_error(L, "missing or invalid route field");
     if (!roles && !binaries)
         luaL_error(L, "missing roles or binaries");
+    if (latency < 0)
+        luaL_error(L, "invalid latency %d", latency);
 
     make_id(name, sizeof(name), "%s", mir_node_type_str(type));
 
@@ -1628,6 +1970,7 @@ static int apclass_create(lua_State *L)
     ac->class = class ? pa_xstrdup(class) : NULL;
     ac->type = type;
     ac->priority = priority;
+    ac->latency = latency;
     ac->route = route;
     ac->roles = roles;
     ac->binaries = binaries;
@@ -1647,6 +1990,12 @@ static int apclass_create(lua_State *L)
                 luaL_error(L, "role '%s' is added to mutiple application "
                            "classes", r->name);
             }
+
+            if (latency && pa_loopback_set_latency(u->loopback, r->name,
+                                                   latency) < 0) {
+                luaL_error(L, "invalid latency %d for role '%s'",
+                           latency, r->name);
+            }
         }
     }
 
@@ -1681,6 +2030,7 @@ static int apclass_getfield(lua_State *L)
         case NAME:           lua_pushstring(L, ac->name);          break;
         case NODE_TYPE:      lua_pushinteger(L, ac->type);         break;
         case PRIORITY:       lua_pushinteger(L, ac->priority);     break;
+        case LATENCY:        lua_pushinteger(L, ac->latency);      break;
         case ROUTE:          route_push(L, ac->route);             break;
         case ROLES:          map_push(L, ac->roles);               break;
         case BINARIES:       map_push(L, ac->binaries);            break;
@@ -1739,9 +2089,13 @@ static void apclass_destroy(void *data)
     ac->class = NULL;
 
     if (ac->roles) {
-        for (r = ac->roles;  r->name;  r++)
+        for (r = ac->roles;  r->name;  r++) {
             pa_nodeset_delete_role(u, r->name);
 
+            if (ac->latency && u->loopback)
+                pa_loopback_set_latency(u->loopback, r->name, 0);
+        }
+
         map_destroy(ac->roles);
         ac->roles = NULL;
     }
@@ -1983,12 +2337,26 @@ static int vollim_create(lua_State *L)
         memcpy(vlim->args, &limit->value, sizeof(limit->value));
     }
 
-    if (type == vollim_generic)
-        mir_volume_add_generic_limit(u, vollim_calculate, vlim->args);
+    /*
+     * the builtins are registered directly so that the volume module
+     * can compile them; only the scripted limits go through Lua
+     */
+    if (type == vollim_generic) {
+        if (correct)
+            mir_volume_add_generic_limit(u, mir_volume_correction,vlim->args);
+        else
+            mir_volume_add_generic_limit(u, vollim_calculate, vlim->args);
+    }
     else {
         for (i = 0;  i < classes->nint;  i++) {
-            mir_volume_add_class_limit(u, classes->ints[i], vollim_calculate,
-                                       vlim->args);
+            if (suppress) {
+                mir_volume_add_class_limit(u, classes->ints[i],
+                                           mir_volume_suppress, vlim->args);
+            }
+            else {
+                mir_volume_add_class_limit(u, classes->ints[i],
+                                           vollim_calculate, vlim->args);
+            }
         }
     }
 
@@ -2526,19 +2894,92 @@ static void map_destroy(map_t *map)
 }
 
 
+static void field_table_create(lua_State *L)
+{
+    static struct {
+        const char *name;
+        field_t     type;
+    } fields[] = {
+        { "name"       , NAME        },
+        { "type"       , TYPE        },
+        { "zone"       , ZONE        },
+        { "class"      , CLASS       },
+        { "input"      , INPUT       },
+        { "limit"      , LIMIT       },
+        { "route"      , ROUTE       },
+        { "roles"      , ROLES       },
+        { "table"      , TABLE       },
+        { "accept"     , ACCEPT      },
+        { "maxrow"     , MAXROW      },
+        { "output"     , OUTPUT      },
+        { "tables"     , TABLES      },
+        { "update"     , UPDATE      },
+        { "changed"    , CHANGED     },
+        { "compare"    , COMPARE     },
+        { "columns"    , COLUMNS     },
+        { "latency"    , LATENCY     },
+        { "privacy"    , PRIVACY     },
+        { "binaries"   , BINARIES    },
+        { "channels"   , CHANNELS    },
+        { "location"   , LOCATION    },
+        { "priority"   , PRIORITY    },
+        { "available"  , AVAILABLE   },
+        { "calculate"  , CALCULATE   },
+        { "condition"  , CONDITION   },
+        { "direction"  , DIRECTION   },
+        { "implement"  , IMPLEMENT   },
+        { "node_type"  , NODE_TYPE   },
+        { "attributes" , ATTRIBUTES  },
+        { "autorelease", AUTORELEASE },
+        { "description", DESCRIPTION },
+    };
+
+    size_t i;
+
+    pa_assert(L);
+
+    /*
+     * Lua strings are interned and carry their hash, so looking up
+     * the field key in this table costs the same as any table access
+     */
+    lua_createtable(L, 0, DIM(fields));
+
+    for (i = 0;  i < DIM(fields);  i++) {
+        pa_assert(field_name_to_type(fields[i].name, strlen(fields[i].name))
+                  == fields[i].type);
+
+        lua_pushstring(L, fields[i].name);
+        lua_pushinteger(L, fields[i].type);
+        lua_rawset(L, -3);
+    }
+
+    field_table = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
 static field_t field_check(lua_State *L, int idx, const char **ret_fldnam)
 {
-    const char *fldnam;
-    size_t fldnamlen;
     field_t fldtyp;
 
-    if (!(fldnam = lua_tolstring(L, idx, &fldnamlen)))
+    idx = (idx < 0) ? lua_gettop(L) + idx + 1 : idx;
+
+    if (lua_type(L, idx) != LUA_TSTRING) {
         fldtyp = 0;
-    else
-        fldtyp = field_name_to_type(fldnam, fldnamlen);
 
-    if (ret_fldnam)
-        *ret_fldnam = fldnam;
+        if (ret_fldnam)
+            *ret_fldnam = NULL;
+    }
+    else {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, field_table);
+        lua_pushvalue(L, idx);
+        lua_rawget(L, -2);
+
+        fldtyp = lua_tointeger(L, -1);
+
+        lua_pop(L, 2);
+
+        if (ret_fldnam)
+            *ret_fldnam = lua_tostring(L, idx);
+    }
 
     return fldtyp;
 }
@@ -2629,6 +3070,12 @@ static field_t field_name_to_type(const char *name, size_t len)
                 return COMPARE;
             if (!strcmp(name, "columns"))
                 return COLUMNS;
+            if (!strcmp(name, "changed"))
+                return CHANGED;
+            break;
+        case 'l':
+            if (!strcmp(name, "latency"))
+                return LATENCY;
             break;
         case 'p':
             if (!strcmp(name, "privacy"))
@@ -2732,6 +3179,203 @@ static int make_id(char *buf, size_t len, const char *fmt, ...)
 }
 
 
+static char *source_read(const char *path, size_t *len)
+{
+    struct stat st;
+    char *buf;
+    FILE *f;
+
+    pa_assert(path);
+    pa_assert(len);
+
+    if (!(f = fopen(path, "r")))
+        return NULL;
+
+    buf = NULL;
+
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)) {
+        buf = pa_xmalloc(st.st_size + 1);
+
+        if (fread(buf, 1, st.st_size, f) != (size_t)st.st_size) {
+            pa_xfree(buf);
+            buf = NULL;
+        }
+        else {
+            buf[st.st_size] = '\0';
+            *len = st.st_size;
+        }
+    }
+
+    fclose(f);
+
+    return buf;
+}
+
+static uint64_t source_hash(const char *buf, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;   /* FNV-1a */
+    size_t i;
+
+    pa_assert(buf || !len);
+
+    for (i = 0;  i < len;  i++) {
+        hash ^= (unsigned char)buf[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static pa_bool_t bytecode_load(lua_State *L, const char *path,
+                               const char *cache, uint64_t hash,
+                               size_t srclen)
+{
+    struct stat src, st;
+    bytecode_header *hdr;
+    const char *cpath;
+    char *buf;
+    size_t size;
+    FILE *f;
+    pa_bool_t success;
+
+    pa_assert(L);
+    pa_assert(path);
+    pa_assert(cache);
+
+    if (stat(path, &src) < 0 || !(f = fopen(cache, "r")))
+        return FALSE;
+
+    buf = NULL;
+    success = FALSE;
+
+    if (fstat(fileno(f), &st) < 0)
+        goto out;
+
+    /*
+     * we are about to execute whatever is in the cache, so it must be
+     * at least as well protected as the source itself
+     */
+    if (!S_ISREG(st.st_mode) || st.st_uid != src.st_uid ||
+        (st.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+        pa_log("ignoring bytecode cache '%s': bad ownership or permissions",
+               cache);
+        goto out;
+    }
+
+    if ((size = st.st_size) < sizeof(bytecode_header))
+        goto out;
+
+    buf = pa_xmalloc(size);
+
+    if (fread(buf, 1, size, f) != size)
+        goto out;
+
+    hdr   = (bytecode_header *)buf;
+    cpath = buf + sizeof(bytecode_header);
+
+    if (memcmp(hdr->magic, BYTECODE_MAGIC, sizeof(hdr->magic))     ||
+        strncmp(hdr->version, LUA_RELEASE, sizeof(hdr->version))  ||
+        hdr->hash  != hash                                        ||
+        hdr->size  != (uint64_t)srclen                            ||
+        sizeof(bytecode_header) + hdr->pathlen + hdr->codelen != size ||
+        hdr->pathlen < 1 || cpath[hdr->pathlen - 1]               ||
+        strcmp(cpath, path)                                        )
+    {
+        pa_log_debug("bytecode cache '%s' is stale", cache);
+        goto out;
+    }
+
+    if (luaL_loadbuffer(L, cpath + hdr->pathlen, hdr->codelen, path)) {
+        pa_log("failed to load bytecode cache '%s': %s", cache,
+               lua_tostring(L, -1));
+        lua_pop(L, 1);
+        goto out;
+    }
+
+    success = TRUE;
+
+ out:
+    fclose(f);
+    pa_xfree(buf);
+
+    return success;
+}
+
+static void bytecode_save(lua_State *L, const char *path, const char *cache,
+                          uint64_t hash, size_t srclen)
+{
+    bytecode_header hdr;
+    bytecode_buffer code;
+    char tmp[PATH_MAX];
+    size_t pathlen;
+    pa_bool_t written;
+    FILE *f;
+
+    pa_assert(L);
+    pa_assert(path);
+    pa_assert(cache);
+    pa_assert(lua_isfunction(L, -1));
+
+    code.buf = NULL;
+    code.len = 0;
+
+    if (lua_dump(L, bytecode_writer, &code) || !code.buf) {
+        pa_log_debug("failed to dump bytecode of '%s'", path);
+        pa_xfree(code.buf);
+        return;
+    }
+
+    pathlen = strlen(path) + 1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BYTECODE_MAGIC, sizeof(hdr.magic));
+    strncpy(hdr.version, LUA_RELEASE, sizeof(hdr.version));
+    hdr.hash    = hash;
+    hdr.size    = srclen;
+    hdr.pathlen = pathlen;
+    hdr.codelen = code.len;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid());
+
+    if (!(f = fopen(tmp, "w")))
+        pa_log_debug("can't create bytecode cache '%s': %s", tmp,
+                     strerror(errno));
+    else {
+        written = fwrite(&hdr, sizeof(hdr), 1, f) == 1  &&
+                  fwrite(path, pathlen, 1, f) == 1      &&
+                  fwrite(code.buf, code.len, 1, f) == 1;
+
+        if (fclose(f) != 0 || !written || rename(tmp, cache) < 0) {
+            pa_log_info("failed to write bytecode cache '%s'", cache);
+            unlink(tmp);
+        }
+        else {
+            pa_log_info("bytecode cache '%s' updated", cache);
+        }
+    }
+
+    pa_xfree(code.buf);
+}
+
+static int bytecode_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+    bytecode_buffer *code = (bytecode_buffer *)ud;
+
+    (void)L;
+
+    pa_assert(code);
+
+    if (sz > 0) {
+        code->buf = pa_xrealloc(code->buf, code->len + sz);
+        memcpy(code->buf + code->len, p, sz);
+        code->len += sz;
+    }
+
+    return 0;
+}
+
+
 static void setup_murphy_interface(struct userdata *u)
 {
     pa_scripting *scripting;
@@ -2915,8 +3559,8 @@ static bool define_constants(lua_State *L)
 static bool register_methods(lua_State *L)
 {
     static funcbridge_def_t funcbridge_defs[] = {
-        {"make_routes"    ,"o"  , update_bridge   ,mir_router_make_routing   },
-        {"make_volumes"   ,"o"  , update_bridge   ,mir_volume_make_limiting  },
+        {"make_routes"    ,"o"  , update_bridge   ,make_routes_update        },
+        {"make_volumes"   ,"o"  , update_bridge   ,make_volumes_update       },
         {"accept_default" ,"oo" , accept_bridge   ,mir_router_default_accept },
         {"compare_default","ooo", compare_bridge  ,mir_router_default_compare},
         {"accept_phone"   ,"oo" , accept_bridge   ,mir_router_phone_accept   },
@@ -2944,21 +3588,227 @@ static bool register_methods(lua_State *L)
 
 static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize)
 {
+    pa_scripting *scripting = (pa_scripting *)ud;
+    lua_pool *pool;
     void *mem;
 
-    (void)ud;
-    (void)osize;
+    pa_assert(scripting);
 
-    if (nsize)
+    pool = &scripting->pool;
+
+    if (!ptr)
+        osize = 0;
+
+    if (!nsize) {
+        pool_put(pool, ptr, osize);
+        pool->live -= osize;
+        return NULL;
+    }
+
+    if (nsize > osize && pool->limit &&
+        pool->live - osize + nsize > pool->limit)
+    {
+        pa_log("Lua memory limit (%lu bytes) exceeded",
+               (unsigned long)pool->limit);
+        return NULL;
+    }
+
+    if (ptr && osize <= POOL_MAX_OBJSIZE && nsize <= POOL_MAX_OBJSIZE &&
+        POOL_CLASS(osize) == POOL_CLASS(nsize))
+        mem = ptr;
+    else if (ptr && osize > POOL_MAX_OBJSIZE && nsize > POOL_MAX_OBJSIZE)
         mem = pa_xrealloc(ptr, nsize);
     else {
-        mem = NULL;
-        pa_xfree(ptr);
+        mem = pool_get(pool, nsize);
+
+        if (ptr) {
+            memcpy(mem, ptr, osize < nsize ? osize : nsize);
+            pool_put(pool, ptr, osize);
+        }
+    }
+
+    pool->live = pool->live - osize + nsize;
+
+    if (pool->live > pool->peak)
+        pool->peak = pool->live;
+
+    if (nsize > osize) {
+        pool->debt += nsize - osize;
+        schedule_gc(scripting);
     }
 
     return mem;
 }
 
+static void *pool_get(lua_pool *pool, size_t size)
+{
+    pool_chunk *chunk;
+    int class;
+
+    pa_assert(pool);
+    pa_assert(size > 0);
+
+    if (size > POOL_MAX_OBJSIZE)
+        return pa_xmalloc(size);
+
+    class = POOL_CLASS(size);
+
+    if (!pool->free[class])
+        pool_refill(pool, class);
+
+    pa_assert_se((chunk = pool->free[class]));
+    pool->free[class] = chunk->next;
+
+    return (void *)chunk;
+}
+
+static void pool_put(lua_pool *pool, void *ptr, size_t size)
+{
+    pool_chunk *chunk;
+    int class;
+
+    pa_assert(pool);
+
+    if (ptr) {
+        if (size > POOL_MAX_OBJSIZE)
+            pa_xfree(ptr);
+        else {
+            pa_assert(size > 0);
+
+            class = POOL_CLASS(size);
+            chunk = (pool_chunk *)ptr;
+
+            chunk->next = pool->free[class];
+            pool->free[class] = chunk;
+        }
+    }
+}
+
+static void pool_refill(lua_pool *pool, int class)
+{
+    pool_slab *slab;
+    pool_chunk *chunk;
+    size_t objsize;
+    char *p, *e;
+
+    pa_assert(pool);
+    pa_assert(class >= 0 && class < POOL_NCLASS);
+
+    objsize = POOL_OBJSIZE(class);
+
+    slab = pa_xmalloc(POOL_SLAB_SIZE);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    /* the first granule holds the slab header; the rest is carved up */
+    p = (char *)slab + POOL_GRANULARITY;
+    e = (char *)slab + POOL_SLAB_SIZE;
+
+    for (;  p + objsize <= e;  p += objsize) {
+        chunk = (pool_chunk *)p;
+        chunk->next = pool->free[class];
+        pool->free[class] = chunk;
+    }
+}
+
+static void pool_free_slabs(lua_pool *pool)
+{
+    pool_slab *slab, *next;
+
+    pa_assert(pool);
+
+    for (slab = pool->slabs;  slab;  slab = next) {
+        next = slab->next;
+        pa_xfree(slab);
+    }
+
+    memset(pool->free, 0, sizeof(pool->free));
+    pool->slabs = NULL;
+}
+
+static void schedule_gc(pa_scripting *scripting)
+{
+    pa_mainloop_api *mainloop;
+    struct timeval when;
+
+    pa_assert(scripting);
+
+    if (scripting->gctimer || scripting->gc.hold > 0 || !scripting->L ||
+        scripting->pool.debt < POOL_GC_DEBT)
+        return;
+
+    pa_assert_se((mainloop = scripting->mainloop));
+
+    pa_gettimeofday(&when);
+    pa_timeval_add(&when, GC_IDLE_INTERVAL);
+
+    scripting->gctimer = mainloop->time_new(mainloop, &when,
+                                            gc_idle_cb, scripting);
+}
+
+static void gc_idle_cb(pa_mainloop_api      *a,
+                       pa_time_event        *e,
+                       const struct timeval *tv,
+                       void                 *userdata)
+{
+    pa_scripting *scripting = (pa_scripting *)userdata;
+    lua_pool *pool;
+    gc_stat *gc;
+    lua_State *L;
+    pa_usec_t start, begin, end;
+    size_t paid;
+    uint32_t nstep;
+    int finished;
+
+    (void)tv;
+
+    pa_assert(a);
+    pa_assert(scripting);
+    pa_assert(scripting->gctimer == e);
+
+    a->time_free(e);
+    scripting->gctimer = NULL;
+
+    pool = &scripting->pool;
+    gc = &scripting->gc;
+
+    if (!(L = scripting->L) || gc->hold > 0)
+        return;
+
+    start = end = pa_rtclock_now();
+    nstep = 0;
+    finished = 0;
+
+    /* do only as much work as it takes to pay off the allocations */
+    while (pool->debt > 0 && !finished && end - start < GC_IDLE_BUDGET) {
+        begin = end;
+        finished = lua_gc(L, LUA_GCSTEP, GC_STEP_SIZE);
+        end = pa_rtclock_now();
+
+        paid = GC_STEP_SIZE * 1024;
+        pool->debt = pool->debt > paid ? pool->debt - paid : 0;
+
+        gc->last = end - begin;
+        gc->total += gc->last;
+        gc->nstep++;
+        nstep++;
+
+        if (gc->last > gc->max)
+            gc->max = gc->last;
+    }
+
+    pa_log_debug("Lua idle GC: %u step(s) in %llu usec%s", nstep,
+                 (unsigned long long)(end - start),
+                 finished ? " (cycle completed)" : "");
+
+    if (finished) {
+        gc->ncycle++;
+        pool->debt = 0;
+    }
+
+    schedule_gc(scripting);
+}
+
 static int panic(lua_State *L)
 {
     (void)L;
@@ -23,8 +23,12 @@
 #include "userdata.h"
 
 
-pa_scripting *pa_scripting_init(struct userdata *);
+pa_scripting *pa_scripting_init(struct userdata *, const char *);
 void pa_scripting_done(struct userdata *);
+void pa_scripting_memstat(struct userdata *, size_t *, size_t *);
+
+void pa_scripting_gc_hold(struct userdata *);
+void pa_scripting_gc_release(struct userdata *);
 
 pa_bool_t pa_scripting_dofile(struct userdata *, const char *);
 
@@ -19,22 +19,113 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
+#include <pulse/timeval.h>
 #include <pulsecore/pulsecore-config.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
 
 #include "userdata.h"
 #include "socketif.h"
 #include "audiomgr.h"
 
+#define AUDIOMGR_DEFAULT_SOCKTYPE  "unix"
+#define AUDIOMGR_DEFAULT_PATH      "/var/run/audiomgr/routing"
+#define AUDIOMGR_DEFAULT_ADDRESS   "127.0.0.1"
+#define AUDIOMGR_DEFAULT_PORT      4000
+
+#define RECONNECT_PERIOD           (2 * PA_USEC_PER_SEC)
+
+/*
+ * Wire format
+ *
+ * Every message is a frame of a fixed size header followed by the payload.
+ * All integers are in network byte order; strings are a 16-bit length
+ * followed by the characters without the terminating zero. Replies carry
+ * the sequence number of the request they answer. Requests are pipelined,
+ * ie. any number of them can be in flight, and everything queued during
+ * one main loop iteration goes out with a single write.
+ */
+#define FRAME_HEADER_SIZE          12
+#define FRAME_MAX_PAYLOAD          65536
+
+/* unparsed input we are willing to buffer before giving up on the peer */
+#define INPUT_MAX_BUFFERED         (16 * (FRAME_HEADER_SIZE+FRAME_MAX_PAYLOAD))
+
+#define FRAME_REQUEST              0x0000
+#define FRAME_REPLY                0x0001
+#define FRAME_ERROR                0x0002
+
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    size_t   len;
+    size_t   off;   /**< start of unconsumed data */
+} sockbuf;
+
+typedef struct {
+    am_method  method;
+    void      *data;
+} pending_req;
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *e;
+    pa_bool_t      ok;
+} decoder;
 
 struct pa_routerif {
-    int  sock;
+    struct userdata     *u;
+    int                  sock;
+    pa_bool_t            connected;
+    int                  family;
+    struct sockaddr_un   unaddr;
+    struct sockaddr_in   inaddr;
+    pa_io_event         *ioev;
+    pa_time_event       *retry;
+    uint32_t             seqno;
+    pa_hashmap          *pending;   /**< requests waiting for a reply */
+    sockbuf              in;
+    sockbuf              out;
 };
 
 
+static pa_bool_t socket_connect(pa_routerif *);
+static void socket_disconnect(pa_routerif *, pa_bool_t);
+static void schedule_reconnect(pa_routerif *);
+static void reconnect_cb(pa_mainloop_api *, pa_time_event *,
+                         const struct timeval *, void *);
+static void io_cb(pa_mainloop_api *, pa_io_event *, int,
+                  pa_io_event_flags_t, void *);
+static void update_io_events(pa_routerif *);
+static pa_bool_t socket_write(pa_routerif *);
+static pa_bool_t socket_read(pa_routerif *);
+static void dispatch_frame(pa_routerif *, uint16_t, uint16_t, uint32_t,
+                           const uint8_t *, size_t);
+static void dispatch_reply(pa_routerif *, uint16_t, pending_req *, decoder *);
+static void dispatch_request(pa_routerif *, uint16_t, uint32_t, decoder *);
+
+static void buf_reserve(sockbuf *, size_t);
+static void buf_put_u16(sockbuf *, uint16_t);
+static void buf_put_u32(sockbuf *, uint32_t);
+static void buf_put_str(sockbuf *, const char *);
+static size_t frame_begin(pa_routerif *, am_method, uint16_t, uint32_t);
+static void frame_end(pa_routerif *, size_t);
+static uint32_t send_request(pa_routerif *, am_method, size_t, void *);
+
+static uint16_t get_u16(decoder *);
+
+static void pending_free(void *, void *);
 
 static const char *method_str(am_method);
 
@@ -43,24 +134,89 @@ pa_routerif *pa_routerif_init(struct userdata *u,
                               const char      *addr,
                               const char      *port)
 {
-    pa_module      *m = u->module;
-    pa_routerif    *routerif = NULL;
-    
+    pa_routerif *routerif;
+    uint32_t     portno;
+
+    pa_assert(u);
+
+    if (!socktyp)
+        socktyp = AUDIOMGR_DEFAULT_SOCKTYPE;
+
     routerif = pa_xnew0(pa_routerif, 1);
+    routerif->u = u;
     routerif->sock = -1;
+    routerif->seqno = 1;
+    routerif->pending = pa_hashmap_new(pa_idxset_trivial_hash_func,
+                                       pa_idxset_trivial_compare_func);
+
+    if (!strcasecmp(socktyp, "unix")) {
+        if (!addr)
+            addr = AUDIOMGR_DEFAULT_PATH;
+
+        if (strlen(addr) >= sizeof(routerif->unaddr.sun_path)) {
+            pa_log("%s: too long socket path '%s'", __FILE__, addr);
+            goto fail;
+        }
+
+        routerif->family = AF_UNIX;
+        routerif->unaddr.sun_family = AF_UNIX;
+        strcpy(routerif->unaddr.sun_path, addr);
+    }
+    else if (!strcasecmp(socktyp, "tcp")) {
+        if (!addr)
+            addr = AUDIOMGR_DEFAULT_ADDRESS;
+
+        if (!port)
+            portno = AUDIOMGR_DEFAULT_PORT;
+        else if (pa_atou(port, &portno) < 0 || portno < 1 || portno > 65535) {
+            pa_log("%s: invalid port '%s'", __FILE__, port);
+            goto fail;
+        }
+
+        routerif->family = AF_INET;
+        routerif->inaddr.sin_family = AF_INET;
+        routerif->inaddr.sin_port = htons(portno);
+
+        if (inet_pton(AF_INET, addr, &routerif->inaddr.sin_addr) != 1) {
+            pa_log("%s: invalid address '%s'", __FILE__, addr);
+            goto fail;
+        }
+    }
+    else {
+        pa_log("%s: invalid socket type '%s'", __FILE__, socktyp);
+        goto fail;
+    }
+
+    /* the audio manager might not be up yet; that's fine */
+    if (!socket_connect(routerif))
+        schedule_reconnect(routerif);
 
     return routerif;
+
+ fail:
+    pa_hashmap_free(routerif->pending, NULL, NULL);
+    pa_xfree(routerif);
+    return NULL;
 }
 
 
 void pa_routerif_done(struct userdata *u)
 {
     pa_routerif *routerif;
+    pa_mainloop_api *ml;
 
     if (u && (routerif = u->routerif)) {
-        if (routerif->sock >= 0)
-            close(routerif->sock);
+        ml = u->core->mainloop;
+
+        socket_disconnect(routerif, FALSE);
+
+        if (routerif->retry)
+            ml->time_free(routerif->retry);
 
+        pa_hashmap_free(routerif->pending, pending_free, NULL);
+
+        pa_xfree(routerif->in.data);
+        pa_xfree(routerif->out.data);
         pa_xfree(routerif);
 
         u->routerif = NULL;
@@ -72,46 +228,75 @@ pa_bool_t pa_routerif_register_domain(struct userdata   *u,
                                            am_domainreg_data *dr)
 {
     pa_routerif *routerif;
-    int          success = TRUE;
+    size_t       frame;
 
     pa_assert(u);
     pa_assert(dr);
     pa_assert_se((routerif = u->routerif));
-    pa_assert(routerif->sock >= 0);
+
+    if (!routerif->connected) {
+        pa_xfree(dr);
+        return FALSE;
+    }
 
     pa_log_info("%s: registering to AudioManager", __FILE__);
 
-    return success;
+    frame = frame_begin(routerif, audiomgr_register_domain, FRAME_REQUEST, 0);
+    buf_put_u16(&routerif->out, dr->domain_id);
+    buf_put_str(&routerif->out, dr->name);
+    buf_put_str(&routerif->out, dr->bus_name);
+    buf_put_str(&routerif->out, dr->node_name);
+    buf_put_u16(&routerif->out, dr->early);
+    buf_put_u16(&routerif->out, dr->complete);
+    buf_put_u16(&routerif->out, dr->state);
+    send_request(routerif, audiomgr_register_domain, frame, dr);
+
+    return TRUE;
 }
 
 pa_bool_t pa_routerif_domain_complete(struct userdata *u, uint16_t domain)
 {
     pa_routerif *routerif;
-    pa_bool_t    success = TRUE;
+    size_t       frame;
 
     pa_assert(u);
     pa_assert_se((routerif = u->routerif));
-    pa_assert(routerif->sock >= 0);
+
+    if (!routerif->connected)
+        return FALSE;
 
     pa_log_debug("%s: domain %u AudioManager %s", __FUNCTION__,
                  domain, method_str(audiomgr_domain_complete));
 
-    return success;
+    frame = frame_begin(routerif, audiomgr_domain_complete, FRAME_REQUEST, 0);
+    buf_put_u16(&routerif->out, domain);
+    send_request(routerif, audiomgr_domain_complete, frame, NULL);
+
+    return TRUE;
 }
 
 pa_bool_t pa_routerif_unregister_domain(struct userdata *u, uint16_t domain)
 {
     pa_routerif *routerif;
-    pa_bool_t    success = TRUE;
+    size_t       frame;
 
     pa_assert(u);
     pa_assert_se((routerif = u->routerif));
-    pa_assert(routerif->sock >= 0);
+
+    if (!routerif->connected)
+        return FALSE;
 
     pa_log_info("%s: deregistreing domain %u from AudioManager",
                 __FILE__, domain);
 
-    return success;
+    frame = frame_begin(routerif, audiomgr_deregister_domain, FRAME_REQUEST,0);
+    buf_put_u16(&routerif->out, domain);
+    send_request(routerif, audiomgr_deregister_domain, frame, NULL);
+
+    /* we're going away; try to get this out right now */
+    socket_write(routerif);
+
+    return TRUE;
 }
 
 
@@ -121,16 +306,55 @@ pa_bool_t pa_routerif_register_node(struct userdata *u,
 {
     const char      *method = method_str(m);
     pa_routerif     *routerif;
-    pa_bool_t        success = TRUE;
+    sockbuf         *b;
+    size_t           frame;
 
     pa_assert(u);
     pa_assert(rd);
     pa_assert_se((routerif = u->routerif));
-    pa_assert(routerif->sock >= 0);
+
+    if (!routerif->connected)
+        return FALSE;
 
     pa_log_debug("%s: %s '%s' to AudioManager", __FUNCTION__, method,rd->name);
 
-    return success;
+    b = &routerif->out;
+    frame = frame_begin(routerif, m, FRAME_REQUEST, 0);
+
+    switch (m) {
+    case audiomgr_register_sink:
+        buf_put_u16(b, rd->id);
+        buf_put_str(b, rd->name);
+        buf_put_u16(b, rd->domain);
+        buf_put_u16(b, rd->class);
+        buf_put_u16(b, rd->volume);
+        buf_put_u16(b, rd->visible);
+        buf_put_u16(b, rd->avail.status);
+        buf_put_u16(b, rd->avail.reason);
+        buf_put_u16(b, rd->mute);
+        buf_put_u16(b, rd->mainvol);
+        break;
+    case audiomgr_register_source:
+        buf_put_u16(b, rd->id);
+        buf_put_str(b, rd->name);
+        buf_put_u16(b, rd->domain);
+        buf_put_u16(b, rd->class);
+        buf_put_u16(b, rd->state);
+        buf_put_u16(b, rd->volume);
+        buf_put_u16(b, rd->visible);
+        buf_put_u16(b, rd->avail.status);
+        buf_put_u16(b, rd->avail.reason);
+        buf_put_u16(b, rd->interrupt);
+        break;
+    default:
+        pa_log("%s: invalid node registration method '%s'", __FILE__, method);
+        b->len = frame;
+        return FALSE;
+    }
+
+    send_request(routerif, m, frame, rd);
+
+    return TRUE;
 }
 
 
@@ -140,16 +364,67 @@ pa_bool_t pa_routerif_unregister_node(struct userdata *u,
 {
     const char  *method = method_str(m);
     pa_routerif *routerif;
-    pa_bool_t    success = TRUE;
+    size_t       frame;
 
     pa_assert(u);
     pa_assert(ud);
     pa_assert_se((routerif = u->routerif));
-    pa_assert(routerif->sock >= 0);
+
+    if (!routerif->connected)
+        return FALSE;
 
     pa_log_debug("%s: %s '%s' to AudioManager", __FUNCTION__, method,ud->name);
 
-    return success;
+    frame = frame_begin(routerif, m, FRAME_REQUEST, 0);
+    buf_put_u16(&routerif->out, ud->id);
+    send_request(routerif, m, frame, ud);
+
+    return TRUE;
+}
+
+
+int pa_routerif_register_nodes(struct userdata *u,
+                               int n,
+                               am_method *m,
+                               am_nodereg_data **rd)
+{
+    int i, nsent;
+
+    pa_assert(u);
+    pa_assert(m);
+    pa_assert(rd);
+
+    /* all of these end up in the same write */
+    for (i = nsent = 0;  i < n;  i++) {
+        if (rd[i] && pa_routerif_register_node(u, m[i], rd[i])) {
+            rd[i] = NULL;
+            nsent++;
+        }
+    }
+
+    return nsent;
+}
+
+
+int pa_routerif_unregister_nodes(struct userdata *u,
+                                 int n,
+                                 am_method *m,
+                                 am_nodeunreg_data **ud)
+{
+    int i, nsent;
+
+    pa_assert(u);
+    pa_assert(m);
+    pa_assert(ud);
+
+    for (i = nsent = 0;  i < n;  i++) {
+        if (ud[i] && pa_routerif_unregister_node(u, m[i], ud[i])) {
+            ud[i] = NULL;
+            nsent++;
+        }
+    }
+
+    return nsent;
 }
 
 
@@ -158,16 +433,656 @@ pa_bool_t pa_routerif_acknowledge(struct userdata *u, am_method m,
 {
     const char     *method = method_str(m);
     pa_routerif    *routerif;
-    pa_bool_t       success = TRUE;
+    size_t          frame;
 
     pa_assert(u);
-    pa_assert(method);
+    pa_assert(ad);
     pa_assert_se((routerif = u->routerif));
-    pa_assert(routerif->sock >= 0);
+
+    if (!routerif->connected)
+        return FALSE;
 
     pa_log_debug("%s: sending %s", __FILE__, method);
 
-    return success;
+    frame = frame_begin(routerif, m, FRAME_REQUEST, routerif->seqno++);
+    buf_put_u32(&routerif->out, ad->handle);
+    buf_put_u16(&routerif->out, ad->param1);
+    buf_put_u16(&routerif->out, ad->param2);
+    buf_put_u16(&routerif->out, ad->error);
+    frame_end(routerif, frame);
+
+    return TRUE;
+}
+
+
+static pa_bool_t socket_connect(pa_routerif *routerif)
+{
+    struct userdata *u;
+    pa_mainloop_api *ml;
+    struct sockaddr *sa;
+    socklen_t        salen;
+    int              sock;
+
+    pa_assert(routerif);
+    pa_assert_se((u = routerif->u));
+    pa_assert_se((ml = u->core->mainloop));
+
+    if (routerif->family == AF_UNIX) {
+        sa = (struct sockaddr *)&routerif->unaddr;
+        salen = sizeof(routerif->unaddr);
+    }
+    else {
+        sa = (struct sockaddr *)&routerif->inaddr;
+        salen = sizeof(routerif->inaddr);
+    }
+
+    if ((sock = socket(routerif->family, SOCK_STREAM, 0)) < 0) {
+        pa_log("%s: failed to create socket: %s", __FILE__, strerror(errno));
+        return FALSE;
+    }
+
+    pa_make_fd_cloexec(sock);
+    pa_make_fd_nonblock(sock);
+
+    if (connect(sock, sa, salen) < 0 && errno != EINPROGRESS) {
+        pa_log_debug("%s: can't connect to AudioManager: %s",
+                     __FILE__, strerror(errno));
+        close(sock);
+        return FALSE;
+    }
+
+    routerif->sock = sock;
+    routerif->connected = FALSE;
+    routerif->ioev = ml->io_new(ml, sock, PA_IO_EVENT_OUTPUT, io_cb, routerif);
+
+    return TRUE;
+}
+
+static void socket_disconnect(pa_routerif *routerif, pa_bool_t unregister)
+{
+    struct userdata *u;
+    pa_mainloop_api *ml;
+    pending_req *pr;
+    pa_bool_t was_connected;
+
+    pa_assert(routerif);
+    pa_assert_se((u = routerif->u));
+    pa_assert_se((ml = u->core->mainloop));
+
+    was_connected = routerif->connected;
+
+    if (routerif->ioev) {
+        ml->io_free(routerif->ioev);
+        routerif->ioev = NULL;
+    }
+
+    if (routerif->sock >= 0) {
+        close(routerif->sock);
+        routerif->sock = -1;
+    }
+
+    routerif->connected = FALSE;
+    routerif->in.len = routerif->in.off = 0;
+    routerif->out.len = routerif->out.off = 0;
+
+    while ((pr = pa_hashmap_steal_first(routerif->pending)))
+        pending_free(pr, NULL);
+
+    if (unregister && was_connected && u->audiomgr)
+        pa_audiomgr_unregister_domain(u, FALSE);
+}
+
+static void schedule_reconnect(pa_routerif *routerif)
+{
+    struct userdata *u;
+    pa_mainloop_api *ml;
+    struct timeval   when;
+
+    pa_assert(routerif);
+    pa_assert_se((u = routerif->u));
+    pa_assert_se((ml = u->core->mainloop));
+
+    pa_gettimeofday(&when);
+    pa_timeval_add(&when, RECONNECT_PERIOD);
+
+    if (routerif->retry)
+        ml->time_restart(routerif->retry, &when);
+    else
+        routerif->retry = ml->time_new(ml, &when, reconnect_cb, routerif);
+}
+
+static void reconnect_cb(pa_mainloop_api *ml, pa_time_event *e,
+                         const struct timeval *tv, void *userdata)
+{
+    pa_routerif *routerif = (pa_routerif *)userdata;
+
+    (void)tv;
+
+    pa_assert(ml);
+    pa_assert(routerif);
+    pa_assert(e == routerif->retry);
+
+    ml->time_free(routerif->retry);
+    routerif->retry = NULL;
+
+    if (!socket_connect(routerif))
+        schedule_reconnect(routerif);
+}
+
+static void io_cb(pa_mainloop_api *ml, pa_io_event *e, int fd,
+                  pa_io_event_flags_t events, void *userdata)
+{
+    pa_routerif *routerif = (pa_routerif *)userdata;
+    struct userdata *u;
+    int err;
+    socklen_t errlen;
+
+    (void)ml;
+    (void)e;
+
+    pa_assert(routerif);
+    pa_assert_se((u = routerif->u));
+    pa_assert(fd == routerif->sock);
+
+    if (!routerif->connected) {
+        err = 0;
+        errlen = sizeof(err);
+
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err) {
+            pa_log_debug("%s: can't connect to AudioManager: %s", __FILE__,
+                         strerror(err ? err : errno));
+            goto failed;
+        }
+
+        pa_log_info("%s: connected to AudioManager", __FILE__);
+
+        routerif->connected = TRUE;
+        update_io_events(routerif);
+
+        pa_audiomgr_register_domain(u);
+        return;
+    }
+
+    if ((events & (PA_IO_EVENT_INPUT | PA_IO_EVENT_HANGUP)) &&
+        !socket_read(routerif))
+        goto failed;
+
+    if ((events & PA_IO_EVENT_ERROR))
+        goto failed;
+
+    if ((events & PA_IO_EVENT_OUTPUT) && !socket_write(routerif))
+        goto failed;
+
+    return;
+
+ failed:
+    socket_disconnect(routerif, TRUE);
+    schedule_reconnect(routerif);
+}
+
+static void update_io_events(pa_routerif *routerif)
+{
+    struct userdata *u;
+    pa_mainloop_api *ml;
+    pa_io_event_flags_t events;
+
+    pa_assert(routerif);
+    pa_assert_se((u = routerif->u));
+    pa_assert_se((ml = u->core->mainloop));
+
+    if (!routerif->ioev || !routerif->connected)
+        return;
+
+    events = PA_IO_EVENT_INPUT;
+
+    if (routerif->out.len > routerif->out.off)
+        events |= PA_IO_EVENT_OUTPUT;
+
+    ml->io_enable(routerif->ioev, events);
+}
+
+static pa_bool_t socket_write(pa_routerif *routerif)
+{
+    sockbuf *b;
+    ssize_t  n;
+
+    pa_assert(routerif);
+
+    b = &routerif->out;
+
+    while (routerif->connected && b->off < b->len) {
+        n = write(routerif->sock, b->data + b->off, b->len - b->off);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            pa_log("%s: write to AudioManager failed: %s",
+                   __FILE__, strerror(errno));
+            return FALSE;
+        }
+
+        b->off += n;
+    }
+
+    if (b->off >= b->len)
+        b->off = b->len = 0;
+
+    update_io_events(routerif);
+
+    return TRUE;
+}
+
+static pa_bool_t socket_read(pa_routerif *routerif)
+{
+    sockbuf       *b;
+    ssize_t        n;
+    const uint8_t *h;
+    uint32_t       len, seqno;
+    uint16_t       method, flags;
+
+    pa_assert(routerif);
+
+    b = &routerif->in;
+
+    for (;;) {
+        if (b->len - b->off >= INPUT_MAX_BUFFERED) {
+            pa_log("%s: AudioManager sent more than %u bytes without us "
+                   "catching up; dropping the connection", __FILE__,
+                   (unsigned)INPUT_MAX_BUFFERED);
+            return FALSE;
+        }
+
+        buf_reserve(b, 4096);
+
+        n = read(routerif->sock, b->data + b->len, b->size - b->len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            pa_log("%s: read from AudioManager failed: %s",
+                   __FILE__, strerror(errno));
+            return FALSE;
+        }
+
+        if (n == 0) {
+            pa_log_info("%s: AudioManager closed the connection", __FILE__);
+            return FALSE;
+        }
+
+        b->len += n;
+    }
+
+    while (b->len - b->off >= FRAME_HEADER_SIZE) {
+        h = b->data + b->off;
+
+        len    = (uint32_t)h[0] << 24 | (uint32_t)h[1] << 16 |
+                 (uint32_t)h[2] <<  8 | (uint32_t)h[3];
+        method = (uint16_t)h[4] << 8 | h[5];
+        flags  = (uint16_t)h[6] << 8 | h[7];
+        seqno  = (uint32_t)h[8] << 24 | (uint32_t)h[9] << 16 |
+                 (uint32_t)h[10] << 8 | (uint32_t)h[11];
+
+        if (len > FRAME_MAX_PAYLOAD) {
+            pa_log("%s: oversized frame (%u bytes) from AudioManager",
+                   __FILE__, len);
+            return FALSE;
+        }
+
+        if (b->len - b->off < FRAME_HEADER_SIZE + len)
+            break;
+
+        dispatch_frame(routerif, method, flags, seqno,
+                       h + FRAME_HEADER_SIZE, len);
+
+        /* we might have been disconnected while dispatching */
+        if (!routerif->connected)
+            return TRUE;
+
+        b->off += FRAME_HEADER_SIZE + len;
+    }
+
+    if (b->off >= b->len)
+        b->off = b->len = 0;
+    else if (b->off > b->size / 2) {
+        memmove(b->data, b->data + b->off, b->len - b->off);
+        b->len -= b->off;
+        b->off = 0;
+    }
+
+    return TRUE;
+}
+
+static void dispatch_frame(pa_routerif *routerif, uint16_t method,
+                           uint16_t flags, uint32_t seqno,
+                           const uint8_t *payload, size_t len)
+{
+    pending_req *pr;
+    decoder      d;
+    char         err[256];
+    uint16_t     l;
+
+    d.p  = payload;
+    d.e  = payload + len;
+    d.ok = TRUE;
+
+    if (!(flags & (FRAME_REPLY | FRAME_ERROR))) {
+        dispatch_request(routerif, method, seqno, &d);
+        return;
+    }
+
+    if (!(pr = pa_hashmap_remove(routerif->pending, PA_UINT32_TO_PTR(seqno)))){
+        pa_log("%s: reply to unknown request %u", __FILE__, seqno);
+        return;
+    }
+
+    if ((flags & FRAME_ERROR)) {
+        l = get_u16(&d);
+
+        if (!d.ok || l >= sizeof(err) || d.e - d.p < l)
+            snprintf(err, sizeof(err), "<unknown error>");
+        else {
+            memcpy(err, d.p, l);
+            err[l] = '\0';
+        }
+
+        pa_log_info("%s: AudioManager %s failed: %s", __FILE__,
+                    method_str(pr->method), err);
+
+        pending_free(pr, NULL);
+        return;
+    }
+
+    dispatch_reply(routerif, method, pr, &d);
+}
+
+static void dispatch_reply(pa_routerif *routerif, uint16_t method,
+                           pending_req *pr, decoder *d)
+{
+    struct userdata *u;
+    uint16_t id, status;
+
+    pa_assert(routerif);
+    pa_assert(pr);
+    pa_assert_se((u = routerif->u));
+
+    if (method != pr->method) {
+        pa_log("%s: %s reply to %s request", __FILE__, method_str(method),
+               method_str(pr->method));
+        pending_free(pr, NULL);
+        return;
+    }
+
+    switch (pr->method) {
+
+    case audiomgr_register_domain:
+        id     = get_u16(d);
+        status = get_u16(d);
+
+        if (!d->ok)
+            break;
+
+        pa_log_info("AudioManager replied to registration: "
+                    "domainID %u, status %u", id, status);
+
+        pa_audiomgr_domain_registered(u, id, status, pr->data);
+        pa_xfree(pr);
+        return;
+
+    case audiomgr_register_source:
+    case audiomgr_register_sink:
+        id     = get_u16(d);
+        status = get_u16(d);
+
+        if (!d->ok)
+            break;
+
+        pa_log_info("AudioManager replied to %s: ID: %u",
+                    method_str(pr->method), id);
+
+        pa_audiomgr_node_registered(u, id, status, pr->data);
+        pa_xfree(pr);
+        return;
+
+    case audiomgr_deregister_source:
+    case audiomgr_deregister_sink:
+        pa_audiomgr_node_unregistered(u, pr->data);
+        pa_xfree(pr);
+        return;
+
+    default:
+        pending_free(pr, NULL);
+        return;
+    }
+
+    pa_log("%s: got broken %s reply from AudioManager",
+           __FILE__, method_str(pr->method));
+
+    pending_free(pr, NULL);
+}
+
+static void dispatch_request(pa_routerif *routerif, uint16_t method,
+                             uint32_t seqno, decoder *d)
+{
+    struct userdata *u;
+    am_connect_data  cd;
+
+    pa_assert(routerif);
+    pa_assert_se((u = routerif->u));
+
+    memset(&cd, 0, sizeof(cd));
+
+    switch (method) {
+
+    case audiomgr_connect:
+        cd.handle     = get_u16(d);
+        cd.connection = get_u16(d);
+        cd.source     = get_u16(d);
+        cd.sink       = get_u16(d);
+        cd.format     = get_u16(d);
+
+        if (d->ok) {
+            pa_log_debug("AudioManager connect(%u|%u|%u|%u|%d)", cd.handle,
+                         cd.connection, cd.source, cd.sink, cd.format);
+            pa_audiomgr_connect(u, &cd);
+            return;
+        }
+        break;
+
+    case audiomgr_disconnect:
+        cd.handle     = get_u16(d);
+        cd.connection = get_u16(d);
+
+        if (d->ok) {
+            pa_log_debug("AudioManager disconnect(%u|%u)",
+                         cd.handle, cd.connection);
+            pa_audiomgr_disconnect(u, &cd);
+            return;
+        }
+        break;
+
+    default:
+        pa_log_info("%s: unsupported '%s' request (%u) ignored", __FILE__,
+                    method_str(method), seqno);
+        return;
+    }
+
+    pa_log("%s: got broken '%s' request (%u) from AudioManager", __FILE__,
+           method_str(method), seqno);
+}
+
+
+static void buf_reserve(sockbuf *b, size_t size)
+{
+    pa_assert(b);
+
+    if (b->len + size > b->size) {
+        while (b->len + size > b->size)
+            b->size = b->size ? b->size * 2 : 4096;
+
+        b->data = pa_xrealloc(b->data, b->size);
+    }
+}
+
+static void buf_put_u16(sockbuf *b, uint16_t v)
+{
+    buf_reserve(b, 2);
+
+    b->data[b->len++] = (v >> 8) & 0xff;
+    b->data[b->len++] = v & 0xff;
+}
+
+static void buf_put_u32(sockbuf *b, uint32_t v)
+{
+    buf_reserve(b, 4);
+
+    b->data[b->len++] = (v >> 24) & 0xff;
+    b->data[b->len++] = (v >> 16) & 0xff;
+    b->data[b->len++] = (v >>  8) & 0xff;
+    b->data[b->len++] = v & 0xff;
+}
+
+static void buf_put_str(sockbuf *b, const char *s)
+{
+    size_t l = s ? strlen(s) : 0;
+
+    if (l > 0xffff)
+        l = 0xffff;
+
+    buf_put_u16(b, l);
+    buf_reserve(b, l);
+
+    if (l > 0) {
+        memcpy(b->data + b->len, s, l);
+        b->len += l;
+    }
+}
+
+static size_t frame_begin(pa_routerif *routerif, am_method m, uint16_t flags,
+                          uint32_t seqno)
+{
+    sockbuf *b;
+    size_t   start;
+
+    pa_assert(routerif);
+
+    b = &routerif->out;
+    start = b->len;
+
+    buf_put_u32(b, 0);     /* length; patched in frame_end() */
+    buf_put_u16(b, m);
+    buf_put_u16(b, flags);
+    buf_put_u32(b, seqno);
+
+    return start;
+}
+
+static void frame_end(pa_routerif *routerif, size_t start)
+{
+    sockbuf  *b;
+    uint32_t  len;
+    uint8_t  *h;
+
+    pa_assert(routerif);
+
+    b = &routerif->out;
+    h = b->data + start;
+    len = b->len - start - FRAME_HEADER_SIZE;
+
+    h[0] = (len >> 24) & 0xff;
+    h[1] = (len >> 16) & 0xff;
+    h[2] = (len >>  8) & 0xff;
+    h[3] = len & 0xff;
+
+    /* the actual write happens when the socket becomes writable */
+    update_io_events(routerif);
+}
+
+static uint32_t send_request(pa_routerif *routerif, am_method m,
+                             size_t start, void *data)
+{
+    pending_req *pr;
+    uint32_t     seqno;
+    uint8_t     *h;
+
+    pa_assert(routerif);
+
+    seqno = routerif->seqno++;
+
+    h = routerif->out.data + start;
+    h[ 8] = (seqno >> 24) & 0xff;
+    h[ 9] = (seqno >> 16) & 0xff;
+    h[10] = (seqno >>  8) & 0xff;
+    h[11] = seqno & 0xff;
+
+    frame_end(routerif, start);
+
+    pr = pa_xnew0(pending_req, 1);
+    pr->method = m;
+    pr->data   = data;
+
+    pa_hashmap_put(routerif->pending, PA_UINT32_TO_PTR(seqno), pr);
+
+    return seqno;
+}
+
+static uint16_t get_u16(decoder *d)
+{
+    uint16_t v;
+
+    if (!d->ok || d->e - d->p < 2) {
+        d->ok = FALSE;
+        return 0;
+    }
+
+    v = (uint16_t)d->p[0] << 8 | d->p[1];
+    d->p += 2;
+
+    return v;
+}
+
+static void pending_free(void *p, void *userdata)
+{
+    pending_req       *pr = (pending_req *)p;
+    am_domainreg_data *dr;
+    am_nodereg_data   *rd;
+    am_nodeunreg_data *ud;
+
+    (void)userdata;
+
+    if (!pr)
+        return;
+
+    switch (pr->method) {
+    case audiomgr_register_domain:
+        if ((dr = pr->data))
+            pa_xfree(dr);
+        break;
+    case audiomgr_register_source:
+    case audiomgr_register_sink:
+        if ((rd = pr->data)) {
+            pa_xfree((void *)rd->key);
+            pa_xfree((void *)rd->name);
+            pa_xfree(rd);
+        }
+        break;
+    case audiomgr_deregister_source:
+    case audiomgr_deregister_sink:
+        if ((ud = pr->data)) {
+            pa_xfree((void *)ud->name);
+            pa_xfree(ud);
+        }
+        break;
+    default:
+        break;
+    }
+
+    pa_xfree(pr);
 }
 
 
@@ -201,4 +1116,3 @@ static const char *method_str(am_method m)
  * End:
  *
  */
-
@@ -691,7 +691,7 @@ static pa_bool_t set_profile(struct userdata *u, mir_node *node)
 
             u->state.profile = node->pacard.profile;
 
-            pa_card_set_profile(card, node->pacard.profile, FALSE);
+            pa_discover_switch_profile(u, card, node->pacard.profile);
 
             u->state.profile = NULL;            
         }
@@ -86,6 +86,7 @@ typedef enum   mir_privacy              mir_privacy;
 typedef struct mir_node                 mir_node;
 typedef struct mir_rtgroup              mir_rtgroup;
 typedef struct mir_rtentry              mir_rtentry;
+typedef struct mir_rtzone               mir_rtzone;
 typedef struct mir_connection           mir_connection;
 typedef struct mir_constr_link          mir_constr_link;
 typedef struct mir_constr_def           mir_constr_def;
@@ -21,10 +21,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
 
 #include <pulsecore/pulsecore-config.h>
 
 #include <pulse/proplist.h>
+#include <pulse/volume.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/module.h>
 
@@ -34,9 +37,20 @@
 #include "utils.h"
 
 #define VLIM_CLASS_ALLOC_BUCKET  16
+#define VLIM_ENTRY_ALLOC_BUCKET   8
 
-typedef struct vlim_entry  vlim_entry;
-typedef struct vlim_table  vlim_table;
+#define VOLUME_TABLE_STEP        10     /* mB between table entries */
+#define VOLUME_TABLE_MIN      -9000     /* mB of the last table entry */
+#define VOLUME_TABLE_SIZE   (-VOLUME_TABLE_MIN / VOLUME_TABLE_STEP + 1)
+#define VOLUME_MB_MUTED     (INT_MIN / 4)  /* survives adding a few limits */
+#define VOLUME_MB_MAX       (INT_MAX / 4)  /* ditto */
+
+typedef struct vlim_entry     vlim_entry;
+typedef struct vlim_table     vlim_table;
+typedef struct vlim_suppress  vlim_suppress;
+typedef struct vlim_correct   vlim_correct;
+typedef struct vlim_stage     vlim_stage;
+typedef struct vlim_pipeline  vlim_pipeline;
 
 
 struct vlim_entry {
@@ -46,20 +60,57 @@ struct vlim_entry {
 
 struct vlim_table {
     size_t       nentry;
+    size_t       maxentry;
     vlim_entry  *entries;
 };
 
+/*
+ * the limit tables are compiled to a pipeline per class. The builtin
+ * limits become plain mask tests and loads, and only the rest, i.e.
+ * the scripted limits, are called through a function pointer.
+ */
+struct vlim_suppress {
+    uint32_t     trigmask;   /**< classes that trigger the suppression */
+    double      *attenuation;
+};
+
+struct vlim_correct {
+    double     **value;      /**< the correction; NULL means no correction */
+};
+
+struct vlim_stage {
+    size_t         nsuppress;
+    vlim_suppress *suppress;
+    size_t         ncorrect;
+    vlim_correct  *correct;
+    size_t         nfunc;
+    vlim_entry    *funcs;
+};
+
+struct vlim_pipeline {
+    vlim_stage   device;     /**< generic limits specialized to the class */
+    vlim_stage   class;      /**< class limits */
+};
+
 struct pa_mir_volume {
-    int          classlen;   /**< class table length  */
-    vlim_table  *classlim;   /**< class indexed table */
-    vlim_table   genlim;     /**< generic limit */
+    int            classlen;   /**< class table length  */
+    vlim_table    *classlim;   /**< class indexed table */
+    vlim_table     genlim;     /**< generic limit */
+    vlim_pipeline *pipelines;  /**< class indexed, compiled from the above */
+    pa_bool_t      compiled;   /**< whether pipelines are up to date */
+    pa_volume_t    dbtable[VOLUME_TABLE_SIZE]; /**< -mB / VOLUME_TABLE_STEP
+                                                    -> pa_volume_t */
 };
 
 
 static void add_to_table(vlim_table *, mir_volume_func_t, void *);
 static void destroy_table(vlim_table *);
-static double apply_table(double, vlim_table *, struct userdata *, int,
-                          mir_node *, const char *);
+
+static void compile_pipelines(pa_mir_volume *);
+static void compile_stage(vlim_stage *, vlim_table *, int);
+static void destroy_pipelines(pa_mir_volume *);
+static void destroy_stage(vlim_stage *);
+static int run_stage(vlim_stage *, struct userdata *, int, mir_node *);
 
 static void reset_volume_limit(struct userdata *, mir_node *, uint32_t);
 static void add_volume_limit(struct userdata *, mir_node *, int);
@@ -68,9 +119,21 @@ static void add_volume_limit(struct userdata *, mir_node *, int);
 pa_mir_volume *pa_mir_volume_init(struct userdata *u)
 {
     pa_mir_volume *volume = pa_xnew0(pa_mir_volume, 1);
+    double dB;
+    int i;
 
     (void)u;
 
+    /*
+     * the attenuations we apply come from a handful of settings, so a
+     * 0.1 dB grid covers practically all of them and saves the pow()
+     * of pa_sw_volume_from_dB() for every stream on every pass
+     */
+    for (i = 0;  i < VOLUME_TABLE_SIZE;  i++) {
+        dB = -(double)(i * VOLUME_TABLE_STEP) / MIR_VOLUME_MB_PER_DB;
+        volume->dbtable[i] = pa_sw_volume_from_dB(dB);
+    }
+
     return volume;
 }
 
@@ -86,6 +149,7 @@ void pa_mir_volume_done(struct userdata *u)
         free(volume->classlim);
 
         destroy_table(&volume->genlim);
+        destroy_pipelines(volume);
 
         pa_xfree(volume);
 
@@ -128,6 +192,7 @@ void mir_volume_add_class_limit(struct userdata  *u,
     }
 
     add_to_table(table, func, arg);
+    volume->compiled = FALSE;
 }
 
 
@@ -142,6 +207,7 @@ void mir_volume_add_generic_limit(struct userdata  *u,
     pa_assert_se((volume = u->volume));
 
     add_to_table(&volume->genlim, func, arg);
+    volume->compiled = FALSE;
 }
 
 
@@ -174,36 +240,39 @@ void mir_volume_add_limiting_class(struct userdata *u,
 }
 
 
-double mir_volume_apply_limits(struct userdata *u,
-                               mir_node *node,
-                               int class,
-                               uint32_t stamp)
+int mir_volume_apply_limits(struct userdata *u,
+                            mir_node *node,
+                            int class,
+                            uint32_t stamp)
 {
+    static mir_node fake_node;
+
     pa_mir_volume *volume;
-    double attenuation = 0.0;
-    double devlim, classlim;
-    vlim_table *tbl;
-    uint32_t clmask;
+    vlim_pipeline *pl;
+    int attenuation = 0;
+    int devlim, classlim;
 
     pa_assert(u);
     pa_assert_se((volume = u->volume));
 
     if (class < 0 || class >= volume->classlen) {
         if (class < 0 || class >= mir_application_class_end)
-            attenuation = -90.0;
+            attenuation = VOLUME_TABLE_MIN;
     }
     else {
-        devlim = apply_table(0.0, &volume->genlim, u,class,node, "device");
-        classlim = 0.0;
+        if (!volume->compiled)
+            compile_pipelines(volume);
+
+        pl = volume->pipelines + class;
+
+        devlim = run_stage(&pl->device, u, class, node ? node : &fake_node);
+        classlim = 0;
 
         if (class && node) {
             pa_assert(class >= mir_application_class_begin);
             pa_assert(class <  mir_application_class_end);
 
-            clmask = (uint32_t)1 << (class - mir_application_class_begin);
-            
-            if (class < volume->classlen && (tbl = volume->classlim + class))
-                classlim = apply_table(classlim, tbl, u, class, node, "class");
+            classlim = run_stage(&pl->class, u, class, node);
         }
 
         attenuation = devlim + classlim;
@@ -211,6 +280,42 @@ double mir_volume_apply_limits(struct userdata *u,
 
     return attenuation;
 }
+
+int mir_volume_dB_to_mB(double dB)
+{
+    double mB;
+
+    /*
+     * the limits come from scripts, so anything can show up here;
+     * make sure the cast to int below stays defined
+     */
+    if (isnan(dB))
+        return 0;
+
+    if (dB <= PA_DECIBEL_MININFTY)
+        return VOLUME_MB_MUTED;
+
+    if ((mB = dB * MIR_VOLUME_MB_PER_DB) >= VOLUME_MB_MAX)
+        return VOLUME_MB_MAX;
+
+    return mB < 0.0 ? -(int)(0.5 - mB) : (int)(mB + 0.5);
+}
+
+pa_volume_t mir_volume_from_mB(struct userdata *u, int mB)
+{
+    pa_mir_volume *volume;
+
+    pa_assert(u);
+    pa_assert_se((volume = u->volume));
+
+    if (mB <= 0 && mB >= VOLUME_TABLE_MIN && !(mB % VOLUME_TABLE_STEP))
+        return volume->dbtable[-mB / VOLUME_TABLE_STEP];
+
+    if (mB <= VOLUME_MB_MUTED)
+        return PA_VOLUME_MUTED;
+
+    return pa_sw_volume_from_dB((double)mB / MIR_VOLUME_MB_PER_DB);
+}
                                
 
 double mir_volume_suppress(struct userdata *u, int class, mir_node *node,
@@ -265,8 +370,14 @@ static void add_to_table(vlim_table *tbl, mir_volume_func_t func, void *arg)
     pa_assert(tbl);
     pa_assert(func);
 
-    size = sizeof(vlim_entry) * (tbl->nentry + 1);
-    pa_assert_se((entries = realloc(tbl->entries,  size)));
+    if (tbl->nentry < tbl->maxentry)
+        entries = tbl->entries;
+    else {
+        tbl->maxentry += VLIM_ENTRY_ALLOC_BUCKET;
+        size = sizeof(vlim_entry) * tbl->maxentry;
+        pa_assert_se((entries = realloc(tbl->entries,  size)));
+    }
+
     entry = entries + tbl->nentry;
 
     entry->func = func;
@@ -283,31 +394,156 @@ static void destroy_table(vlim_table *tbl)
     free(tbl->entries);
 }
 
-static double apply_table(double attenuation,
-                          vlim_table *tbl,
-                          struct userdata *u,
-                          int class,
-                          mir_node *node,
-                          const char *type)
+static void compile_pipelines(pa_mir_volume *volume)
 {
-    static mir_node fake_node;
+    vlim_pipeline *pl;
+    int class;
+
+    pa_assert(volume);
+
+    destroy_pipelines(volume);
+
+    volume->pipelines = pa_xnew0(vlim_pipeline, volume->classlen);
+
+    for (class = 0;  class < volume->classlen;  class++) {
+        pl = volume->pipelines + class;
+
+        compile_stage(&pl->device, &volume->genlim, class);
+
+        if (class)
+            compile_stage(&pl->class, volume->classlim + class, class);
+    }
+
+    volume->compiled = TRUE;
+
+    pa_log_debug("volume limits compiled for %d classes", volume->classlen);
+}
 
-    double a;
+static void compile_stage(vlim_stage *stage, vlim_table *tbl, int class)
+{
+    mir_volume_suppress_arg *suppress;
     vlim_entry *e;
+    uint32_t clmask;
+    uint32_t trigmask;
     size_t i;
 
+    pa_assert(stage);
     pa_assert(tbl);
-    pa_assert(u);
-    pa_assert(type);
 
-    if (!node)
-        node = &fake_node;
+    if (!tbl->nentry)
+        return;
+
+    if (class >= mir_application_class_begin &&
+        class <  mir_application_class_end     )
+        clmask = ((uint32_t)1) << (class - mir_application_class_begin);
+    else
+        clmask = 0;
+
+    stage->suppress = pa_xnew0(vlim_suppress, tbl->nentry);
+    stage->correct  = pa_xnew0(vlim_correct, tbl->nentry);
+    stage->funcs    = pa_xnew0(vlim_entry, tbl->nentry);
 
-    for (i = 0;   i < tbl->nentry;  i++) {
+    for (i = 0;  i < tbl->nentry;  i++) {
         e = tbl->entries + i;
-        a = e->func(u, class, node, e->arg);
 
-        pa_log_debug("        %s limit = %.2lf", type, a);
+        if (e->func == mir_volume_suppress) {
+            /*
+             * a suppression that can't be triggered or that our own
+             * class would trigger never limits this class
+             */
+            if (!clmask || !(suppress = e->arg) ||
+                !(trigmask = suppress->trigger.clmask) || (trigmask & clmask))
+                continue;
+
+            stage->suppress[stage->nsuppress].trigmask = trigmask;
+            stage->suppress[stage->nsuppress].attenuation =
+                suppress->attenuation;
+            stage->nsuppress++;
+        }
+        else if (e->func == mir_volume_correction) {
+            if (e->arg)
+                stage->correct[stage->ncorrect++].value = e->arg;
+        }
+        else
+            stage->funcs[stage->nfunc++] = *e;
+    }
+}
+
+static void destroy_pipelines(pa_mir_volume *volume)
+{
+    vlim_pipeline *pl;
+    int class;
+
+    pa_assert(volume);
+
+    if (volume->pipelines) {
+        for (class = 0;  class < volume->classlen;  class++) {
+            pl = volume->pipelines + class;
+
+            destroy_stage(&pl->device);
+            destroy_stage(&pl->class);
+        }
+
+        pa_xfree(volume->pipelines);
+        volume->pipelines = NULL;
+    }
+
+    volume->compiled = FALSE;
+}
+
+static void destroy_stage(vlim_stage *stage)
+{
+    pa_assert(stage);
+
+    pa_xfree(stage->suppress);
+    pa_xfree(stage->correct);
+    pa_xfree(stage->funcs);
+
+    memset(stage, 0, sizeof(*stage));
+}
+
+static int run_stage(vlim_stage *stage,
+                     struct userdata *u,
+                     int class,
+                     mir_node *node)
+{
+    vlim_suppress *s;
+    vlim_entry *e;
+    double *value;
+    uint32_t nodemask;
+    int attenuation = 0;
+    int a;
+    size_t i;
+
+    pa_assert(stage);
+    pa_assert(node);
+
+    nodemask = node->vlim.clmask;
+
+    for (i = 0;  i < stage->nsuppress;  i++) {
+        s = stage->suppress + i;
+        a = (s->trigmask & nodemask) ? mir_volume_dB_to_mB(*s->attenuation) : 0;
+
+        if (a < attenuation)
+            attenuation = a;
+    }
+
+    if (node->implement == mir_device && node->privacy == mir_public) {
+        for (i = 0;  i < stage->ncorrect;  i++) {
+            if ((value = *stage->correct[i].value)) {
+                a = mir_volume_dB_to_mB(*value);
+
+                if (a < attenuation)
+                    attenuation = a;
+            }
+        }
+    }
+
+    for (i = 0;  i < stage->nfunc;  i++) {
+        e = stage->funcs + i;
+        a = mir_volume_dB_to_mB(e->func(u, class, node, e->arg));
+
+        pa_log_debug("        scripted limit = %d mB", a);
 
         if (a < attenuation)
             attenuation = a;
@@ -25,6 +25,11 @@
 #include "userdata.h"
 #include "list.h"
 
+/*
+ * limits are calculated in fixed point, in 1/100 dB units (mB)
+ */
+#define MIR_VOLUME_MB_PER_DB  100
+
 typedef double (*mir_volume_func_t)(struct userdata *, int, mir_node *, void*);
 
 
@@ -55,7 +60,10 @@ void mir_volume_add_generic_limit(struct userdata *, mir_volume_func_t,void *);
 void mir_volume_make_limiting(struct userdata *);
 
 void mir_volume_add_limiting_class(struct userdata *,mir_node *,int,uint32_t);
-double mir_volume_apply_limits(struct userdata *, mir_node *, int, uint32_t);
+int mir_volume_apply_limits(struct userdata *, mir_node *, int, uint32_t);
+
+int mir_volume_dB_to_mB(double);
+pa_volume_t mir_volume_from_mB(struct userdata *, int);
 
 double mir_volume_suppress(struct userdata *, int, mir_node *, void *);
 double mir_volume_correction(struct userdata *, int, mir_node *, void *);
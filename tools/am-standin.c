@@ -0,0 +1,497 @@
+/*
+ * module-murphy-ivi -- PulseAudio module for providing audio routing support
+ * Copyright (c) 2012, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St - Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Stand-in AudioManager for the socket router interface (murphy/socketif.c)
+ *
+ * It accepts one module-murphy-ivi connection at a time, answers the domain
+ * and node (de)registrations and, once the domain is complete, benchmarks
+ * the link with a number of connect/disconnect round trips. At the end it
+ * prints how many frames arrived per read (ie. how well the module batches
+ * its requests) and the round trip times.
+ *
+ * It is self-contained and not part of the build:
+ *
+ *     cc -O2 -Wall -o am-standin tools/am-standin.c
+ *     ./am-standin [-p path] [-n round-trips]
+ *
+ * and load the module with 'audiomgr_socktype=unix audiomgr_address=<path>'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_PATH       "/tmp/audiomgr-standin"
+#define DEFAULT_ROUNDS     1000
+
+#define FRAME_HEADER_SIZE  12
+#define FRAME_MAX_PAYLOAD  65536
+
+#define FRAME_REQUEST      0x0000
+#define FRAME_REPLY        0x0001
+#define FRAME_ERROR        0x0002
+
+/* these must match enum am_method in murphy/routerif.h */
+enum {
+    am_unknown_method = 0,
+    am_register_domain,
+    am_domain_complete,
+    am_deregister_domain,
+    am_register_source,
+    am_deregister_source,
+    am_register_sink,
+    am_deregister_sink,
+    am_connect,
+    am_connect_ack,
+    am_disconnect,
+    am_disconnect_ack,
+    am_method_dim = am_disconnect_ack + 7
+};
+
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    size_t   len;
+} buffer;
+
+typedef struct {
+    int       sock;
+    buffer    in;
+    buffer    out;
+    uint32_t  seqno;
+    uint16_t  nextid;
+    uint16_t  source;        /* the first registered source */
+    uint16_t  sink;          /* the first registered sink */
+    int       complete;      /* the domain is complete */
+    int       rounds;        /* round trips to do */
+    int       done;          /* round trips done */
+    int       failed;        /* round trips acked with an error */
+    int       inflight;      /* connect or disconnect is in flight */
+    uint64_t  start;         /* when the in-flight request was sent */
+    uint64_t  min, max, sum; /* round trip times in usec */
+    uint64_t  nread;         /* number of reads with at least one frame */
+    uint64_t  nframe;
+    uint64_t  nbyte;
+    uint64_t  count[am_method_dim];
+} client;
+
+static void report(client *);
+
+static uint64_t now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void buf_reserve(buffer *b, size_t size)
+{
+    if (b->len + size > b->size) {
+        while (b->len + size > b->size)
+            b->size = b->size ? b->size * 2 : 4096;
+
+        if (!(b->data = realloc(b->data, b->size))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+}
+
+static void put_u16(buffer *b, uint16_t v)
+{
+    buf_reserve(b, 2);
+
+    b->data[b->len++] = (v >> 8) & 0xff;
+    b->data[b->len++] = v & 0xff;
+}
+
+static void put_u32(buffer *b, uint32_t v)
+{
+    buf_reserve(b, 4);
+
+    b->data[b->len++] = (v >> 24) & 0xff;
+    b->data[b->len++] = (v >> 16) & 0xff;
+    b->data[b->len++] = (v >>  8) & 0xff;
+    b->data[b->len++] = v & 0xff;
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)p[0] << 8 | p[1];
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] <<  8 | (uint32_t)p[3];
+}
+
+static size_t frame_begin(buffer *b, uint16_t method, uint16_t flags,
+                          uint32_t seqno)
+{
+    size_t start = b->len;
+
+    put_u32(b, 0);
+    put_u16(b, method);
+    put_u16(b, flags);
+    put_u32(b, seqno);
+
+    return start;
+}
+
+static void frame_end(buffer *b, size_t start)
+{
+    uint32_t len = b->len - start - FRAME_HEADER_SIZE;
+    uint8_t *h = b->data + start;
+
+    h[0] = (len >> 24) & 0xff;
+    h[1] = (len >> 16) & 0xff;
+    h[2] = (len >>  8) & 0xff;
+    h[3] = len & 0xff;
+}
+
+static int flush_output(client *c)
+{
+    size_t  off;
+    ssize_t n;
+
+    for (off = 0;  off < c->out.len;  off += n) {
+        if ((n = write(c->sock, c->out.data + off, c->out.len - off)) < 0) {
+            if (errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            perror("write");
+            return -1;
+        }
+    }
+
+    c->out.len = 0;
+
+    return 0;
+}
+
+static void send_next_request(client *c)
+{
+    size_t frame;
+
+    if (c->done >= c->rounds || !c->source || !c->sink)
+        return;
+
+    /* even rounds connect, odd ones tear the connection down again */
+    if (!(c->done & 1)) {
+        frame = frame_begin(&c->out, am_connect, FRAME_REQUEST, c->seqno++);
+        put_u16(&c->out, c->done + 1);       /* handle */
+        put_u16(&c->out, 1);                 /* connection */
+        put_u16(&c->out, c->source);
+        put_u16(&c->out, c->sink);
+        put_u16(&c->out, 1);                 /* format */
+    }
+    else {
+        frame = frame_begin(&c->out, am_disconnect,FRAME_REQUEST,c->seqno++);
+        put_u16(&c->out, c->done + 1);       /* handle */
+        put_u16(&c->out, 1);                 /* connection */
+    }
+
+    frame_end(&c->out, frame);
+
+    c->inflight = 1;
+    c->start = now_usec();
+}
+
+static void round_trip_done(client *c)
+{
+    uint64_t rtt;
+
+    if (!c->inflight)
+        return;
+
+    rtt = now_usec() - c->start;
+
+    if (!c->done || rtt < c->min)
+        c->min = rtt;
+    if (rtt > c->max)
+        c->max = rtt;
+
+    c->sum += rtt;
+    c->done++;
+    c->inflight = 0;
+
+    if (c->done == c->rounds)
+        report(c);
+    else
+        send_next_request(c);
+}
+
+static void handle_frame(client *c, uint16_t method, uint16_t flags,
+                         uint32_t seqno, const uint8_t *p, uint32_t len)
+{
+    size_t frame;
+
+    if (method < am_method_dim)
+        c->count[method]++;
+
+    if ((flags & (FRAME_REPLY | FRAME_ERROR)))
+        return;
+
+    switch (method) {
+
+    case am_register_domain:
+        frame = frame_begin(&c->out, method, FRAME_REPLY, seqno);
+        put_u16(&c->out, 1);        /* domain ID */
+        put_u16(&c->out, 0);        /* status */
+        frame_end(&c->out, frame);
+        break;
+
+    case am_register_source:
+    case am_register_sink:
+        if (len < 2)
+            return;
+
+        frame = frame_begin(&c->out, method, FRAME_REPLY, seqno);
+        put_u16(&c->out, c->nextid);
+        put_u16(&c->out, 0);        /* status */
+        frame_end(&c->out, frame);
+
+        if (method == am_register_source && !c->source)
+            c->source = c->nextid;
+        if (method == am_register_sink && !c->sink)
+            c->sink = c->nextid;
+
+        c->nextid++;
+        break;
+
+    case am_domain_complete:
+    case am_deregister_domain:
+    case am_deregister_source:
+    case am_deregister_sink:
+        frame = frame_begin(&c->out, method, FRAME_REPLY, seqno);
+        frame_end(&c->out, frame);
+
+        if (method == am_domain_complete && !c->complete) {
+            c->complete = 1;
+            printf("domain complete: %u node(s) registered\n",
+                   (unsigned)(c->nextid - 1));
+            send_next_request(c);
+        }
+        break;
+
+    case am_connect_ack:
+    case am_disconnect_ack:
+        if (len >= 10 && get_u16(p + 8))
+            c->failed++;
+        round_trip_done(c);
+        break;
+
+    default:
+        /* volume and property acks need no answer */
+        break;
+    }
+}
+
+static int handle_input(client *c)
+{
+    const uint8_t *h;
+    uint32_t len;
+    size_t off;
+    ssize_t n;
+    int nframe;
+
+    buf_reserve(&c->in, 4096);
+
+    if ((n = read(c->sock, c->in.data + c->in.len,
+                  c->in.size - c->in.len)) <= 0)
+    {
+        if (n < 0 && errno == EINTR)
+            return 0;
+        return -1;
+    }
+
+    c->in.len += n;
+    c->nbyte += n;
+
+    for (off = 0, nframe = 0;  c->in.len - off >= FRAME_HEADER_SIZE;  ) {
+        h = c->in.data + off;
+        len = get_u32(h);
+
+        if (len > FRAME_MAX_PAYLOAD) {
+            fprintf(stderr, "oversized frame (%u bytes)\n", len);
+            return -1;
+        }
+
+        if (c->in.len - off < FRAME_HEADER_SIZE + len)
+            break;
+
+        handle_frame(c, get_u16(h + 4), get_u16(h + 6), get_u32(h + 8),
+                     h + FRAME_HEADER_SIZE, len);
+
+        off += FRAME_HEADER_SIZE + len;
+        nframe++;
+    }
+
+    memmove(c->in.data, c->in.data + off, c->in.len - off);
+    c->in.len -= off;
+
+    if (nframe > 0) {
+        c->nread++;
+        c->nframe += nframe;
+    }
+
+    return flush_output(c);
+}
+
+static void report(client *c)
+{
+    printf("%llu frame(s) in %llu byte(s), %.2f frame(s) per read\n",
+           (unsigned long long)c->nframe, (unsigned long long)c->nbyte,
+           c->nread ? (double)c->nframe / c->nread : 0.0);
+    printf("registrations: %llu source(s), %llu sink(s); "
+           "deregistrations: %llu source(s), %llu sink(s)\n",
+           (unsigned long long)c->count[am_register_source],
+           (unsigned long long)c->count[am_register_sink],
+           (unsigned long long)c->count[am_deregister_source],
+           (unsigned long long)c->count[am_deregister_sink]);
+
+    if (c->done > 0) {
+        printf("%d round trip(s), %d failed: min %llu avg %llu max %llu "
+               "usec\n", c->done, c->failed, (unsigned long long)c->min,
+               (unsigned long long)(c->sum / c->done),
+               (unsigned long long)c->max);
+    }
+    else if (!c->source || !c->sink)
+        printf("no round trips: need at least one source and one sink\n");
+
+    fflush(stdout);
+}
+
+static void serve(int lsock, int rounds)
+{
+    struct pollfd pfd;
+    client c;
+
+    for (;;) {
+        memset(&c, 0, sizeof(c));
+
+        if ((c.sock = accept(lsock, NULL, NULL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            return;
+        }
+
+        printf("module connected\n");
+
+        c.nextid = 1;
+        c.rounds = rounds;
+
+        pfd.fd = c.sock;
+        pfd.events = POLLIN;
+
+        for (;;) {
+            if (poll(&pfd, 1, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                perror("poll");
+                break;
+            }
+
+            if (handle_input(&c) < 0) {
+                printf("module disconnected\n");
+                break;
+            }
+        }
+
+        report(&c);
+
+        close(c.sock);
+        free(c.in.data);
+        free(c.out.data);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    const char *path = DEFAULT_PATH;
+    int rounds = DEFAULT_ROUNDS;
+    int opt, lsock;
+
+    while ((opt = getopt(argc, argv, "p:n:h")) != -1) {
+        switch (opt) {
+        case 'p':  path = optarg;                 break;
+        case 'n':  rounds = atoi(optarg);         break;
+        default:
+            fprintf(stderr, "usage: %s [-p path] [-n round-trips]\n",argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path '%s' is too long\n", path);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    unlink(path);
+
+    if ((lsock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(lsock, 1) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    printf("listening on %s\n", path);
+    fflush(stdout);
+
+    serve(lsock, rounds < 0 ? 0 : rounds);
+
+    close(lsock);
+    unlink(path);
+
+    return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
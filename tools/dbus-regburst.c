@@ -0,0 +1,300 @@
+/*
+ * module-murphy-ivi -- PulseAudio module for providing audio routing support
+ * Copyright (c) 2012, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St - Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Registration burst benchmark for the D-Bus router interface
+ * (murphy/dbusif.c)
+ *
+ * It builds the messages of a burst of 100 node registrations (eg. what an
+ * AudioManager restart triggers) and of as many acknowledgements, both
+ * from scratch and the way dbusif.c does it with its message caches, ie.
+ * copying a registration that was marshalled before and filling in a
+ * copy of the per-method ack header. Every message is marshalled to wire
+ * format too, as sending it would, so the numbers include that.
+ *
+ * No bus connection is needed. It is self-contained and not part of the
+ * build:
+ *
+ *     cc -O2 -Wall -o dbus-regburst tools/dbus-regburst.c \
+ *        $(pkg-config --cflags --libs dbus-1)
+ *     ./dbus-regburst [bursts]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <dbus/dbus.h>
+
+#define NNODE            100
+#define DEFAULT_BURSTS   1000
+
+#define AM_DEST   "org.genivi.audiomanager"
+#define AM_PATH   "/org/genivi/audiomanager/RoutingInterface"
+#define AM_IFACE  "org.genivi.audiomanager.RoutingInterface"
+
+typedef struct {
+    uint16_t    id;
+    const char *name;
+    uint16_t    domain;
+    uint16_t    class;
+    int16_t     volume;
+    dbus_bool_t visible;
+    int16_t     status;
+    int16_t     reason;
+    int16_t     mute;
+    int16_t     mainvol;
+} node_data;
+
+
+static node_data    nodes[NNODE];
+static char         names[NNODE][32];
+static DBusMessage *cache[NNODE];
+static DBusMessage *acktmpl;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int build_properties(DBusMessageIter *mit)
+{
+    static int16_t zero;
+
+    DBusMessageIter ait, sit;
+    int16_t i;
+
+    if (!dbus_message_iter_open_container(mit, DBUS_TYPE_ARRAY, "(nn)", &ait))
+        return 0;
+
+    for (i = 1;  i < 3;  i++) {
+        if (!dbus_message_iter_open_container(&ait, DBUS_TYPE_STRUCT, NULL,
+                                              &sit)                        ||
+            !dbus_message_iter_append_basic(&sit, DBUS_TYPE_INT16, &i)     ||
+            !dbus_message_iter_append_basic(&sit, DBUS_TYPE_INT16, &zero)  ||
+            !dbus_message_iter_close_container(&ait, &sit))
+            return 0;
+    }
+
+    return dbus_message_iter_close_container(mit, &ait);
+}
+
+static int build_formats(DBusMessageIter *mit)
+{
+    DBusMessageIter ait;
+    int16_t i = 1;
+
+    if (!dbus_message_iter_open_container(mit, DBUS_TYPE_ARRAY, "n", &ait) ||
+        !dbus_message_iter_append_basic(&ait, DBUS_TYPE_INT16, &i))
+        return 0;
+
+    return dbus_message_iter_close_container(mit, &ait);
+}
+
+/* the same message pa_routerif_register_node() builds for a sink */
+static DBusMessage *build_registration(node_data *nd)
+{
+    DBusMessage *msg;
+    DBusMessageIter mit, cit;
+
+    if (!(msg = dbus_message_new_method_call(AM_DEST, AM_PATH, AM_IFACE,
+                                             "registerSink")))
+        return NULL;
+
+    dbus_message_iter_init_append(msg, &mit);
+
+    if (!dbus_message_iter_append_basic(&mit, DBUS_TYPE_UINT16, &nd->id)     ||
+        !dbus_message_iter_append_basic(&mit, DBUS_TYPE_STRING, &nd->name)   ||
+        !dbus_message_iter_append_basic(&mit, DBUS_TYPE_UINT16, &nd->domain) ||
+        !dbus_message_iter_append_basic(&mit, DBUS_TYPE_UINT16, &nd->class)  ||
+        !dbus_message_iter_append_basic(&mit, DBUS_TYPE_INT16, &nd->volume)  ||
+        !dbus_message_iter_append_basic(&mit, DBUS_TYPE_BOOLEAN,&nd->visible)||
+        !dbus_message_iter_open_container(&mit, DBUS_TYPE_STRUCT, NULL, &cit)||
+        !dbus_message_iter_append_basic(&cit, DBUS_TYPE_INT16, &nd->status)  ||
+        !dbus_message_iter_append_basic(&cit, DBUS_TYPE_INT16, &nd->reason)  ||
+        !dbus_message_iter_close_container(&mit, &cit)                       ||
+        !dbus_message_iter_append_basic(&mit, DBUS_TYPE_INT16, &nd->mute)    ||
+        !dbus_message_iter_append_basic(&mit, DBUS_TYPE_INT16, &nd->mainvol) ||
+        !build_properties(&mit)                                              ||
+        !build_formats(&mit)                                                 ||
+        !build_properties(&mit))
+    {
+        dbus_message_unref(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+static int append_ack(DBusMessage *msg, uint16_t handle)
+{
+    uint16_t param = 0, error = 0;
+
+    return dbus_message_append_args(msg,
+                                    DBUS_TYPE_UINT16, &handle,
+                                    DBUS_TYPE_UINT16, &param,
+                                    DBUS_TYPE_UINT16, &error,
+                                    DBUS_TYPE_INVALID);
+}
+
+/* what dbus_connection_send() does to the message, short of the write */
+static size_t marshal(DBusMessage *msg)
+{
+    char *wire;
+    int   len;
+
+    if (!msg)
+        return 0;
+
+    dbus_message_set_serial(msg, 1);
+
+    if (!dbus_message_marshal(msg, &wire, &len))
+        len = 0;
+    else
+        dbus_free(wire);
+
+    dbus_message_unref(msg);
+
+    return (size_t)len;
+}
+
+static void setup(void)
+{
+    node_data *nd;
+    int i;
+
+    for (i = 0;  i < NNODE;  i++) {
+        nd = nodes + i;
+
+        snprintf(names[i], sizeof(names[i]), "alsa_output.%d.analog", i);
+
+        nd->id      = (uint16_t)(i + 1);
+        nd->name    = names[i];
+        nd->domain  = 1;
+        nd->class   = (uint16_t)(i % 8 + 1);
+        nd->volume  = 0;
+        nd->visible = TRUE;
+        nd->status  = 1;
+        nd->reason  = 0;
+        nd->mute    = 2;
+        nd->mainvol = 0;
+
+        cache[i] = build_registration(nd);
+    }
+
+    acktmpl = dbus_message_new_method_call(AM_DEST, AM_PATH, AM_IFACE,
+                                           "ackConnect");
+}
+
+static void report(const char *what, uint64_t ns, int nburst, size_t bytes)
+{
+    printf("  %-28s %8.2f us/burst  %6.0f ns/message  (%zu bytes/burst)\n",
+           what, (double)ns / (nburst * 1000.0),
+           (double)ns / ((double)nburst * NNODE), bytes / (size_t)nburst);
+}
+
+int main(int argc, char **argv)
+{
+    DBusMessage *msg;
+    int nburst = DEFAULT_BURSTS;
+    uint64_t start;
+    size_t bytes;
+    int b, i;
+
+    if (argc > 1 && (nburst = atoi(argv[1])) <= 0) {
+        fprintf(stderr, "usage: %s [bursts]\n", argv[0]);
+        return 1;
+    }
+
+    setup();
+
+    printf("%d bursts of %d messages\n", nburst, NNODE);
+
+    bytes = 0;
+    start = now_ns();
+    for (b = 0;  b < nburst;  b++) {
+        for (i = 0;  i < NNODE;  i++)
+            bytes += marshal(build_registration(nodes + i));
+    }
+    report("registration, marshalled", now_ns() - start, nburst, bytes);
+
+    bytes = 0;
+    start = now_ns();
+    for (b = 0;  b < nburst;  b++) {
+        for (i = 0;  i < NNODE;  i++)
+            bytes += marshal(dbus_message_copy(cache[i]));
+    }
+    report("registration, cached", now_ns() - start, nburst, bytes);
+
+    bytes = 0;
+    start = now_ns();
+    for (b = 0;  b < nburst;  b++) {
+        for (i = 0;  i < NNODE;  i++) {
+            msg = dbus_message_new_method_call(AM_DEST, AM_PATH, AM_IFACE,
+                                               "ackConnect");
+            if (msg && !append_ack(msg, (uint16_t)i)) {
+                dbus_message_unref(msg);
+                msg = NULL;
+            }
+            bytes += marshal(msg);
+        }
+    }
+    report("ack, from scratch", now_ns() - start, nburst, bytes);
+
+    bytes = 0;
+    start = now_ns();
+    for (b = 0;  b < nburst;  b++) {
+        for (i = 0;  i < NNODE;  i++) {
+            msg = dbus_message_copy(acktmpl);
+            if (msg && !append_ack(msg, (uint16_t)i)) {
+                dbus_message_unref(msg);
+                msg = NULL;
+            }
+            bytes += marshal(msg);
+        }
+    }
+    report("ack, from template", now_ns() - start, nburst, bytes);
+
+    for (i = 0;  i < NNODE;  i++) {
+        if (cache[i])
+            dbus_message_unref(cache[i]);
+    }
+
+    if (acktmpl)
+        dbus_message_unref(acktmpl);
+
+    return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
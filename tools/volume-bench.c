@@ -0,0 +1,261 @@
+/*
+ * module-murphy-ivi -- PulseAudio module for providing audio routing support
+ * Copyright (c) 2012, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St - Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Volume limit benchmark (murphy/volume.c)
+ *
+ * It compiles murphy/volume.c in, sets up the kind of limits the default
+ * scripts register (a generic suppression, a correction and a per-class
+ * suppression for every class), and then times limiting passes over
+ * 500 streams spread over 20 zones, each zone having its own output
+ * device. For comparison it times the same pass done the way it used to
+ * be done, ie. with the limits summed in dB and a pa_sw_volume_from_dB()
+ * per stream.
+ *
+ * It is not part of the build. It needs the same headers as the module:
+ *
+ *     cc -O2 -I murphy $(pkg-config --cflags libpulse murphy-domain-controller) \
+ *        -o volume-bench tools/volume-bench.c \
+ *        -lpulsecore-<version> $(pkg-config --libs libpulse) -lm
+ *     ./volume-bench [passes]
+ */
+
+#include "../murphy/volume.c"
+
+#include <time.h>
+
+#define NSTREAM      500
+#define NZONE         20
+#define NCLASS      (mir_application_class_end - mir_application_class_begin)
+#define DEFAULT_PASS 1000
+
+typedef struct {
+    int       class;
+    mir_node *device;
+} bench_stream;
+
+
+/*
+ * the rest of the module is not compiled in;
+ * these are the bits volume.c needs from it
+ */
+uint32_t pa_utils_new_stamp(void)
+{
+    static uint32_t stamp;
+
+    return ++stamp;
+}
+
+void pa_fader_apply_volume_limits(struct userdata *u, uint32_t stamp)
+{
+    (void)u;
+    (void)stamp;
+}
+
+const char *mir_node_type_str(mir_node_type type)
+{
+    (void)type;
+
+    return "<class>";
+}
+
+
+static double    attenuation = -20.0;
+static double    correction  = -3.5;
+static double   *correctionp = &correction;
+
+static mir_volume_suppress_arg generic;
+static mir_volume_suppress_arg perclass[NCLASS];
+
+static mir_node      devices[NZONE];
+static bench_stream  streams[NSTREAM];
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void setup(struct userdata *u)
+{
+    mir_node *dev;
+    int class;
+    int i;
+
+    pa_assert_se((u->volume = pa_mir_volume_init(u)));
+
+    /* phone and alert suppress everything else */
+    generic.attenuation = &attenuation;
+    generic.trigger.clmask = (1U << (mir_phone - mir_application_class_begin)) |
+                             (1U << (mir_alert - mir_application_class_begin));
+
+    mir_volume_add_generic_limit(u, mir_volume_suppress, &generic);
+    mir_volume_add_generic_limit(u, mir_volume_correction, &correctionp);
+
+    /* and each class is suppressed by the next one */
+    for (i = 0;  i < NCLASS;  i++) {
+        class = mir_application_class_begin + i;
+
+        perclass[i].attenuation = &attenuation;
+        perclass[i].trigger.clmask = 1U << ((i + 1) % NCLASS);
+
+        mir_volume_add_class_limit(u, class, mir_volume_suppress,
+                                   perclass + i);
+    }
+
+    for (i = 0;  i < NZONE;  i++) {
+        dev = devices + i;
+
+        dev->direction = mir_output;
+        dev->implement = mir_device;
+        dev->privacy   = (i & 1) ? mir_private : mir_public;
+        dev->amname    = "bench";
+    }
+
+    for (i = 0;  i < NSTREAM;  i++) {
+        streams[i].class  = mir_application_class_begin + (i % NCLASS);
+        streams[i].device = devices + (i % NZONE);
+    }
+}
+
+static void make_limiting(struct userdata *u)
+{
+    uint32_t stamp = pa_utils_new_stamp();
+    int i;
+
+    for (i = 0;  i < NSTREAM;  i++) {
+        mir_volume_add_limiting_class(u, streams[i].device,
+                                      streams[i].class, stamp);
+    }
+}
+
+static pa_volume_t pass_mB(struct userdata *u, uint32_t stamp)
+{
+    bench_stream *s;
+    pa_volume_t sum = 0;
+    int mB;
+    int i;
+
+    for (i = 0;  i < NSTREAM;  i++) {
+        s = streams + i;
+        mB = mir_volume_apply_limits(u, s->device, s->class, stamp);
+        sum += mir_volume_from_mB(u, mB);
+    }
+
+    return sum;
+}
+
+static pa_volume_t pass_dB(struct userdata *u)
+{
+    pa_mir_volume *volume = u->volume;
+    bench_stream *s;
+    vlim_table *tbl;
+    vlim_entry *e;
+    pa_volume_t sum = 0;
+    double dB, devlim, classlim, a;
+    size_t j;
+    int i;
+
+    for (i = 0;  i < NSTREAM;  i++) {
+        s = streams + i;
+
+        devlim = classlim = 0.0;
+
+        for (j = 0;  j < volume->genlim.nentry;  j++) {
+            e = volume->genlim.entries + j;
+            if ((a = e->func(u, s->class, s->device, e->arg)) < devlim)
+                devlim = a;
+        }
+
+        tbl = volume->classlim + s->class;
+
+        for (j = 0;  j < tbl->nentry;  j++) {
+            e = tbl->entries + j;
+            if ((a = e->func(u, s->class, s->device, e->arg)) < classlim)
+                classlim = a;
+        }
+
+        dB = devlim + classlim;
+        sum += pa_sw_volume_from_dB(dB);
+    }
+
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    struct userdata u;
+    int npass = DEFAULT_PASS;
+    uint64_t start, mB_ns, dB_ns;
+    pa_volume_t check_mB = 0, check_dB = 0;
+    int i;
+
+    if (argc > 1 && (npass = atoi(argv[1])) <= 0) {
+        fprintf(stderr, "usage: %s [passes]\n", argv[0]);
+        return 1;
+    }
+
+    pa_log_set_level(PA_LOG_ERROR);
+
+    memset(&u, 0, sizeof(u));
+    setup(&u);
+    make_limiting(&u);
+
+    /* compile the pipelines outside of the timed loop */
+    pass_mB(&u, 0);
+
+    start = now_ns();
+    for (i = 0;  i < npass;  i++)
+        check_mB += pass_mB(&u, i);
+    mB_ns = now_ns() - start;
+
+    start = now_ns();
+    for (i = 0;  i < npass;  i++)
+        check_dB += pass_dB(&u);
+    dB_ns = now_ns() - start;
+
+    printf("%d streams, %d zones, %d passes\n", NSTREAM, NZONE, npass);
+    printf("  fixed point: %8.1f ns/stream  %8.1f us/pass\n",
+           (double)mB_ns / ((double)npass * NSTREAM),
+           (double)mB_ns / (npass * 1000.0));
+    printf("  dB + pow():  %8.1f ns/stream  %8.1f us/pass\n",
+           (double)dB_ns / ((double)npass * NSTREAM),
+           (double)dB_ns / (npass * 1000.0));
+
+    if (check_mB != check_dB)
+        printf("  note: the two passes disagree on the resulting volumes\n");
+
+    pa_mir_volume_done(&u);
+
+    return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */